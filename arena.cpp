@@ -0,0 +1,156 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Each block is preceded by its size, and both are kept 16-byte aligned.
+const size_t ALIGNMENT = 16;
+const size_t HEADER = ALIGNMENT;
+
+size_t roundUp(size_t size) {
+  return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+size_t& blockSize(void* ptr) {
+  return *(size_t*) ((unsigned char*) ptr - HEADER);
+}
+
+void* lodepngMalloc(size_t size, void* context) {
+  return ((Arena*) context)->allocate(size);
+}
+
+void* lodepngRealloc(void* ptr, size_t size, void* context) {
+  return ((Arena*) context)->reallocate(ptr, size);
+}
+
+void lodepngFree(void* ptr, void* context) {
+  ((Arena*) context)->release(ptr);
+}
+
+} // namespace
+
+Arena::Arena(size_t chunkSize) : chunkSize(chunkSize), live(0), last(NULL) {}
+
+Arena::~Arena() {
+  for(const Chunk& chunk : chunks) {
+    std::free(chunk.data);
+  }
+}
+
+void* Arena::allocate(size_t size) {
+  size_t need = HEADER + roundUp(size);
+  if(chunks.empty() || chunks.back().used + need > chunks.back().size) {
+    Chunk chunk;
+    chunk.size = need > chunkSize ? need : chunkSize;
+    chunk.data = (unsigned char*) std::malloc(chunk.size);
+    chunk.used = 0;
+    if(!chunk.data) {
+      return NULL;
+    }
+    chunks.push_back(chunk);
+  }
+  Chunk& chunk = chunks.back();
+  last = chunk.data + chunk.used + HEADER;
+  blockSize(last) = roundUp(size);
+  chunk.used += need;
+  live++;
+  return last;
+}
+
+void* Arena::reallocate(void* ptr, size_t size) {
+  if(!ptr) {
+    return allocate(size);
+  }
+  if(!owns(ptr)) {
+    return std::realloc(ptr, size);
+  }
+  size_t oldSize = blockSize(ptr);
+  if(ptr == last) {
+    Chunk& chunk = chunks.back();
+    size_t start = (unsigned char*) ptr - chunk.data;
+    if(start + roundUp(size) <= chunk.size) {
+      blockSize(ptr) = roundUp(size);
+      chunk.used = start + roundUp(size);
+      return ptr;
+    }
+  }
+  if(size <= oldSize) {
+    return ptr;
+  }
+  void* moved = allocate(size);
+  if(!moved) {
+    return NULL;
+  }
+  std::memcpy(moved, ptr, oldSize);
+  release(ptr);
+  return moved;
+}
+
+void Arena::release(void* ptr) {
+  if(!ptr) {
+    return;
+  }
+  if(!owns(ptr)) {
+    std::free(ptr);
+    return;
+  }
+  if(ptr == last) {
+    chunks.back().used = (unsigned char*) ptr - HEADER - chunks.back().data;
+    last = NULL;
+  }
+  if(--live == 0) {
+    rewind();
+  }
+}
+
+LodePNGAllocator Arena::lodepngAllocator() {
+  LodePNGAllocator allocator;
+  allocator.malloc = lodepngMalloc;
+  allocator.realloc = lodepngRealloc;
+  allocator.free = lodepngFree;
+  allocator.context = this;
+  return allocator;
+}
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for(const Chunk& chunk : chunks) {
+    total += chunk.size;
+  }
+  return total;
+}
+
+bool Arena::owns(const void* ptr) const {
+  const unsigned char* p = (const unsigned char*) ptr;
+  for(const Chunk& chunk : chunks) {
+    if(p >= chunk.data && p < chunk.data + chunk.size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Arena::rewind() {
+  last = NULL;
+  if(chunks.size() > 1) {
+    // One chunk the size of all of them holds the next round in one piece.
+    size_t total = capacity();
+    for(const Chunk& chunk : chunks) {
+      std::free(chunk.data);
+    }
+    chunks.clear();
+    Chunk chunk;
+    chunk.data = (unsigned char*) std::malloc(total);
+    chunk.size = total;
+    chunk.used = 0;
+    if(chunk.data) {
+      chunks.push_back(chunk);
+    }
+    return;
+  }
+  if(!chunks.empty()) {
+    chunks.back().used = 0;
+  }
+}
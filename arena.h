@@ -0,0 +1,54 @@
+#ifndef CPP_ARENA_H
+#define CPP_ARENA_H
+
+#include "lodepng.h"
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocation for short-lived work such as encoding one PNG. Blocks are
+// carved out of large chunks one after the other; the most recent block can
+// grow or shrink in place, and freeing it gives its space back. Other frees
+// only count down, and once every block has been freed the arena starts over
+// from the beginning, merging its chunks into one so that the next round of
+// the same work fits without asking the system for memory.
+//
+// Not thread-safe: give each thread its own.
+class Arena {
+  public:
+    explicit Arena(size_t chunkSize = 1 << 20);
+    ~Arena();
+
+    void* allocate(size_t size);
+    // Memory from elsewhere is passed on to realloc and free, so that buffers
+    // lodepng's custom deflate hands over with malloc can be freed through
+    // the arena too.
+    void* reallocate(void* ptr, size_t size);
+    void release(void* ptr);
+
+    // For lodepng_set_allocator and lodepng::Encoder.
+    LodePNGAllocator lodepngAllocator();
+
+    // Bytes reserved from the system, across all chunks.
+    size_t capacity() const;
+
+  private:
+    struct Chunk {
+      unsigned char* data;
+      size_t size;
+      size_t used;
+    };
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    bool owns(const void* ptr) const;
+    void rewind();
+
+    const size_t chunkSize;
+    std::vector<Chunk> chunks;  // allocation goes on in the last one
+    size_t live;                // blocks allocated and not yet freed
+    unsigned char* last;        // the most recent block, if not freed since
+};
+
+#endif //CPP_ARENA_H
@@ -0,0 +1,88 @@
+#ifndef CPP_BOUNDED_QUEUE_H
+#define CPP_BOUNDED_QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// A fixed-capacity FIFO between pipeline stages. push blocks while the queue
+// is full, which is what bounds the number of frames held in memory.
+template<typename T>
+class BoundedQueue {
+  public:
+    struct Stats {
+      size_t pushes;
+      size_t occupancySum;  // queue length after each push, summed
+      size_t maxOccupancy;
+      size_t fullStalls;    // pushes that had to wait for space
+      double stalledMs;
+      size_t emptyWaits;    // pops that had to wait for an item
+    };
+
+    explicit BoundedQueue(size_t capacity)
+      : capacity(capacity > 0 ? capacity : 1), closed(false), stats_() {}
+
+    void push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(items.size() >= capacity) {
+        ++stats_.fullStalls;
+        auto start = std::chrono::steady_clock::now();
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        stats_.stalledMs += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+      }
+      items.push_back(std::move(item));
+      ++stats_.pushes;
+      stats_.occupancySum += items.size();
+      if(items.size() > stats_.maxOccupancy) {
+        stats_.maxOccupancy = items.size();
+      }
+      lock.unlock();
+      notEmpty.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained.
+    bool pop(T& item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      if(items.empty() && !closed) {
+        ++stats_.emptyWaits;
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+      }
+      if(items.empty()) {
+        return false;
+      }
+      item = std::move(items.front());
+      items.pop_front();
+      lock.unlock();
+      notFull.notify_one();
+      return true;
+    }
+
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+      }
+      notEmpty.notify_all();
+    }
+
+    size_t getCapacity() const { return capacity; }
+
+    Stats stats() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats_;
+    }
+
+  private:
+    const size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    bool closed;
+    Stats stats_;
+};
+
+#endif //CPP_BOUNDED_QUEUE_H
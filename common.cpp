@@ -1,7 +1,11 @@
 
 #include "common.h"
 
+#include "trace.h"
+
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 const char *gl_error_to_str(EGLint error){
     switch(error){
@@ -23,15 +27,34 @@ const char *gl_error_to_str(EGLint error){
     }
 }
 
+static bool has_extension(const char *extensions, const char *name) {
+  if(extensions == NULL) {
+    return false;
+  }
+  const size_t length = strlen(name);
+  for(const char *p = strstr(extensions, name); p != NULL; p = strstr(p + length, name)) {
+    if((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
 bool init_gl(
     const int width,
     const int height,
     EGLDisplay& display,
     EGLConfig& config,
     EGLContext& context,
-    EGLSurface& surface
+    EGLSurface& surface,
+    bool request_robustness
   ) {
 
+  TraceSpan span("init_gl");
+  if(!loadGLLibraries()) {
+    return false;
+  }
+
   const EGLint config_attribute_list[] =
       {
           //EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
@@ -46,10 +69,9 @@ bool init_gl(
           EGL_NONE
       };
 
-  const EGLint context_attrib_list[] =
+  std::vector<EGLint> context_attrib_list =
       {
           EGL_CONTEXT_CLIENT_VERSION, 3,
-          EGL_NONE
       };
 
   const EGLint pbuffer_attrib_list[] =
@@ -83,7 +105,26 @@ bool init_gl(
     return false;
   }
 
-  context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attrib_list);
+  // A robust context turns a GPU reset caused by a runaway shader into a lost
+  // context for this process only, rather than undefined behaviour.
+  bool robust = request_robustness &&
+      has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_EXT_create_context_robustness");
+  if(robust) {
+    context_attrib_list.push_back(EGL_CONTEXT_OPENGL_ROBUST_ACCESS_EXT);
+    context_attrib_list.push_back(EGL_TRUE);
+    context_attrib_list.push_back(EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_EXT);
+    context_attrib_list.push_back(EGL_LOSE_CONTEXT_ON_RESET_EXT);
+  }
+  context_attrib_list.push_back(EGL_NONE);
+
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, &context_attrib_list[0]);
+
+  if(context == EGL_NO_CONTEXT && robust) {
+    std::cerr << "Warning: robust context creation failed, falling back to a default context." << std::endl;
+    context_attrib_list.resize(2);
+    context_attrib_list.push_back(EGL_NONE);
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, &context_attrib_list[0]);
+  }
 
   if(context == EGL_NO_CONTEXT) {
     std::cerr << "eglCreateContext failed: " << std::hex << eglGetError() << std::endl;
@@ -1,7 +1,7 @@
 #ifndef CPP_COMMON_H
 #define CPP_COMMON_H
 
-#include "EGL/egl.h"
+#include "gl_dispatch.h"
 
 bool init_gl(
     const int width,
@@ -9,7 +9,8 @@ bool init_gl(
     EGLDisplay& display,
     EGLConfig& config,
     EGLContext& context,
-    EGLSurface& surface
+    EGLSurface& surface,
+    bool request_robustness = false
 );
 
 #endif //CPP_COMMON_H
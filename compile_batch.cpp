@@ -0,0 +1,147 @@
+#include "compile_batch.h"
+
+#include "gl_info.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+// Only needs to hold a program, never to draw into it.
+#define COMPILE_SURFACE_SIZE (16)
+
+namespace {
+
+// State shared by the compile threads.
+struct CompileQueue {
+  const std::vector<Job>& jobs;
+  const CompileBatchOptions& options;
+  std::ostream& out;
+  std::vector<int>& results;
+  std::atomic<size_t> next;
+  std::mutex outMutex;
+  std::mutex initMutex;
+
+  CompileQueue(
+      const std::vector<Job>& jobs,
+      const CompileBatchOptions& options,
+      std::ostream& out,
+      std::vector<int>& results)
+    : jobs(jobs), options(options), out(out), results(results), next(0) {}
+};
+
+}
+
+static const char* statusName(int result) {
+  switch(result) {
+    case EXIT_SUCCESS:
+      return "ok";
+    case COMPILE_ERROR_EXIT_CODE:
+      return "compile_error";
+    case LINK_ERROR_EXIT_CODE:
+      return "link_error";
+    default:
+      return "error";
+  }
+}
+
+static void compileJobs(CompileQueue& queue) {
+  nameTraceThread("compile");
+  EGLDisplay display = 0;
+  EGLConfig config = 0;
+  EGLContext context = 0;
+  EGLSurface surface = 0;
+
+  bool initialised;
+  {
+    // Display initialisation is not safe to race in every EGL.
+    std::lock_guard<std::mutex> lock(queue.initMutex);
+    initialised = init_gl(COMPILE_SURFACE_SIZE, COMPILE_SURFACE_SIZE, display, config, context, surface,
+                          queue.options.timeoutMs > 0);
+  }
+  if(!initialised) {
+    return;
+  }
+
+  Watchdog watchdog(queue.options.timeoutMs, TIMEOUT_EXIT_CODE);
+  // The records may be going to stdout; the timeout is still on stderr.
+  watchdog.setStdoutReport(false);
+
+  DiagnosticsCache diagnostics;
+  diagnostics.dir = queue.options.diagnosticsCache;
+  if(diagnostics.dir.length() > 0) {
+    diagnostics.driverIdentity = driverIdentity(display);
+  }
+
+  for(;;) {
+    size_t i = queue.next++;
+    if(i >= queue.jobs.size()) {
+      break;
+    }
+    const Job& job = queue.jobs[i];
+
+    BuildReport report = BuildReport();
+    int result;
+    std::string fragContents;
+    if(!readFile(job.fragment_shader, fragContents)) {
+      result = EXIT_FAILURE;
+      report.infoLog = "File " + job.fragment_shader + " not found";
+    } else {
+      GLuint program = 0;
+      watchdog.arm("compile");
+      result = buildProgram(fragContents, queue.options.vertex_shader, queue.options.stopAfter, program,
+                            watchdog, &report, diagnostics.dir.length() > 0 ? &diagnostics : NULL);
+      watchdog.disarm();
+      glDeleteProgram(program);
+    }
+
+    json record;
+    record["index"] = i;
+    record["shader"] = job.fragment_shader;
+    record["status"] = statusName(result);
+    record["exit_code"] = result;
+    record["info_log"] = report.infoLog;
+    record["compile_ms"] = report.compileMs;
+    if(report.cached) {
+      record["cached"] = true;
+    }
+    if(queue.options.stopAfter != BUILD_COMPILE && result != COMPILE_ERROR_EXIT_CODE) {
+      record["link_ms"] = report.linkMs;
+    }
+
+    queue.results[i] = result;
+    std::lock_guard<std::mutex> lock(queue.outMutex);
+    queue.out << record.dump() << "\n";
+    queue.out.flush();
+  }
+
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroySurface(display, surface);
+  eglDestroyContext(display, context);
+  eglReleaseThread();
+}
+
+void runCompileBatch(
+    const std::vector<Job>& jobs,
+    const CompileBatchOptions& options,
+    std::ostream& out,
+    std::vector<int>& results) {
+
+  // Jobs no thread got to (e.g. no context could be created) stay failed.
+  results.assign(jobs.size(), EXIT_FAILURE);
+
+  CompileQueue queue(jobs, options, out, results);
+  size_t threadCount = options.threads > 0 ? options.threads : 1;
+  std::vector<std::thread> threads;
+  for(size_t t = 0; t < threadCount; t++) {
+    threads.push_back(std::thread(compileJobs, std::ref(queue)));
+  }
+  for(size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+}
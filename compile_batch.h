@@ -0,0 +1,33 @@
+#ifndef CPP_COMPILE_BATCH_H
+#define CPP_COMPILE_BATCH_H
+
+#include "job.h"
+#include "renderer.h"
+
+#include <ostream>
+#include <vector>
+
+struct CompileBatchOptions {
+  std::string vertex_shader;
+  // BUILD_COMPILE or BUILD_LINK.
+  BuildStage stopAfter;
+  // Threads, each with a context of its own.
+  size_t threads;
+  // Watchdog budget per shader; 0 disables it.
+  long timeoutMs;
+  // Diagnostics cache directory, or empty; see diagnostics_cache.h.
+  std::string diagnosticsCache;
+};
+
+// Compiles (and with BUILD_LINK, links) every job's fragment shader without
+// drawing anything, writing one JSON object per line to out as each finishes:
+//   {"index", "shader", "status", "exit_code", "info_log", "compile_ms"[, "link_ms"][, "cached"]}
+// status is "ok", "compile_error", "link_error" or "error". results[i] is set
+// to the exit code for jobs[i].
+void runCompileBatch(
+    const std::vector<Job>& jobs,
+    const CompileBatchOptions& options,
+    std::ostream& out,
+    std::vector<int>& results);
+
+#endif //CPP_COMPILE_BATCH_H
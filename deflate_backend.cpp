@@ -0,0 +1,35 @@
+#include "deflate_backend.h"
+
+#include "fast_deflate.h"
+
+const std::vector<DeflateBackend>& deflateBackends() {
+  static const std::vector<DeflateBackend> backends = {
+    {"lodepng", "lodepng's deflate, tuned by --png-level", NULL},
+    {"fast", "greedy matching and fixed Huffman codes", fastDeflate},
+  };
+  return backends;
+}
+
+const DeflateBackend* findDeflateBackend(const std::string& name) {
+  for(const DeflateBackend& backend : deflateBackends()) {
+    if(name == backend.name) {
+      return &backend;
+    }
+  }
+  return NULL;
+}
+
+std::string deflateBackendNames() {
+  std::string names;
+  for(const DeflateBackend& backend : deflateBackends()) {
+    if(!names.empty()) {
+      names += "|";
+    }
+    names += backend.name;
+  }
+  return names;
+}
+
+void useDeflateBackend(const DeflateBackend& backend, LodePNGCompressSettings& settings) {
+  settings.custom_deflate = backend.deflate;
+}
@@ -0,0 +1,35 @@
+#ifndef CPP_DEFLATE_BACKEND_H
+#define CPP_DEFLATE_BACKEND_H
+
+#include "lodepng.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A deflate implementation for the PNG encoder, plugged into lodepng through
+// LodePNGCompressSettings::custom_deflate.
+struct DeflateBackend {
+  const char* name;
+  const char* description;
+  // NULL for lodepng's own deflate.
+  unsigned (*deflate)(
+      unsigned char** out,
+      size_t* outsize,
+      const unsigned char* in,
+      size_t insize,
+      const LodePNGCompressSettings* settings);
+};
+
+// Every backend, the default ("lodepng") first.
+const std::vector<DeflateBackend>& deflateBackends();
+
+// NULL if no backend has that name.
+const DeflateBackend* findDeflateBackend(const std::string& name);
+
+// Names of all backends separated by '|', for usage messages.
+std::string deflateBackendNames();
+
+void useDeflateBackend(const DeflateBackend& backend, LodePNGCompressSettings& settings);
+
+#endif //CPP_DEFLATE_BACKEND_H
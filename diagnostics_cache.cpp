@@ -0,0 +1,143 @@
+#include "diagnostics_cache.h"
+
+#include "file_util.h"
+#include "hash.h"
+#include "renderer.h"
+
+#include <fstream>
+#include <iostream>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+// Bump when normalisation or the entry layout changes.
+#define DIAGNOSTICS_CACHE_VERSION (2)
+
+std::string normaliseShaderSource(const std::string& source) {
+  std::string result;
+  result.reserve(source.length());
+  bool blockComment = false;
+  bool pendingBlank = false;
+  for(size_t i = 0; i < source.length(); i++) {
+    char c = source[i];
+    char next = i + 1 < source.length() ? source[i + 1] : '\0';
+    if(blockComment) {
+      if(c == '*' && next == '/') {
+        blockComment = false;
+        pendingBlank = true;
+        ++i;
+      } else if(c == '\n') {
+        result += '\n';
+      }
+      continue;
+    }
+    if(c == '/' && next == '*') {
+      blockComment = true;
+      ++i;
+      continue;
+    }
+    if(c == '/' && next == '/') {
+      while(i + 1 < source.length() && source[i + 1] != '\n') {
+        ++i;
+      }
+      continue;
+    }
+    if(c == '\r') {
+      continue;
+    }
+    if(c == '\n') {
+      pendingBlank = false;
+      result += '\n';
+      continue;
+    }
+    if(c == ' ' || c == '\t') {
+      pendingBlank = true;
+      continue;
+    }
+    // A single blank between tokens, none at either end of the line.
+    if(pendingBlank && !result.empty() && result[result.length() - 1] != '\n') {
+      result += ' ';
+    }
+    pendingBlank = false;
+    result += c;
+  }
+  return result;
+}
+
+// One line per input, none of which can contain a newline, so no two sets of
+// inputs hash the same text.
+static void nameKey(const char* stage, BuildFailureKey& key) {
+  Hasher hasher;
+  hasher.update(std::string("get_image ") + stage + " " + std::to_string(DIAGNOSTICS_CACHE_VERSION) + "\n");
+  for(std::map<std::string, std::string>::const_iterator it = key.inputs.begin(); it != key.inputs.end(); ++it) {
+    hasher.update(it->first + " " + it->second + "\n");
+  }
+  key.name = hasher.hexDigest();
+}
+
+BuildFailureKey compileFailureKey(const DiagnosticsCache& cache, const std::string& fragContents) {
+  BuildFailureKey key;
+  key.inputs["fragment"] = Hasher().update(normaliseShaderSource(fragContents)).hexDigest();
+  key.inputs["driver"] = Hasher().update(cache.driverIdentity).hexDigest();
+  nameKey("compile", key);
+  return key;
+}
+
+BuildFailureKey linkFailureKey(
+    const DiagnosticsCache& cache,
+    const std::string& fragContents,
+    const std::string& vertexContents) {
+  BuildFailureKey key;
+  key.inputs["fragment"] = Hasher().update(normaliseShaderSource(fragContents)).hexDigest();
+  key.inputs["vertex"] = Hasher().update(normaliseShaderSource(vertexContents)).hexDigest();
+  key.inputs["driver"] = Hasher().update(cache.driverIdentity).hexDigest();
+  nameKey("link", key);
+  return key;
+}
+
+static std::string entryPath(const DiagnosticsCache& cache, const BuildFailureKey& key) {
+  return cache.dir + "/" + key.name + ".diag.json";
+}
+
+bool lookupBuildFailure(
+    const DiagnosticsCache& cache, const BuildFailureKey& key, int& exitCode, std::string& infoLog) {
+  std::ifstream ifs(entryPath(cache, key).c_str());
+  if(!ifs) {
+    return false;
+  }
+  try {
+    json entry = json::parse(ifs);
+    if(entry.value("cache_version", 0) != DIAGNOSTICS_CACHE_VERSION) {
+      return false;
+    }
+    // Other shaders whose inputs hash to the same name.
+    if(entry.value("inputs", json::object()) != json(key.inputs) ||
+       entry.value("driver_identity", std::string()) != cache.driverIdentity) {
+      std::cerr << "Warning: diagnostics cache entry " << key.name << " was made from other inputs; compiling."
+                << std::endl;
+      return false;
+    }
+    exitCode = entry.value("exit_code", 0);
+    infoLog = entry.value("info_log", std::string());
+  } catch(const std::exception& e) {
+    std::cerr << "Warning: ignoring unreadable diagnostics cache entry " << key.name << ": " << e.what() << std::endl;
+    return false;
+  }
+  return exitCode == COMPILE_ERROR_EXIT_CODE || exitCode == LINK_ERROR_EXIT_CODE;
+}
+
+bool storeBuildFailure(
+    const DiagnosticsCache& cache, const BuildFailureKey& key, int exitCode, const std::string& infoLog) {
+  json entry;
+  entry["cache_version"] = DIAGNOSTICS_CACHE_VERSION;
+  entry["inputs"] = key.inputs;
+  entry["driver_identity"] = cache.driverIdentity;
+  entry["exit_code"] = exitCode;
+  entry["info_log"] = infoLog;
+  if(!makeDirectory(cache.dir) ||
+     !writeFileAtomic(entryPath(cache, key), entry.dump(4) + "\n")) {
+    std::cerr << "Warning: could not write diagnostics cache entry in " << cache.dir << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef CPP_DIAGNOSTICS_CACHE_H
+#define CPP_DIAGNOSTICS_CACHE_H
+
+#include <map>
+#include <string>
+
+// Remembers which shaders failed to compile or link on a driver, with the
+// info log, so resubmitting one is answered without calling the compiler.
+// Entries are keyed by a hash of the normalised sources and the driver
+// identity, whose digests are kept in the entry and compared on a hit, and
+// renamed into place so processes can share the directory.
+struct DiagnosticsCache {
+  std::string dir;
+  std::string driverIdentity;
+};
+
+struct BuildFailureKey {
+  // Input ("fragment", "vertex", "driver") to the hash of its normalised
+  // contents.
+  std::map<std::string, std::string> inputs;
+  // The entry name, a hash of the stage and the input digests.
+  std::string name;
+};
+
+// Strips comments, trailing whitespace and runs of blanks, keeping line
+// breaks so that line numbers in cached logs still match.
+std::string normaliseShaderSource(const std::string& source);
+
+// The key for a fragment shader on its own, or with its vertex shader when
+// linking.
+BuildFailureKey compileFailureKey(const DiagnosticsCache& cache, const std::string& fragContents);
+
+BuildFailureKey linkFailureKey(
+    const DiagnosticsCache& cache,
+    const std::string& fragContents,
+    const std::string& vertexContents);
+
+// On a hit whose entry was made from the same inputs sets exitCode
+// (COMPILE_ERROR_EXIT_CODE or LINK_ERROR_EXIT_CODE) and infoLog.
+bool lookupBuildFailure(
+    const DiagnosticsCache& cache, const BuildFailureKey& key, int& exitCode, std::string& infoLog);
+
+bool storeBuildFailure(
+    const DiagnosticsCache& cache, const BuildFailureKey& key, int exitCode, const std::string& infoLog);
+
+#endif //CPP_DIAGNOSTICS_CACHE_H
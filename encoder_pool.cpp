@@ -0,0 +1,137 @@
+#include "encoder_pool.h"
+
+#include "hash.h"
+#include "renderer.h"
+#include "result_cache.h"
+#include "trace.h"
+
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+
+EncoderPool::EncoderPool(
+    size_t threads,
+    size_t queueDepth,
+    const std::string& resultCache,
+    PackWriter* pack,
+    PackKind packKind,
+    const std::vector<Job>& jobs,
+    std::vector<int>& results)
+  : resultCache(resultCache),
+    pack(pack),
+    packKind(packKind),
+    jobs(jobs),
+    results(results),
+    queue(queueDepth),
+    threadCount(threads > 0 ? threads : 1),
+    reusedBuffers(0),
+    newBuffers(0) {
+  // Every buffer is either queued, being encoded, being read back into, or
+  // free; there is no point keeping more free ones than could ever be in use.
+  maxFreeBuffers = queue.getCapacity() + threadCount + 1;
+  for(size_t i = 0; i < threadCount; i++) {
+    this->threads.push_back(std::thread(&EncoderPool::run, this, i));
+  }
+}
+
+EncoderPool::~EncoderPool() {
+  finish();
+}
+
+void EncoderPool::submit(Frame frame) {
+  // Long spans here are the render thread waiting for the encoders.
+  TraceSpan span("submit");
+  queue.push(std::move(frame));
+}
+
+std::vector<std::uint8_t> EncoderPool::acquireBuffer() {
+  std::lock_guard<std::mutex> lock(freeListMutex);
+  if(freeList.empty()) {
+    ++newBuffers;
+    return std::vector<std::uint8_t>();
+  }
+  ++reusedBuffers;
+  std::vector<std::uint8_t> buffer = std::move(freeList.back());
+  freeList.pop_back();
+  return buffer;
+}
+
+void EncoderPool::finish() {
+  queue.close();
+  for(size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  threads.clear();
+}
+
+void EncoderPool::reportStats() {
+  BoundedQueue<Frame>::Stats stats = queue.stats();
+  double meanOccupancy = stats.pushes > 0 ? (double) stats.occupancySum / stats.pushes : 0.0;
+  std::lock_guard<std::mutex> lock(freeListMutex);
+  std::cerr << "Pipeline: " << stats.pushes << " frames, queue depth " << queue.getCapacity()
+            << ", mean occupancy " << meanOccupancy
+            << ", max occupancy " << stats.maxOccupancy
+            << ", " << stats.fullStalls << " render stalls (" << stats.stalledMs << " ms)"
+            << ", " << stats.emptyWaits << " encoder waits." << std::endl;
+  std::cerr << "Encoder pool: " << threadCount << " threads, "
+            << newBuffers << " buffers allocated, " << reusedBuffers << " reused." << std::endl;
+}
+
+// Only the append itself is serialised; encoding and hashing run in
+// parallel on the pool's threads.
+static int packFrame(PackWriter& pack, PackKind kind, const std::string& output, Frame& frame) {
+  flipRows(frame.pixels, frame.width, frame.height);
+  PackEntry entry;
+  entry.job = frame.job;
+  entry.kind = kind;
+  entry.width = frame.width;
+  entry.height = frame.height;
+  entry.pixelHash = Hasher().update(frame.pixels.data(), frame.pixels.size()).digest();
+  entry.name = output;
+  const void* data = NULL;
+  entry.length = 0;
+  if(kind == PACK_PNG) {
+    const unsigned char* png;
+    size_t pngSize;
+    if(encodePNG(frame.pixels, frame.width, frame.height, &png, &pngSize) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+    data = png;
+    entry.length = pngSize;
+  } else if(kind == PACK_RAW) {
+    data = frame.pixels.data();
+    entry.length = frame.pixels.size();
+  }
+  TraceSpan append("pack_append");
+  return pack.append(entry, data) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void EncoderPool::run(size_t index) {
+  nameTraceThread("encoder " + std::to_string(index));
+  Frame frame;
+  for(;;) {
+    traceBegin("wait_frame");
+    bool popped = queue.pop(frame);
+    traceEnd("wait_frame");
+    if(!popped) {
+      break;
+    }
+    TraceSpan span("encode_frame", jobs[frame.job].output);
+    if(pack) {
+      results[frame.job] = packFrame(*pack, packKind, jobs[frame.job].output, frame);
+      recycle(std::move(frame.pixels));
+      continue;
+    }
+    results[frame.job] = writePNG(jobs[frame.job].output, frame.pixels, frame.width, frame.height);
+    if(results[frame.job] == EXIT_SUCCESS && frame.cacheKey.name.length() > 0) {
+      storeCachedResult(resultCache, frame.cacheKey, jobs[frame.job].output, frame.pixels);
+    }
+    recycle(std::move(frame.pixels));
+  }
+}
+
+void EncoderPool::recycle(std::vector<std::uint8_t> buffer) {
+  std::lock_guard<std::mutex> lock(freeListMutex);
+  if(freeList.size() < maxFreeBuffers) {
+    freeList.push_back(std::move(buffer));
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef CPP_ENCODER_POOL_H
+#define CPP_ENCODER_POOL_H
+
+#include "bounded_queue.h"
+#include "job.h"
+#include "pack.h"
+#include "result_cache.h"
+
+#include <cstdint>		// uint8_t, etc
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A read-back frame waiting to be encoded.
+struct Frame {
+  size_t job;
+  // Result cache key to store the written PNG under, if it has a name.
+  ResultCacheKey cacheKey;
+  unsigned width;
+  unsigned height;
+  std::vector<std::uint8_t> pixels;
+};
+
+// PNG encoding and file writing on threads of their own, so the thread that
+// owns the EGL context can get on with the next draw.
+//
+// Frames are moved in, never copied. Once a frame has been written its pixel
+// buffer goes onto a free list, and acquireBuffer hands it back out for the
+// next readback, so steady-state batches do not allocate per frame.
+class EncoderPool {
+  public:
+    // results[frame.job] receives the exit code of each write. With a pack,
+    // frames are appended to it as packKind entries instead of being written
+    // to their outputs.
+    EncoderPool(
+        size_t threads,
+        size_t queueDepth,
+        const std::string& resultCache,
+        PackWriter* pack,
+        PackKind packKind,
+        const std::vector<Job>& jobs,
+        std::vector<int>& results);
+    ~EncoderPool();
+
+    // Blocks while queueDepth frames are already waiting.
+    void submit(Frame frame);
+
+    // A recycled buffer if one is free, otherwise an empty one.
+    std::vector<std::uint8_t> acquireBuffer();
+
+    // Encodes everything submitted so far and stops the threads.
+    void finish();
+
+    // Queue occupancy, thread count and buffer reuse, on stderr.
+    void reportStats();
+
+  private:
+    void run(size_t index);
+    void recycle(std::vector<std::uint8_t> buffer);
+
+    const std::string resultCache;
+    PackWriter* const pack;
+    const PackKind packKind;
+    const std::vector<Job>& jobs;
+    std::vector<int>& results;
+    BoundedQueue<Frame> queue;
+    const size_t threadCount;
+    std::vector<std::thread> threads;
+    std::mutex freeListMutex;
+    std::vector<std::vector<std::uint8_t> > freeList;
+    size_t maxFreeBuffers;
+    size_t reusedBuffers;
+    size_t newBuffers;
+};
+
+#endif //CPP_ENCODER_POOL_H
@@ -0,0 +1,242 @@
+#include "fast_deflate.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const unsigned HASH_BITS = 15;
+const size_t WINDOW_SIZE = 32768;
+const size_t MAX_MATCH = 258;
+const size_t MIN_MATCH = 4;
+const size_t MAX_STORED_BLOCK = 65535;
+
+const unsigned LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const unsigned LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const unsigned DISTANCE_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const unsigned DISTANCE_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Deflate writes Huffman codes most significant bit first into an LSB-first
+// stream, so the codes are stored reversed.
+unsigned reverseBits(unsigned code, unsigned bits) {
+  unsigned result = 0;
+  for(unsigned i = 0; i < bits; i++) {
+    result = (result << 1) | ((code >> i) & 1);
+  }
+  return result;
+}
+
+// The fixed Huffman code (RFC 1951, 3.2.6) with the extra bits of each
+// length and distance folded in, ready to be written in one go.
+struct FixedCodes {
+  unsigned literal[256];
+  unsigned literalBits[256];
+  unsigned endOfBlock;
+  unsigned endOfBlockBits;
+  unsigned length[MAX_MATCH + 1];
+  unsigned lengthBits[MAX_MATCH + 1];
+  unsigned distance[30];
+  // Distance code of d - 1 for d <= 256, and of 256 + ((d - 1) >> 7) above.
+  std::uint8_t distanceCode[512];
+
+  FixedCodes() {
+    unsigned code[288];
+    unsigned bits[288];
+    for(unsigned symbol = 0; symbol < 288; symbol++) {
+      if(symbol < 144) {
+        code[symbol] = 0x30 + symbol;
+        bits[symbol] = 8;
+      } else if(symbol < 256) {
+        code[symbol] = 0x190 + (symbol - 144);
+        bits[symbol] = 9;
+      } else if(symbol < 280) {
+        code[symbol] = symbol - 256;
+        bits[symbol] = 7;
+      } else {
+        code[symbol] = 0xc0 + (symbol - 280);
+        bits[symbol] = 8;
+      }
+      code[symbol] = reverseBits(code[symbol], bits[symbol]);
+    }
+    for(unsigned symbol = 0; symbol < 256; symbol++) {
+      literal[symbol] = code[symbol];
+      literalBits[symbol] = bits[symbol];
+    }
+    endOfBlock = code[256];
+    endOfBlockBits = bits[256];
+    // Later codes win, so 258 gets its own symbol rather than 227 + 31.
+    for(unsigned i = 0; i < 29; i++) {
+      unsigned symbol = 257 + i;
+      for(unsigned extra = 0; extra < (1u << LENGTH_EXTRA[i]); extra++) {
+        unsigned len = LENGTH_BASE[i] + extra;
+        if(len > MAX_MATCH) {
+          break;
+        }
+        length[len] = code[symbol] | (extra << bits[symbol]);
+        lengthBits[len] = bits[symbol] + LENGTH_EXTRA[i];
+      }
+    }
+    for(unsigned i = 0; i < 30; i++) {
+      distance[i] = reverseBits(i, 5);
+      for(unsigned x = DISTANCE_BASE[i] - 1; x < DISTANCE_BASE[i] - 1 + (1u << DISTANCE_EXTRA[i]); x++) {
+        distanceCode[x < 256 ? x : 256 + (x >> 7)] = (std::uint8_t) i;
+      }
+    }
+  }
+};
+
+const FixedCodes& fixedCodes() {
+  static const FixedCodes codes;
+  return codes;
+}
+
+class BitWriter {
+  public:
+    explicit BitWriter(unsigned char* out) : out(out), bits(0), count(0) {}
+
+    // At most 32 bits at a time.
+    void put(std::uint64_t value, unsigned n) {
+      bits |= value << count;
+      count += n;
+      if(count >= 32) {
+        out[0] = (unsigned char) bits;
+        out[1] = (unsigned char) (bits >> 8);
+        out[2] = (unsigned char) (bits >> 16);
+        out[3] = (unsigned char) (bits >> 24);
+        out += 4;
+        bits >>= 32;
+        count -= 32;
+      }
+    }
+
+    // Pads to a whole byte; returns the end of the output.
+    unsigned char* finish() {
+      while(count > 0) {
+        *out++ = (unsigned char) bits;
+        bits >>= 8;
+        count = count > 8 ? count - 8 : 0;
+      }
+      return out;
+    }
+
+  private:
+    unsigned char* out;
+    std::uint64_t bits;
+    unsigned count;
+};
+
+std::uint32_t load32(const unsigned char* p) {
+  std::uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+size_t matchLength(const unsigned char* a, const unsigned char* b, size_t max) {
+  size_t len = MIN_MATCH;
+  while(len + 8 <= max) {
+    std::uint64_t x, y;
+    std::memcpy(&x, a + len, 8);
+    std::memcpy(&y, b + len, 8);
+    if(x != y) {
+      break;
+    }
+    len += 8;
+  }
+  while(len < max && a[len] == b[len]) {
+    len++;
+  }
+  return len;
+}
+
+// One final block with the fixed codes; returns the end of the output.
+unsigned char* writeFixedBlock(unsigned char* out, const unsigned char* in, size_t insize) {
+  const FixedCodes& codes = fixedCodes();
+  std::vector<std::uint32_t> head((size_t) 1 << HASH_BITS, 0);
+  BitWriter writer(out);
+  writer.put(1, 1); // BFINAL
+  writer.put(1, 2); // BTYPE 01: fixed Huffman codes
+
+  size_t i = 0;
+  const size_t last = insize >= MIN_MATCH ? insize - MIN_MATCH + 1 : 0;
+  while(i < last) {
+    std::uint32_t word = load32(in + i);
+    std::uint32_t hash = (word * 2654435761u) >> (32 - HASH_BITS);
+    size_t candidate = head[hash];
+    head[hash] = (std::uint32_t) i;
+    size_t dist = i - candidate;
+    if(candidate < i && dist <= WINDOW_SIZE && load32(in + candidate) == word) {
+      size_t max = insize - i < MAX_MATCH ? insize - i : MAX_MATCH;
+      size_t len = matchLength(in + candidate, in + i, max);
+      writer.put(codes.length[len], codes.lengthBits[len]);
+      size_t x = dist - 1;
+      unsigned code = codes.distanceCode[x < 256 ? x : 256 + (x >> 7)];
+      writer.put(codes.distance[code] | ((x - (DISTANCE_BASE[code] - 1)) << 5), 5 + DISTANCE_EXTRA[code]);
+      i += len;
+    } else {
+      writer.put(codes.literal[in[i]], codes.literalBits[in[i]]);
+      i++;
+    }
+  }
+  for(; i < insize; i++) {
+    writer.put(codes.literal[in[i]], codes.literalBits[in[i]]);
+  }
+  writer.put(codes.endOfBlock, codes.endOfBlockBits);
+  return writer.finish();
+}
+
+unsigned char* writeStoredBlocks(unsigned char* out, const unsigned char* in, size_t insize) {
+  size_t pos = 0;
+  do {
+    size_t len = insize - pos < MAX_STORED_BLOCK ? insize - pos : MAX_STORED_BLOCK;
+    bool final = pos + len == insize;
+    *out++ = final ? 1 : 0; // BFINAL, BTYPE 00
+    *out++ = (unsigned char) len;
+    *out++ = (unsigned char) (len >> 8);
+    *out++ = (unsigned char) ~len;
+    *out++ = (unsigned char) (~len >> 8);
+    std::memcpy(out, in + pos, len);
+    out += len;
+    pos += len;
+  } while(pos < insize);
+  return out;
+}
+
+} // namespace
+
+unsigned fastDeflate(
+    unsigned char** out,
+    size_t* outsize,
+    const unsigned char* in,
+    size_t insize,
+    const LodePNGCompressSettings* settings) {
+  (void) settings;
+  // A literal costs at most 9 bits and a match less than 9 bits per byte; the
+  // stored fallback needs less than that.
+  size_t bound = insize + insize / 8 + 64;
+  unsigned char* buffer = (unsigned char*) std::malloc(bound);
+  if(!buffer) {
+    return 83; // lodepng's "memory allocation failed"
+  }
+  size_t storedSize = insize + 5 * (insize / MAX_STORED_BLOCK + 1);
+  size_t size = (size_t) (writeFixedBlock(buffer, in, insize) - buffer);
+  if(size > storedSize) {
+    size = (size_t) (writeStoredBlocks(buffer, in, insize) - buffer);
+  }
+  *out = buffer;
+  *outsize = size;
+  return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef CPP_FAST_DEFLATE_H
+#define CPP_FAST_DEFLATE_H
+
+#include "lodepng.h"
+
+#include <cstddef>
+
+// A deflate encoder built for speed over ratio, with the signature of
+// LodePNGCompressSettings::custom_deflate. It hashes 4-byte words into a
+// single-entry table of earlier positions, takes the first match it finds
+// (greedy, no chains) and writes one block with the fixed Huffman codes, so
+// there are no code lengths to build. Input that would grow is written as
+// stored blocks instead. settings is ignored; *out is allocated with malloc,
+// as lodepng frees it.
+unsigned fastDeflate(
+    unsigned char** out,
+    size_t* outsize,
+    const unsigned char* in,
+    size_t insize,
+    const LodePNGCompressSettings* settings);
+
+#endif //CPP_FAST_DEFLATE_H
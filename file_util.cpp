@@ -0,0 +1,83 @@
+#include "file_util.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+bool makeDirectory(const std::string& dir) {
+#ifdef _WIN32
+  int result = _mkdir(dir.c_str());
+#else
+  int result = mkdir(dir.c_str(), 0777);
+#endif
+  return result == 0 || errno == EEXIST;
+}
+
+bool fileExists(const std::string& path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+// Unique per process and per call, as several threads may write at once.
+static std::string temporaryName(const std::string& path) {
+  static std::atomic<unsigned> counter(0);
+  std::ostringstream tmp;
+  tmp << path << ".tmp." << getpid() << "." << counter++;
+  return tmp.str();
+}
+
+bool writeFileAtomic(const std::string& path, const std::string& contents) {
+  return writeFileAtomic(path, contents.data(), contents.size());
+}
+
+bool writeFileAtomic(const std::string& path, const void* data, size_t size) {
+  std::ostringstream tmp;
+  tmp << temporaryName(path);
+  {
+    std::ofstream ofs(tmp.str().c_str(), std::ios::binary);
+    if(!ofs || !ofs.write((const char*) data, size)) {
+      std::remove(tmp.str().c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename does not replace an existing file on Windows.
+  std::remove(path.c_str());
+#endif
+  if(std::rename(tmp.str().c_str(), path.c_str()) != 0) {
+    std::remove(tmp.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool linkFileAtomic(const std::string& source, const std::string& path) {
+#ifndef _WIN32
+  std::string tmp = temporaryName(path);
+  if(link(source.c_str(), tmp.c_str()) == 0) {
+    if(std::rename(tmp.c_str(), path.c_str()) == 0) {
+      return true;
+    }
+    std::remove(tmp.c_str());
+    return false;
+  }
+#endif
+  std::ifstream ifs(source.c_str(), std::ios::binary);
+  if(!ifs) {
+    return false;
+  }
+  std::ostringstream contents;
+  contents << ifs.rdbuf();
+  return writeFileAtomic(path, contents.str());
+}
@@ -0,0 +1,22 @@
+#ifndef CPP_FILE_UTIL_H
+#define CPP_FILE_UTIL_H
+
+#include <cstddef>
+#include <string>
+
+// Creates dir (one level) if it does not exist yet.
+bool makeDirectory(const std::string& dir);
+
+bool fileExists(const std::string& path);
+
+// Writes contents to a temporary file next to path and renames it into place,
+// so concurrent readers see either the old file or the complete new one.
+bool writeFileAtomic(const std::string& path, const std::string& contents);
+bool writeFileAtomic(const std::string& path, const void* data, size_t size);
+
+// Makes path a hard link to source, atomically replacing whatever was there.
+// Falls back to an atomic copy where linking is not possible (e.g. across
+// file systems).
+bool linkFileAtomic(const std::string& source, const std::string& path);
+
+#endif //CPP_FILE_UTIL_H
@@ -0,0 +1,666 @@
+#include "fork_server.h"
+
+#include "gl_info.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Not yet rendered, or handed back by a child that died before reaching it.
+#define PENDING (-1)
+
+// A worker that has not reported ready after this long is taken to be wedged
+// creating its context.
+#define WORKER_STARTUP_MS (30000)
+// How long a worker gets to exit once its socket is closed, and again once
+// it has been killed.
+#define WORKER_EXIT_GRACE_MS (5000)
+
+#ifdef _WIN32
+
+void runForkServer(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results) {
+
+  std::cerr << "--fork-server is not supported on this platform." << std::endl;
+  results.assign(jobs.size(), EXIT_FAILURE);
+}
+
+void runWorkerPool(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results) {
+
+  std::cerr << "--workers is not supported on this platform." << std::endl;
+  results.assign(jobs.size(), EXIT_FAILURE);
+}
+
+#else
+
+namespace {
+
+// What a child reported before exiting.
+struct ChildReport {
+  long currentJob;
+  std::string phase;
+};
+
+}
+
+// Writes a whole protocol line, ignoring a parent that has gone away.
+static void sendLine(int fd, const std::string& line) {
+  const char* data = line.c_str();
+  size_t left = line.length();
+  while(left > 0) {
+    ssize_t written = write(fd, data, left);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += written;
+    left -= (size_t) written;
+  }
+}
+
+// Runs in the child: renders jobs [first, end) and reports over fd.
+//   job <i>           about to start jobs[i]
+//   phase <name>      the watchdog phase changed
+//   result <i> <code> jobs[i] finished
+[[noreturn]] static void runChild(
+    const std::vector<Job>& jobs,
+    size_t first,
+    size_t end,
+    const ForkServerOptions& options,
+    int fd) {
+
+  nameTraceProcess("fork child");
+  EGLDisplay display = 0;
+  EGLConfig config = 0;
+  EGLContext context = 0;
+  EGLSurface surface = 0;
+
+  if(!init_gl(options.width, options.height, display, config, context, surface, options.timeoutMs > 0)) {
+    flushTrace();
+    std::_Exit(EXIT_FAILURE);
+  }
+
+  ForkServerOptions renderOptions = options;
+  if(renderOptions.resultCache.length() > 0 || renderOptions.diagnosticsCache.length() > 0) {
+    renderOptions.driverIdentity = driverIdentity(display);
+  }
+
+  GLuint vertexBuffer;
+  GLuint indicesBuffer;
+  if(initDrawBuffers(vertexBuffer, indicesBuffer) != EXIT_SUCCESS) {
+    std::_Exit(EXIT_FAILURE);
+  }
+  ProgramCache programs(options.programCacheEntries, options.programCacheBytes);
+  renderOptions.programCache = &programs;
+
+  Watchdog watchdog(options.timeoutMs, TIMEOUT_EXIT_CODE);
+  watchdog.setPhaseListener([fd](const char* phase) {
+    sendLine(fd, std::string("phase ") + phase + "\n");
+  });
+
+  std::vector<std::uint8_t> pixels;
+  for(size_t i = first; i < end; i++) {
+    sendLine(fd, "job " + std::to_string(i) + "\n");
+    watchdog.arm("compile");
+    int result = renderJob(display, surface, jobs[i], renderOptions, vertexBuffer, watchdog, pixels);
+    watchdog.disarm();
+    // Flushed per job, so that a crash loses only the job it happened in.
+    flushTrace();
+    sendLine(fd, "result " + std::to_string(i) + " " + std::to_string(result) + "\n");
+  }
+
+  programs.reportStats();
+  // The parent only needs the results; skip teardown in the driver.
+  std::cout.flush();
+  std::cerr.flush();
+  std::_Exit(EXIT_SUCCESS);
+}
+
+// Does one read from fd and moves every complete line into lines. Returns
+// false once the other end has closed it.
+static bool readLines(int fd, std::string& pending, std::vector<std::string>& lines) {
+  char buffer[4096];
+  ssize_t got;
+  do {
+    got = read(fd, buffer, sizeof(buffer));
+  } while(got < 0 && errno == EINTR);
+  if(got <= 0) {
+    return false;
+  }
+  pending.append(buffer, (size_t) got);
+  size_t newline;
+  while((newline = pending.find('\n')) != std::string::npos) {
+    lines.push_back(pending.substr(0, newline));
+    pending.erase(0, newline + 1);
+  }
+  return true;
+}
+
+// Applies one report line from a child. Returns the job a "result" line
+// finished, or -1.
+static long applyReport(const std::string& text, std::vector<int>& results, ChildReport& report) {
+  std::istringstream line(text);
+  std::string kind;
+  line >> kind;
+  if(kind == "job") {
+    line >> report.currentJob;
+    report.phase = "init";
+  } else if(kind == "phase") {
+    line >> report.phase;
+  } else if(kind == "result") {
+    size_t job;
+    int code;
+    if(line >> job >> code && job < results.size()) {
+      results[job] = code;
+      return (long) job;
+    }
+  }
+  return -1;
+}
+
+// Reads the child's report lines until it closes the pipe.
+static void readReports(int fd, std::vector<int>& results, ChildReport& report) {
+  std::string pending;
+  std::vector<std::string> lines;
+  bool open = true;
+  while(open) {
+    open = readLines(fd, pending, lines);
+    for(size_t i = 0; i < lines.size(); i++) {
+      applyReport(lines[i], results, report);
+    }
+    lines.clear();
+  }
+}
+
+// Loads the libraries and initialises the display for children to inherit.
+static bool warmUp(EGLDisplay& display) {
+  if(!loadGLLibraries()) {
+    return false;
+  }
+  display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+    std::cerr << "Could not initialise the EGL display." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// How a dead child went, for the log.
+static std::string describeStatus(int status) {
+  if(WIFSIGNALED(status)) {
+    int signal = WTERMSIG(status);
+    const char* name = strsignal(signal);
+    return "signal " + std::to_string(signal) + (name != NULL ? std::string(" (") + name + ")" : std::string());
+  }
+  return "exit code " + std::to_string(WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+// The exit code a job gets when its child died: CRASH_EXIT_CODE for a
+// signal, otherwise whatever the child exited with (e.g. a timeout).
+static int deathExitCode(int status) {
+  if(WIFSIGNALED(status)) {
+    return CRASH_EXIT_CODE;
+  }
+  int code = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+  return code != EXIT_SUCCESS ? code : EXIT_FAILURE;
+}
+
+void runForkServer(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results) {
+
+  results.assign(jobs.size(), PENDING);
+
+  // Warm up once in the parent: every child inherits the loaded libraries
+  // and the initialised display instead of paying for them again.
+  EGLDisplay display = EGL_NO_DISPLAY;
+  if(!warmUp(display)) {
+    results.assign(jobs.size(), EXIT_FAILURE);
+    return;
+  }
+
+  const size_t batchSize = options.batchSize > 0 ? options.batchSize : 1;
+  size_t next = 0;
+  size_t children = 0;
+  size_t crashes = 0;
+
+  while(next < jobs.size()) {
+    const size_t end = std::min(next + batchSize, jobs.size());
+
+    int fds[2];
+    if(pipe(fds) != 0) {
+      std::cerr << "pipe failed: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    // Anything still buffered would otherwise be written by the child too.
+    std::cout.flush();
+    std::cerr.flush();
+    flushTrace();
+
+    pid_t pid = fork();
+    if(pid < 0) {
+      std::cerr << "fork failed: " << std::strerror(errno) << std::endl;
+      close(fds[0]);
+      close(fds[1]);
+      break;
+    }
+    if(pid == 0) {
+      close(fds[0]);
+      runChild(jobs, next, end, options, fds[1]);
+    }
+    ++children;
+
+    close(fds[1]);
+    ChildReport report;
+    report.currentJob = -1;
+    report.phase = "init";
+    readReports(fds[0], results, report);
+    close(fds[0]);
+
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    // The job the child was on when it died, if any. A child that never got
+    // as far as starting a job is charged to the first one, so every child
+    // makes progress.
+    size_t failed = report.currentJob >= 0 ? (size_t) report.currentJob : next;
+    if(results[failed] == PENDING) {
+      if(WIFSIGNALED(status)) {
+        ++crashes;
+        std::cerr << "Job " << failed << " (" << jobs[failed].fragment_shader << ") crashed with "
+                  << describeStatus(status) << " during phase '" << report.phase << "'." << std::endl;
+      }
+      results[failed] = deathExitCode(status);
+    }
+
+    // Jobs after the one that died go to the next child.
+    while(next < end && results[next] != PENDING) {
+      ++next;
+    }
+  }
+
+  for(size_t i = 0; i < jobs.size(); i++) {
+    if(results[i] == PENDING) {
+      results[i] = EXIT_FAILURE;
+    }
+  }
+
+  std::cerr << "Fork server: " << children << " children for " << jobs.size() << " jobs, "
+            << crashes << " crashed." << std::endl;
+
+  eglTerminate(display);
+}
+
+namespace {
+
+// One process of the worker pool, as the supervisor sees it.
+struct Worker {
+  pid_t pid;
+  int fd;
+  bool ready;
+  long job;
+  ChildReport report;
+  std::string pending;
+  // When the worker was forked, then when it was handed its current job.
+  std::chrono::steady_clock::time_point started;
+  // Sent SIGKILL already; waiting for it to go.
+  bool killed;
+};
+
+}
+
+// Runs in a worker: creates a context once, then renders every job sent
+// over fd ("job <i>") until the supervisor closes it. Reports "ready" once
+// the context exists, then phases and results as runChild does.
+[[noreturn]] static void runWorker(const std::vector<Job>& jobs, const ForkServerOptions& options, int fd) {
+  nameTraceProcess("worker");
+  EGLDisplay display = 0;
+  EGLConfig config = 0;
+  EGLContext context = 0;
+  EGLSurface surface = 0;
+
+  if(!init_gl(options.width, options.height, display, config, context, surface, options.timeoutMs > 0)) {
+    flushTrace();
+    std::_Exit(EXIT_FAILURE);
+  }
+
+  ForkServerOptions renderOptions = options;
+  if(renderOptions.resultCache.length() > 0 || renderOptions.diagnosticsCache.length() > 0) {
+    renderOptions.driverIdentity = driverIdentity(display);
+  }
+
+  GLuint vertexBuffer;
+  GLuint indicesBuffer;
+  if(initDrawBuffers(vertexBuffer, indicesBuffer) != EXIT_SUCCESS) {
+    std::_Exit(EXIT_FAILURE);
+  }
+  ProgramCache programs(options.programCacheEntries, options.programCacheBytes);
+  renderOptions.programCache = &programs;
+
+  Watchdog watchdog(options.timeoutMs, TIMEOUT_EXIT_CODE);
+  watchdog.setPhaseListener([fd](const char* phase) {
+    sendLine(fd, std::string("phase ") + phase + "\n");
+  });
+  sendLine(fd, "ready\n");
+
+  std::string pending;
+  std::vector<std::string> lines;
+  std::vector<std::uint8_t> pixels;
+  while(readLines(fd, pending, lines)) {
+    for(size_t l = 0; l < lines.size(); l++) {
+      std::istringstream line(lines[l]);
+      std::string kind;
+      size_t i;
+      if(!(line >> kind >> i) || kind != "job" || i >= jobs.size()) {
+        continue;
+      }
+      sendLine(fd, "job " + std::to_string(i) + "\n");
+      watchdog.arm("compile");
+      int result = renderJob(display, surface, jobs[i], renderOptions, vertexBuffer, watchdog, pixels);
+      watchdog.disarm();
+      flushTrace();
+      sendLine(fd, "result " + std::to_string(i) + " " + std::to_string(result) + "\n");
+    }
+    lines.clear();
+  }
+
+  programs.reportStats();
+  std::cout.flush();
+  std::cerr.flush();
+  std::_Exit(EXIT_SUCCESS);
+}
+
+// Forks a worker connected to the supervisor by a socket pair.
+static bool spawnWorker(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    const std::vector<Worker>& others,
+    Worker& worker) {
+
+  int fds[2];
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    std::cerr << "socketpair failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  std::cout.flush();
+  std::cerr.flush();
+  flushTrace();
+
+  pid_t pid = fork();
+  if(pid < 0) {
+    std::cerr << "fork failed: " << std::strerror(errno) << std::endl;
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    for(size_t i = 0; i < others.size(); i++) {
+      if(others[i].fd >= 0) {
+        close(others[i].fd);
+      }
+    }
+    runWorker(jobs, options, fds[1]);
+  }
+  close(fds[1]);
+  worker.pid = pid;
+  worker.fd = fds[0];
+  worker.ready = false;
+  worker.job = -1;
+  worker.report.currentJob = -1;
+  worker.report.phase = "init";
+  worker.pending.clear();
+  worker.started = std::chrono::steady_clock::now();
+  worker.killed = false;
+  return true;
+}
+
+// Waits up to WORKER_EXIT_GRACE_MS for a worker to exit, then kills it and
+// waits as long again. Returns false, leaving status unset, if it is still
+// there: stuck in the driver where even SIGKILL cannot end it. It is then
+// left behind rather than hanging the supervisor.
+static bool reapWorker(pid_t pid, int& status) {
+  for(int attempt = 0; attempt < 2; attempt++) {
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(WORKER_EXIT_GRACE_MS);
+    do {
+      pid_t reaped = waitpid(pid, &status, WNOHANG);
+      if(reaped == pid || (reaped < 0 && errno != EINTR)) {
+        return reaped == pid;
+      }
+      poll(NULL, 0, 10);
+    } while(std::chrono::steady_clock::now() < deadline);
+    if(attempt == 0) {
+      std::cerr << "Worker " << pid << " did not exit; killing it." << std::endl;
+      kill(pid, SIGKILL);
+    }
+  }
+  std::cerr << "Worker " << pid << " did not exit after SIGKILL; leaving it behind." << std::endl;
+  return false;
+}
+
+void runWorkerPool(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results) {
+
+  typedef std::chrono::steady_clock Clock;
+
+  results.assign(jobs.size(), PENDING);
+
+  EGLDisplay display = EGL_NO_DISPLAY;
+  if(!warmUp(display)) {
+    results.assign(jobs.size(), EXIT_FAILURE);
+    return;
+  }
+
+  // A worker that died is noticed by reading, not by writing to it.
+  signal(SIGPIPE, SIG_IGN);
+
+  std::deque<size_t> queue;
+  for(size_t i = 0; i < jobs.size(); i++) {
+    queue.push_back(i);
+  }
+  std::vector<bool> retried(jobs.size(), false);
+
+  // A worker's own watchdog should end a hung render; this backstop catches
+  // one wedged so hard that the watchdog thread never gets to run.
+  const long hangMs = options.timeoutMs > 0 ? 2 * options.timeoutMs + 1000 : 0;
+
+  const size_t workerCount = options.workers > 0 ? options.workers : 1;
+  std::vector<Worker> workers(workerCount);
+  for(size_t w = 0; w < workers.size(); w++) {
+    workers[w].fd = -1;
+  }
+  for(size_t w = 0; w < workers.size(); w++) {
+    spawnWorker(jobs, options, workers, workers[w]);
+  }
+
+  size_t done = 0;
+  size_t respawns = 0;
+  size_t retries = 0;
+  size_t flaky = 0;
+  size_t deterministic = 0;
+  size_t hung = 0;
+
+  while(done < jobs.size()) {
+    // Hand out work to idle, initialised workers.
+    for(size_t w = 0; w < workers.size(); w++) {
+      Worker& worker = workers[w];
+      if(worker.fd >= 0 && worker.ready && worker.job < 0 && !queue.empty()) {
+        worker.job = (long) queue.front();
+        queue.pop_front();
+        worker.report.currentJob = -1;
+        worker.report.phase = "init";
+        worker.started = Clock::now();
+        sendLine(worker.fd, "job " + std::to_string(worker.job) + "\n");
+      }
+    }
+
+    std::vector<pollfd> polled;
+    std::vector<size_t> polledWorker;
+    for(size_t w = 0; w < workers.size(); w++) {
+      if(workers[w].fd >= 0) {
+        pollfd entry;
+        entry.fd = workers[w].fd;
+        entry.events = POLLIN;
+        entry.revents = 0;
+        polled.push_back(entry);
+        polledWorker.push_back(w);
+      }
+    }
+    if(polled.empty()) {
+      std::cerr << "Worker pool: no workers left." << std::endl;
+      break;
+    }
+
+    // Woken regularly to check the startup and hang deadlines.
+    int ready = poll(&polled[0], polled.size(), 100);
+    if(ready < 0 && errno != EINTR) {
+      std::cerr << "poll failed: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    for(size_t p = 0; p < polled.size(); p++) {
+      Worker& worker = workers[polledWorker[p]];
+
+      if(polled[p].revents == 0) {
+        if(worker.killed) {
+          continue;
+        }
+        long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - worker.started).count();
+        if(!worker.ready && elapsed > WORKER_STARTUP_MS) {
+          std::cerr << "Worker " << worker.pid << " did not start within " << WORKER_STARTUP_MS
+                    << " ms; killing it." << std::endl;
+        } else if(hangMs > 0 && worker.job >= 0 && elapsed > hangMs) {
+          std::cerr << "Worker " << worker.pid << " hung on job " << worker.job << " during phase '"
+                    << worker.report.phase << "'; killing it." << std::endl;
+        } else {
+          continue;
+        }
+        ++hung;
+        kill(worker.pid, SIGKILL);
+        worker.killed = true;
+        continue;
+      }
+
+      std::vector<std::string> lines;
+      bool open = readLines(worker.fd, worker.pending, lines);
+      for(size_t l = 0; l < lines.size(); l++) {
+        if(lines[l] == "ready") {
+          worker.ready = true;
+          continue;
+        }
+        long finished = applyReport(lines[l], results, worker.report);
+        if(finished >= 0 && finished == worker.job) {
+          if(retried[finished]) {
+            std::cerr << "Job " << finished << " (" << jobs[finished].fragment_shader
+                      << ") completed on retry: the crash was flaky." << std::endl;
+            ++flaky;
+          }
+          worker.job = -1;
+          ++done;
+        }
+      }
+      if(open) {
+        continue;
+      }
+
+      // The worker has gone, or at least closed its end.
+      close(worker.fd);
+      worker.fd = -1;
+      int status = 0;
+      if(!reapWorker(worker.pid, status)) {
+        // As a wait status: killed by SIGKILL.
+        status = SIGKILL;
+      }
+
+      if(worker.job >= 0) {
+        size_t job = (size_t) worker.job;
+        std::cerr << "Job " << job << " (" << jobs[job].fragment_shader << ") lost its worker to "
+                  << describeStatus(status) << " during phase '" << worker.report.phase << "'";
+        if(WIFEXITED(status) && WEXITSTATUS(status) == TIMEOUT_EXIT_CODE) {
+          // The worker's own watchdog ended it: a retry would only time out
+          // again, and most such shaders simply never finish.
+          std::cerr << "; not retrying a timeout." << std::endl;
+          results[job] = TIMEOUT_EXIT_CODE;
+          ++done;
+        } else if(!retried[job]) {
+          // Once more in a fresh worker, ahead of everything else.
+          std::cerr << "; retrying." << std::endl;
+          retried[job] = true;
+          ++retries;
+          queue.push_front(job);
+        } else {
+          std::cerr << " again: the crash is deterministic." << std::endl;
+          ++deterministic;
+          results[job] = deathExitCode(status);
+          ++done;
+        }
+      } else if(!worker.ready) {
+        // Could not even create a context; another try would fail the same
+        // way, so this slot stays empty.
+        std::cerr << "Worker " << worker.pid << " failed to start (" << describeStatus(status) << ")." << std::endl;
+        continue;
+      }
+
+      if(done < jobs.size()) {
+        if(spawnWorker(jobs, options, workers, worker)) {
+          ++respawns;
+        }
+      }
+    }
+  }
+
+  // Closing the sockets tells idle workers to exit; all of them at once, so
+  // that they wind down in parallel.
+  for(size_t w = 0; w < workers.size(); w++) {
+    if(workers[w].fd >= 0) {
+      close(workers[w].fd);
+    }
+  }
+  for(size_t w = 0; w < workers.size(); w++) {
+    if(workers[w].fd >= 0) {
+      int status = 0;
+      reapWorker(workers[w].pid, status);
+      workers[w].fd = -1;
+    }
+  }
+
+  for(size_t i = 0; i < jobs.size(); i++) {
+    if(results[i] == PENDING) {
+      results[i] = EXIT_FAILURE;
+    }
+  }
+
+  std::cerr << "Worker pool: " << workerCount << " workers, " << respawns << " respawned, " << hung << " hung, "
+            << retries << " jobs retried (" << flaky << " flaky, " << deterministic << " deterministic)." << std::endl;
+
+  eglTerminate(display);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CPP_FORK_SERVER_H
+#define CPP_FORK_SERVER_H
+
+#include "job.h"
+#include "renderer.h"
+
+#include <vector>
+
+struct ForkServerOptions : RenderOptions {
+  // Watchdog budget for each render in the children; 0 disables it.
+  long timeoutMs;
+  // Jobs rendered by each child before it exits.
+  size_t batchSize;
+  // Processes in the worker pool.
+  size_t workers;
+};
+
+// Renders jobs in forked children so a driver crash only takes down the job
+// that caused it.
+//
+// The parent loads the EGL and GLES libraries and initialises the display
+// once; each child inherits that warm state, creates its own context and
+// renders up to batchSize jobs, streaming the job and phase it is in back over
+// a pipe. When a child dies the parent reports the signal and phase, gives
+// the job it was on CRASH_EXIT_CODE (or the child's exit code, e.g. a
+// timeout) and hands the rest of the batch to a fresh child. results[i] is
+// set to the exit code for jobs[i].
+void runForkServer(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results);
+
+// Renders jobs on a pool of long-lived workers, forked from the same warm
+// parent, each holding its own context and taking one job at a time over a
+// socket. A worker that crashes, or hangs past its watchdog, is replaced at
+// once while the others keep going. The job it was on is retried once in a
+// fresh worker: success there marks the crash as flaky, a second death as
+// deterministic, and the job gets CRASH_EXIT_CODE or the worker's exit code.
+void runWorkerPool(
+    const std::vector<Job>& jobs,
+    const ForkServerOptions& options,
+    std::vector<int>& results);
+
+#endif //CPP_FORK_SERVER_H
@@ -1,49 +1,34 @@
 #include "common.h"
+#include "gl_info.h"
 
-#define GL_GLEXT_PROTOTYPES
-
-#include "GLES/gl.h"
-#include "GLES2/gl2.h"
-#include "GL/glcorearb.h"
-
+#include <cstdlib>
 #include <iostream>
+#include <string>
 
-GLint getInt(GLenum name) {
-  GLint temp = 0;
-  glGetIntegerv(name, &temp);
-  return temp;
-}
-
-template<class KT, class VT> void output(KT key, VT val) {
-  std::cout << "    \"" << key << "\": \"" << val << "\",\n";
-}
-
-void go() {
-
-  std::cout << "{\n";
-
-  output("GL_VERSION", glGetString(GL_VERSION));
-  output("GL_MAJOR_VERSION", getInt(GL_MAJOR_VERSION));
-  output("GL_MINOR_VERSION", getInt(GL_MINOR_VERSION));
-  output("GL_SHADING_LANGUAGE_VERSION", glGetString(GL_SHADING_LANGUAGE_VERSION));
-  output("GL_VENDOR", glGetString(GL_VENDOR));
-  output("GL_RENDERER", glGetString(GL_RENDERER));
+int main(int argc, char* argv[]) {
 
-  GLuint glslNumVersions = (GLuint) getInt(GL_NUM_SHADING_LANGUAGE_VERSIONS);
+  std::string cache_dir;
+  std::string egl_lib;
+  std::string gles_lib;
 
-  std::cout << "    \"Supported_GLSL_versions\": [";
-  if(glslNumVersions > 0) {
-    std::cout << "\"" << glGetStringi(GL_SHADING_LANGUAGE_VERSION, 0) << "\"";
-    for(GLuint i=1; i < glslNumVersions; ++i) {
-      std::cout << ", \"" << glGetStringi(GL_SHADING_LANGUAGE_VERSION, i) << "\"";
+  for(int i = 1; i < argc; i++) {
+    std::string curr_arg = std::string(argv[i]);
+    if(curr_arg == "--cache-dir" && i + 1 < argc) {
+      cache_dir = argv[++i];
+      continue;
     }
+    if(curr_arg == "--egl-lib" && i + 1 < argc) {
+      egl_lib = argv[++i];
+      continue;
+    }
+    if(curr_arg == "--gles-lib" && i + 1 < argc) {
+      gles_lib = argv[++i];
+      continue;
+    }
+    std::cerr << "Unknown argument " << curr_arg << std::endl;
   }
-  std::cout << "]\n";
-
-  std::cout << "}" << std::endl;
-}
 
-int main(int argc, char* argv[]) {
+  configureGLLibraries(egl_lib, gles_lib);
 
   EGLDisplay display = 0;
   EGLConfig config = 0;
@@ -66,7 +51,14 @@ int main(int argc, char* argv[]) {
     return EXIT_FAILURE;
   }
 
-  go();
+  nlohmann::json info = collectGLInfo(display, config);
+
+  // Seed the cache get_image reads with --gl-info-cache.
+  if(cache_dir.length() > 0) {
+    storeGLInfoCache(cache_dir, driverIdentity(display), info);
+  }
+
+  std::cout << info.dump(4) << std::endl;
 
   return EXIT_SUCCESS;
 }
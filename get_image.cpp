@@ -1,377 +1,174 @@
 #include "common.h"
-
-#define GL_GLEXT_PROTOTYPES
-
-#include "GLES/gl.h"
-#include "GLES2/gl2.h"
-
+#include "compile_batch.h"
+#include "deflate_backend.h"
+#include "fork_server.h"
+#include "gl_info.h"
+#include "pack.h"
+#include "pipeline.h"
+#include "renderer.h"
+#include "result_cache.h"
+#include "timing.h"
+#include "trace.h"
+#include "uniform_sweep.h"
+#include "watchdog.h"
+
+#include <cassert>
 #include <cstdlib>		// EXIT_SUCCESS, etc
 #include <cstdint>		// uint8_t, etc
-#include <iostream>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <vector>
 
-#include "lodepng.h"
-#include "json.hpp"
-using json = nlohmann::json;
-
-static const int WIDTH = 256;
-static const int HEIGHT = 256;
-
-#define COMPILE_ERROR_EXIT_CODE (101)
-#define LINK_ERROR_EXIT_CODE (102)
-#define RENDER_ERROR_EXIT_CODE (103)
-
-#define CHANNELS (4)
-#define DELAY (2)
-
-const float vertices[] = {
-  -1.0f,  1.0f,
-  -1.0f, -1.0f,
-   1.0f, -1.0f,
-   1.0f,  1.0f
-};
+class TerminateEGLAtExit{
+  EGLDisplay display;
 
-const GLubyte indices[] = {
-  0, 1, 2,
-  2, 3, 0
+  public:
+    TerminateEGLAtExit(EGLDisplay);
+    ~TerminateEGLAtExit();
 };
 
-const char* vertex_shader_wo_version =
-"attribute vec2 vert2d;\n"
-"void main(void) {\n"
-"  gl_Position = vec4(vert2d, 0.0, 1.0);\n"
-"}\n";
-
-const char* vertex_shader_v300es =
-"in vec3 aVertexPosition;\n"
-"void main(void) {\n"
-"    gl_Position = vec4(aVertexPosition, 1.0);\n"
-"}\n";
-
-bool readFile(const std::string& fileName, std::string& contentsOut) {
-  std::ifstream ifs(fileName.c_str());
-  if(!ifs) {
-    std::cerr << "File " << fileName << " not found" << std::endl;
-    return false;
-  }
-  std::stringstream ss;
-  ss << ifs.rdbuf();
-  contentsOut = ss.str();
-  return true;
+TerminateEGLAtExit::TerminateEGLAtExit(EGLDisplay display){
+  this->display = display;
 }
 
-void printShaderError(GLuint shader) {
-  GLint length = 0;
-  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
-
-  // The maxLength includes the NULL character
-
-  std::vector<GLchar> errorLog((size_t) length, 0);
-
-  glGetShaderInfoLog(shader, length, &length, &errorLog[0]);
-  if(length > 0) {
-    std::string s(&errorLog[0]);
-    std::cout << s << std::endl;
-  }
+TerminateEGLAtExit::~TerminateEGLAtExit(){
+  auto succeeded = eglTerminate(this->display);
+  assert(succeeded);
 }
 
-void printProgramError(GLuint program) {
-  GLint length = 0;
-  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-
-  // The maxLength includes the NULL character
-
-  std::vector<GLchar> errorLog((size_t) length, 0);
+// Finishes the --trace and --timing files on every way out of main.
+class CloseProfilesAtExit{
+  public:
+    ~CloseProfilesAtExit();
+};
 
-  glGetProgramInfoLog(program, length, &length, &errorLog[0]);
-  if(length > 0) {
-    std::string s(&errorLog[0]);
-    std::cout << s << std::endl;
-  }
+CloseProfilesAtExit::~CloseProfilesAtExit(){
+  closeTrace();
+  closeTiming();
 }
 
-int checkForGLError(const char loc[]) {
-  GLenum res = glGetError();
-  if(res != GL_NO_ERROR) {
-    std::cerr << loc << ": glGetError: " << std::hex << res << std::endl;
-    return EXIT_FAILURE;
-  }
-  return EXIT_SUCCESS;
+void printUsage(const char* program) {
+  std::cerr <<
+      "Usage: " << program << " [options] <fragment shader>\n"
+      "       " << program << " [options] --batch <manifest>\n"
+      "\n"
+      "Options:\n"
+      "  --output <file>          PNG to write (default output.png)\n"
+      "  --vertex <file>          vertex shader to use instead of the embedded one\n"
+      "  --resolution <w>x<h>     render size (default 256x256)\n"
+      "  --exit_compile           stop after compiling the fragment shader\n"
+      "  --exit_linking           stop after linking the program\n"
+      "  --timeout-ms <ms>        abort a render that takes longer than this; in batch\n"
+      "                           mode requires --workers or --fork-server\n"
+      "  --batch <manifest>       render every \"<shader> [<output>]\" line of manifest,\n"
+      "                           or every .frag in a directory\n"
+      "  --atlas <cols>x<rows>    draw batch jobs as tiles of one target, read back at once\n"
+      "  --uniform-sweep <file>   render the shader once per set of uniform overrides\n"
+      "  --pipeline-depth <n>     frames queued for encoding in batch mode\n"
+      "  --encoders <n>           PNG encoder threads in batch mode\n"
+      "  --png-level <0-9>        deflate effort; 1-9 use the fast match finder (default 0)\n"
+      "  --png-deflate <backend>  deflate implementation: lodepng (default) or fast\n"
+      "  --pack <file>            append a batch's images to one pack file instead\n"
+      "  --pack-format <format>   what the pack holds per job: png (default), raw or hash\n"
+      "  --pack-sync-mb <n>       sync the pack every n MB written (default 64, 0 at the end)\n"
+      "  --results <file>         JSONL records of a compile/link-only batch (default stdout)\n"
+      "  --compile-threads <n>    contexts compiling in parallel in a compile/link-only batch\n"
+      "  --fork-server            render batch jobs in forked children\n"
+      "  --fork-batch-size <n>    jobs per forked child (default 1)\n"
+      "  --workers <n>            render batch jobs on a pool of worker processes\n"
+      "  --gl-info-cache <dir>    cache of driver capabilities\n"
+      "  --program-cache <n>      linked programs kept for repeat shaders in a batch (default 64)\n"
+      "  --program-cache-mb <n>   size limit of those programs (default 256)\n"
+      "  --result-cache <dir>     reuse earlier renders of identical inputs\n"
+      "  --diagnostics-cache <dir> remember compile and link failures\n"
+      "  --trace <file>           write Chrome trace events for every phase\n"
+      "  --timing <file>          write per-phase totals as JSON\n"
+      "  --perf-counters          add hardware counters to --timing (Linux)\n"
+      "  --egl-lib <library>      EGL library to load (or GET_IMAGE_EGL_LIB)\n"
+      "  --gles-lib <library>     GLES library to load (or GET_IMAGE_GLES_LIB)\n"
+      "  --persist, --animate     accepted for compatibility\n"
+      "  --help                   show this message\n";
 }
 
-#define CHECK_ERROR(loc) \
-do { \
-  if(checkForGLError(loc) == EXIT_FAILURE) { \
-    return EXIT_FAILURE; \
-  } \
-} while(false)
-
-int render(
-    EGLDisplay display,
-    EGLSurface surface,
-    int width,
-    int height,
-    bool animate,
-    int numFrames,
-    bool& saved,
-    const std::string& output,
-    GLint resolutionLocation,
-    GLint timeLocation) {
-
-  glViewport(0, 0, width, height);
-  CHECK_ERROR("After glViewport");
-
-  if(resolutionLocation != -1) {
-    glUniform2f(resolutionLocation, width, height);
-    CHECK_ERROR("After glUniform2f");
-  }
-
-  if(animate && timeLocation != -1 && numFrames > DELAY) {
-    glUniform1f(timeLocation, numFrames / 10.0f);
-    CHECK_ERROR("After glUniform1f");
+// Options followed by a value.
+bool takesValue(const std::string& arg) {
+  static const char* const options[] = {
+    "--output", "--vertex", "--resolution", "--timeout-ms", "--batch", "--atlas", "--uniform-sweep", "--pipeline-depth",
+    "--encoders", "--png-level", "--png-deflate", "--pack", "--pack-format", "--pack-sync-mb", "--results", "--compile-threads", "--fork-batch-size", "--workers", "--gl-info-cache", "--program-cache", "--program-cache-mb", "--result-cache", "--diagnostics-cache", "--trace", "--timing", "--egl-lib", "--gles-lib"
+  };
+  for(const char* option : options) {
+    if(arg == option) {
+      return true;
+    }
   }
-
-  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-  CHECK_ERROR("After glClearColor");
-  glClear(GL_COLOR_BUFFER_BIT);
-  CHECK_ERROR("After glClear");
-
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0);
-  CHECK_ERROR("After glDrawElements");
-
-  glFlush();
-  CHECK_ERROR("After glFlush");
-
-  eglSwapBuffers(display, surface);
-  CHECK_ERROR("After swapBuffers");
-
-  return EXIT_SUCCESS;
+  return false;
 }
 
-/*---------------------------------------------------------------------------*/
-// Initialisation of uniforms
+// The driver's limits, to check requested resolutions against. With a cache
+// directory they come from a cached get_gl_info dump for this driver, written
+// on first use, instead of being probed.
+GLLimits driverLimits(EGLDisplay display, EGLConfig config, const std::string& cacheDir) {
 
-template<typename T>
-T *getArray(const json& j) {
-  T *a = new T[j.size()];
-  for (unsigned int i = 0; i < j.size(); i++) {
-    a[i] = j[i];
+  nlohmann::json info;
+  if(cacheDir.length() == 0) {
+    info["limits"] = collectLimits(display, config);
+  } else {
+    std::string identity = driverIdentity(display);
+    if(!loadGLInfoCache(cacheDir, identity, info)) {
+      info = collectGLInfo(display, config);
+      storeGLInfoCache(cacheDir, identity, info);
+    }
   }
-  return a;
+  return limitsFromGLInfo(info);
 }
 
-#define GLUNIFORM_ARRAYINIT(funcname, uniformloc, gltype, jsonarray) \
-  gltype *a = getArray<gltype>(jsonarray); \
-  funcname(uniformloc, jsonarray.size(), a); \
-  delete [] a
-
-void setJSONDefaultEntries(json& j) {
-
-  if (j.count("injectionSwitch") == 0) {
-    std::cerr << "Warning: uniform injectionSwitch not found in JSON, using default value" << std::endl;
-    j["injectionSwitch"] = {
-      {"func", "glUniform2f"},
-      { "args", { 0.0f, 1.0f }}
-    };
-  }
-
-  if (j.count("time") == 0) {
-    std::cerr << "Warning: uniform time not found in JSON, using default value" << std::endl;
-    j["time"] = {
-      {"func", "glUniform1f"},
-      { "args", { 0.0f }}
-    };
-  }
-
-
-  if (j.count("mouse") == 0) {
-    std::cerr << "Warning: uniform mouse not found in JSON, using default value" << std::endl;
-    j["mouse"] = {
-      {"func", "glUniform2f"},
-      { "args", { 0.0f, 0.0f }}
-    };
-  }
-
-  if (j.count("resolution") == 0) {
-    std::cerr << "Warning: uniform resolution not found in JSON, using default value" << std::endl;
-    j["resolution"] = {
-      {"func", "glUniform2f"},
-      { "args", { float(WIDTH), float(HEIGHT) }}
-    };
+// Parses "<width>x<height>".
+bool parseResolution(const std::string& arg, int& width, int& height) {
+  char separator = 0;
+  std::istringstream ss(arg);
+  if(!(ss >> width >> separator >> height) || separator != 'x' || !ss.eof()) {
+    std::cerr << "Invalid resolution " << arg << ", expected <width>x<height>" << std::endl;
+    return false;
   }
-
+  return true;
 }
 
-int setUniforms(const GLuint& program, const std::string& fragment_shader) {
-  GLint nbUniforms;
-  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &nbUniforms);
-  CHECK_ERROR("glGetProgramiv");
-  if (nbUniforms == 0) {
-    return EXIT_SUCCESS;
-  }
-
-  GLint uniformNameMaxLength = 0;
-  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformNameMaxLength);
-  CHECK_ERROR("glGetProgramiv");
-  GLchar *uniformName = new GLchar[uniformNameMaxLength];
-  GLint uniformSize;
-  GLenum uniformType;
-
-  std::string jsonFilename(fragment_shader);
-  jsonFilename.replace(jsonFilename.end()-4, jsonFilename.end(), "json");
-  std::string jsonContent;
-  if (!readFile(jsonFilename, jsonContent)) {
-    return EXIT_FAILURE;
-  }
-  json j = json::parse(jsonContent);
-
-  setJSONDefaultEntries(j);
-
-  for (int i = 0; i < nbUniforms; i++) {
-    glGetActiveUniform(program, i, uniformNameMaxLength, NULL, &uniformSize, &uniformType, uniformName);
-    CHECK_ERROR("glGetActiveUniform");
-    std::cout << "UNIFORM " << i << ": " << uniformName << " size:" << uniformSize << std::endl;
-
-    if (j.count(uniformName) == 0) {
-      std::cerr << "Error: missing JSON entry for uniform: " << uniformName << std::endl;
-      return EXIT_FAILURE;
-    }
-    if (j.count(uniformName) > 1) {
-      std::cerr << "Error: more than one JSON entry for uniform: " << uniformName << std::endl;
-      return EXIT_FAILURE;
-    }
-    json uniformInfo = j[uniformName];
-
-    // Check presence of func and args entries
-    if (uniformInfo.find("func") == uniformInfo.end()) {
-      std::cerr << "Error: malformed JSON: no \"func\" entry for uniform: " << uniformName << std::endl;
-      return EXIT_FAILURE;
-    }
-    if (uniformInfo.find("args") == uniformInfo.end()) {
-      std::cerr << "Error: malformed JSON: no \"args\" entry for uniform: " << uniformName << std::endl;
-      return EXIT_FAILURE;
-    }
-
-    // Get uniform location
-    GLint uniformLocation = glGetUniformLocation(program, uniformName);
-    CHECK_ERROR("After glGetUniformLocation");
-    if (uniformLocation == -1) {
-      std::cerr << "Error: Cannot find uniform named: " << uniformName << std::endl;
-      return EXIT_FAILURE;
-    }
-
-    // Dispatch to matching init function
-    std::string uniformFunc = uniformInfo["func"];
-    json args = uniformInfo["args"];
-
-    // TODO: check that args has the good number of fields and type
-
-    if (uniformFunc == "glUniform1f") {
-      glUniform1f(uniformLocation, args[0]);
-    } else if (uniformFunc == "glUniform2f") {
-      glUniform2f(uniformLocation, args[0], args[1]);
-    } else if (uniformFunc == "glUniform3f") {
-      glUniform3f(uniformLocation, args[0], args[1], args[2]);
-    } else if (uniformFunc == "glUniform4f") {
-      glUniform4f(uniformLocation, args[0], args[1], args[2], args[3]);
-    }
-
-    else if (uniformFunc == "glUniform1i") {
-      glUniform1i(uniformLocation, args[0]);
-    } else if (uniformFunc == "glUniform2i") {
-      glUniform2i(uniformLocation, args[0], args[1]);
-    } else if (uniformFunc == "glUniform3i") {
-      glUniform3i(uniformLocation, args[0], args[1], args[2]);
-    } else if (uniformFunc == "glUniform4i") {
-      glUniform4i(uniformLocation, args[0], args[1], args[2], args[3]);
-    }
-
-    // Note: no "glUniformXui" variant in OpenGL ES
-
-    // else if (uniformFunc == "glUniform1ui") {
-    //   glUniform1ui(uniformLocation, args[0]);
-    // } else if (uniformFunc == "glUniform2ui") {
-    //   glUniform2ui(uniformLocation, args[0], args[1]);
-    // } else if (uniformFunc == "glUniform3ui") {
-    //   glUniform3ui(uniformLocation, args[0], args[1], args[2]);
-    // } else if (uniformFunc == "glUniform4ui") {
-    //   glUniform4ui(uniformLocation, args[0], args[1], args[2], args[3]);
-    // }
-
-    else if (uniformFunc == "glUniform1fv") {
-      GLUNIFORM_ARRAYINIT(glUniform1fv, uniformLocation, GLfloat, args);
-    } else if (uniformFunc == "glUniform2fv") {
-      GLUNIFORM_ARRAYINIT(glUniform2fv, uniformLocation, GLfloat, args);
-    } else if (uniformFunc == "glUniform3fv") {
-      GLUNIFORM_ARRAYINIT(glUniform3fv, uniformLocation, GLfloat, args);
-    } else if (uniformFunc == "glUniform4fv") {
-      GLUNIFORM_ARRAYINIT(glUniform4fv, uniformLocation, GLfloat, args);
-    }
-
-    else if (uniformFunc == "glUniform1iv") {
-      GLUNIFORM_ARRAYINIT(glUniform1iv, uniformLocation, GLint, args);
-    } else if (uniformFunc == "glUniform2iv") {
-      GLUNIFORM_ARRAYINIT(glUniform2iv, uniformLocation, GLint, args);
-    } else if (uniformFunc == "glUniform3iv") {
-      GLUNIFORM_ARRAYINIT(glUniform3iv, uniformLocation, GLint, args);
-    } else if (uniformFunc == "glUniform4iv") {
-      GLUNIFORM_ARRAYINIT(glUniform4iv, uniformLocation, GLint, args);
+// Reports failed jobs; the exit code is EXIT_SUCCESS only if all of them
+// succeeded.
+int reportBatch(const std::vector<Job>& jobs, const std::vector<int>& results) {
+  size_t failures = 0;
+  for(size_t i = 0; i < jobs.size(); i++) {
+    if(results[i] != EXIT_SUCCESS) {
+      std::cerr << "Job " << i << " (" << jobs[i].fragment_shader << ") failed with exit code "
+                << results[i] << "." << std::endl;
+      ++failures;
     }
-
-    else {
-      std::cerr << "Error: unknown/unsupported uniform init func: " << uniformFunc << std::endl;
-      return EXIT_FAILURE;
-    }
-    CHECK_ERROR("After uniform initialisation");
   }
-
-  delete [] uniformName;
-
-  return EXIT_SUCCESS;
+  std::cerr << "Batch: " << jobs.size() - failures << " of " << jobs.size() << " jobs succeeded." << std::endl;
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-class TerminateEGLAtExit{
-  EGLDisplay display;
-
-  public:
-    TerminateEGLAtExit(EGLDisplay);
-    ~TerminateEGLAtExit();
-};
-
-TerminateEGLAtExit::TerminateEGLAtExit(EGLDisplay display){
-  this->display = display;
-}
+// Runs every job in the manifest in this process.
+int runBatch(
+    EGLDisplay display,
+    EGLSurface surface,
+    const std::vector<Job>& jobs,
+    const PipelineOptions& options,
+    Watchdog& watchdog) {
 
-TerminateEGLAtExit::~TerminateEGLAtExit(){
-  auto succeeded = eglTerminate(this->display);
-  assert(succeeded);
+  std::vector<int> results;
+  if(options.atlasColumns > 0) {
+    runAtlasPipeline(display, surface, jobs, options, watchdog, results);
+  } else {
+    runPipeline(display, surface, jobs, options, watchdog, results);
+  }
+  return reportBatch(jobs, results);
 }
 /*---------------------------------------------------------------------------*/
 
 int main(int argc, char* argv[]) {
 
-  EGLDisplay display = 0;
-  EGLConfig config = 0;
-  EGLContext context = 0;
-  EGLSurface surface = 0;
-
-  bool res = init_gl(
-      WIDTH,
-      HEIGHT,
-      display,
-      config,
-      context,
-      surface
-  );
-
-  if(!res) {
-    return EXIT_FAILURE;
-  }
-
-  TerminateEGLAtExit cleanup_display = display;
-
   bool persist = false;
   bool animate = false;
   bool exit_compile = false;
@@ -379,11 +176,51 @@ int main(int argc, char* argv[]) {
   std::string output("output.png");
   std::string vertex_shader;
   std::string fragment_shader;
-
+  long timeout_ms = 0;
+  std::string batch;
+  size_t pipeline_depth = 2;
+  size_t encoders = 1;
+  long png_level = 0;
+  const DeflateBackend* png_deflate = &deflateBackends()[0];
+  int atlas_columns = 0;
+  int atlas_rows = 0;
+  std::string uniform_sweep;
+  std::string pack;
+  PackKind pack_format = PACK_PNG;
+  long pack_sync_mb = 64;
+  std::string results_file("-");
+  size_t compile_threads = 1;
+  bool fork_server = false;
+  size_t fork_batch_size = 1;
+  size_t workers = 0;
+  int width = WIDTH;
+  int height = HEIGHT;
+  std::string gl_info_cache;
+  long program_cache = 64;
+  long program_cache_mb = 256;
+  std::string result_cache;
+  std::string diagnostics_cache;
+  std::string trace;
+  std::string timing_file;
+  bool perf_counters = false;
+  std::string egl_lib;
+  std::string gles_lib;
+
+  // Nothing here may touch EGL or GLES: the libraries are only loaded once the
+  // arguments are known to be good.
   for(int i = 1; i < argc; i++) {
     std::string curr_arg = std::string(argv[i]);
     if(!curr_arg.compare(0, 2, "--")) {
-      if(curr_arg == "--persist") {
+      if(takesValue(curr_arg) && i + 1 >= argc) {
+        std::cerr << "Missing value for " << curr_arg << std::endl;
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      if(curr_arg == "--help") {
+        printUsage(argv[0]);
+        return EXIT_SUCCESS;
+      }
+      else if(curr_arg == "--persist") {
         persist = true;
         continue;
       }
@@ -407,6 +244,138 @@ int main(int argc, char* argv[]) {
         vertex_shader = argv[++i];
         continue;
       }
+      else if(curr_arg == "--timeout-ms") {
+        timeout_ms = std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--batch") {
+        batch = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--pipeline-depth") {
+        pipeline_depth = (size_t) std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--encoders") {
+        encoders = (size_t) std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--png-level") {
+        png_level = std::atol(argv[++i]);
+        if(png_level < 0 || png_level > 9) {
+          std::cerr << "--png-level must be between 0 and 9" << std::endl;
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--png-deflate") {
+        png_deflate = findDeflateBackend(argv[++i]);
+        if(!png_deflate) {
+          std::cerr << "Unknown --png-deflate backend " << argv[i] << " (expected "
+                    << deflateBackendNames() << ")" << std::endl;
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--atlas") {
+        char separator = 0;
+        std::istringstream ss(argv[++i]);
+        if(!(ss >> atlas_columns >> separator >> atlas_rows) || separator != 'x' || !ss.eof() ||
+           atlas_columns < 1 || atlas_rows < 1) {
+          std::cerr << "Invalid atlas " << argv[i] << ", expected <columns>x<rows>" << std::endl;
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--uniform-sweep") {
+        uniform_sweep = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--pack") {
+        pack = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--pack-format") {
+        if(!parsePackKind(argv[++i], pack_format)) {
+          std::cerr << "Unknown --pack-format " << argv[i] << " (expected png, raw or hash)" << std::endl;
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--pack-sync-mb") {
+        pack_sync_mb = std::atol(argv[++i]);
+        if(pack_sync_mb < 0) {
+          std::cerr << "--pack-sync-mb must not be negative" << std::endl;
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--results") {
+        results_file = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--compile-threads") {
+        compile_threads = (size_t) std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--fork-server") {
+        fork_server = true;
+        continue;
+      }
+      else if(curr_arg == "--fork-batch-size") {
+        fork_batch_size = (size_t) std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--workers") {
+        workers = (size_t) std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--resolution") {
+        if(!parseResolution(argv[++i], width, height)) {
+          return EXIT_FAILURE;
+        }
+        continue;
+      }
+      else if(curr_arg == "--gl-info-cache") {
+        gl_info_cache = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--program-cache") {
+        program_cache = std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--program-cache-mb") {
+        program_cache_mb = std::atol(argv[++i]);
+        continue;
+      }
+      else if(curr_arg == "--result-cache") {
+        result_cache = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--diagnostics-cache") {
+        diagnostics_cache = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--trace") {
+        trace = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--timing") {
+        timing_file = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--perf-counters") {
+        perf_counters = true;
+        continue;
+      }
+      else if(curr_arg == "--egl-lib") {
+        egl_lib = argv[++i];
+        continue;
+      }
+      else if(curr_arg == "--gles-lib") {
+        gles_lib = argv[++i];
+        continue;
+      }
       std::cerr << "Unknown argument " << curr_arg << std::endl;
       continue;
     }
@@ -417,134 +386,262 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  if(fragment_shader.length() == 0) {
+  std::vector<Job> jobs;
+  if(batch.length() > 0) {
+    if(fragment_shader.length() != 0) {
+      std::cerr << "Ignoring fragment shader argument in batch mode" << std::endl;
+    }
+    if(!readJobs(batch, jobs)) {
+      return EXIT_FAILURE;
+    }
+  } else if(fork_server || workers > 0) {
+    std::cerr << (fork_server ? "--fork-server" : "--workers") << " requires --batch" << std::endl;
+    return EXIT_FAILURE;
+  } else if(fragment_shader.length() == 0) {
     std::cerr << "Requires fragment shader argument!" << std::endl;
+    printUsage(argv[0]);
     return EXIT_FAILURE;
   }
 
-  GLuint program = glCreateProgram();
-  int compileOk = 0;
-  const char* temp;
+  std::vector<nlohmann::json> sweep;
+  if(uniform_sweep.length() > 0) {
+    if(batch.length() > 0 || result_cache.length() > 0) {
+      std::cerr << "--uniform-sweep cannot be combined with "
+                << (batch.length() > 0 ? "--batch" : "--result-cache") << std::endl;
+      return EXIT_FAILURE;
+    }
+    if(!readUniformSweep(uniform_sweep, sweep)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Atlases are drawn by the in-process pipeline, which does not consult the
+  // result cache per tile.
+  if(atlas_columns > 0) {
+    if(batch.length() == 0) {
+      std::cerr << "--atlas requires --batch" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if(fork_server || workers > 0 || result_cache.length() > 0) {
+      std::cerr << "--atlas cannot be combined with "
+                << (fork_server ? "--fork-server" : workers > 0 ? "--workers" : "--result-cache") << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
 
-  std::string fragContents;
-  if(!readFile(fragment_shader, fragContents)) {
+  // Packs are written by the in-process pipeline only; forked renderers and
+  // result cache hits produce files.
+  if(pack.length() > 0) {
+    if(batch.length() == 0 && uniform_sweep.length() == 0) {
+      std::cerr << "--pack requires --batch or --uniform-sweep" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if(fork_server || workers > 0 || result_cache.length() > 0) {
+      std::cerr << "--pack cannot be combined with "
+                << (fork_server ? "--fork-server" : workers > 0 ? "--workers" : "--result-cache") << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The in-process batch renders every job on one context under one
+  // watchdog, so a timeout would end it with the jobs already drawn lost.
+  // Worker processes can be replaced instead.
+  if(timeout_ms > 0 && batch.length() > 0 && !exit_compile && !exit_linking && !fork_server && workers == 0) {
+    std::cerr << "--timeout-ms with --batch requires --workers or --fork-server" << std::endl;
     return EXIT_FAILURE;
   }
 
-  temp = fragContents.c_str();
-  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &temp, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &compileOk);
-  if (!compileOk) {
-    std::cerr << "Error compiling fragment shader." << std::endl;
-    printShaderError(fragmentShader);
-    return COMPILE_ERROR_EXIT_CODE;
+  // Timing totals are kept in memory by the process that ran each phase, so
+  // forked renderers would take theirs with them.
+  if(timing_file.length() > 0 && (fork_server || workers > 0)) {
+    std::cerr << "--timing cannot be combined with " << (fork_server ? "--fork-server" : "--workers") << std::endl;
+    return EXIT_FAILURE;
   }
-  std::cerr << "Fragment shader compiled successfully." << std::endl;
-  if (exit_compile) {
-    std::cout << "Exiting after fragment shader compilation." << std::endl;
-    return EXIT_SUCCESS;
+  if(perf_counters && timing_file.length() == 0) {
+    std::cerr << "--perf-counters requires --timing" << std::endl;
+    return EXIT_FAILURE;
   }
-  glAttachShader(program, fragmentShader);
 
-  std::string vertexContents;
-  if(vertex_shader.length() == 0) {
-    // Use embedded vertex shader.
-    std::stringstream ss;
-    size_t i = fragContents.find('\n');
-    if(i != std::string::npos && fragContents[0] == '#') {
-      ss << fragContents.substr(0,i);
-      ss << "\n";
-    } else {
-      std::cerr << "Warning: Could not find #version string of fragment shader." << std::endl;
+  // Opened before any thread starts; children forked later append to the
+  // trace.
+  if(trace.length() > 0 && !openTrace(trace)) {
+    return EXIT_FAILURE;
+  }
+  if(timing_file.length() > 0 && !openTiming(timing_file, perf_counters)) {
+    return EXIT_FAILURE;
+  }
+  CloseProfilesAtExit close_profiles;
+
+  configureGLLibraries(egl_lib, gles_lib);
+  setPNGCompressionLevel((unsigned) png_level);
+  setPNGDeflateBackend(*png_deflate);
+
+  PipelineOptions pipelineOptions;
+  pipelineOptions.vertex_shader = vertex_shader;
+  pipelineOptions.stopAfter = exit_compile ? BUILD_COMPILE : exit_linking ? BUILD_LINK : BUILD_ALL;
+  pipelineOptions.animate = animate;
+  pipelineOptions.depth = pipeline_depth;
+  pipelineOptions.encoders = encoders;
+  pipelineOptions.pack = NULL;
+  pipelineOptions.atlasColumns = atlas_columns;
+  pipelineOptions.atlasRows = atlas_rows;
+  pipelineOptions.packKind = pack_format;
+  pipelineOptions.width = width;
+  pipelineOptions.height = height;
+  pipelineOptions.resultCache = result_cache;
+  pipelineOptions.programCacheEntries = program_cache > 0 ? (size_t) program_cache : 0;
+  pipelineOptions.programCacheBytes = program_cache_mb > 0 ? (size_t) program_cache_mb << 20 : 0;
+  pipelineOptions.programCache = NULL;
+  pipelineOptions.diagnosticsCache = diagnostics_cache;
+
+  // Compile- and link-only batches need no render target and report in
+  // JSONL instead.
+  if(batch.length() > 0 && pipelineOptions.stopAfter != BUILD_ALL) {
+    CompileBatchOptions compileOptions;
+    compileOptions.vertex_shader = vertex_shader;
+    compileOptions.stopAfter = pipelineOptions.stopAfter;
+    compileOptions.threads = compile_threads;
+    compileOptions.timeoutMs = timeout_ms;
+    compileOptions.diagnosticsCache = diagnostics_cache;
+    std::ofstream resultsStream;
+    if(results_file != "-") {
+      resultsStream.open(results_file.c_str());
+      if(!resultsStream) {
+        std::cerr << "Could not write " << results_file << std::endl;
+        return EXIT_FAILURE;
+      }
     }
-    // the vertex shader is different for versio 300 es
-    i = fragContents.find("300");
-    if (i != std::string::npos) {
-        ss << vertex_shader_v300es;
+    std::vector<int> results;
+    runCompileBatch(jobs, compileOptions, results_file != "-" ? resultsStream : std::cout, results);
+    return reportBatch(jobs, results);
+  }
+
+  if(fork_server || workers > 0) {
+    ForkServerOptions forkOptions;
+    static_cast<RenderOptions&>(forkOptions) = pipelineOptions;
+    forkOptions.timeoutMs = timeout_ms;
+    forkOptions.batchSize = fork_batch_size;
+    forkOptions.workers = workers;
+    std::vector<int> results;
+    if(workers > 0) {
+      runWorkerPool(jobs, forkOptions, results);
     } else {
-        ss << vertex_shader_wo_version;
-    }
-    vertexContents = ss.str();
-  } else {
-    if(!readFile(vertex_shader, vertexContents)) {
-      return EXIT_FAILURE;
+      runForkServer(jobs, forkOptions, results);
     }
+    return reportBatch(jobs, results);
   }
 
-  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  temp = vertexContents.c_str();
-  glShaderSource(vertexShader, 1, &temp, NULL);
-  glCompileShader(vertexShader);
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &compileOk);
-  if (!compileOk) {
-    std::cerr << "Error compiling vertex shader." << std::endl;
-    printShaderError(vertexShader);
+  EGLDisplay display = 0;
+  EGLConfig config = 0;
+  EGLContext context = 0;
+  EGLSurface surface = 0;
+
+  bool res = init_gl(
+      width,
+      height,
+      display,
+      config,
+      context,
+      surface,
+      timeout_ms > 0
+  );
+
+  if(!res) {
     return EXIT_FAILURE;
   }
-  std::cerr << "Vertex shader compiled successfully." << std::endl;
 
-  glAttachShader(program, vertexShader);
+  TerminateEGLAtExit cleanup_display = display;
 
-  std::cerr << "Linking program." << std::endl;
-  glLinkProgram(program);
-  glGetProgramiv(program, GL_LINK_STATUS, &compileOk);
-  if (!compileOk) {
-    std::cerr << "Error in linking program." << std::endl;
-    printProgramError(program);
-    return LINK_ERROR_EXIT_CODE;
-  }
-  std::cerr << "Program linked successfully." << std::endl;
-  if (exit_linking) {
-    std::cout << "Exiting after program linking." << std::endl;
-    return EXIT_SUCCESS;
+  // The atlas is drawn into renderbuffers only, never the pbuffer.
+  GLLimits limits = driverLimits(display, config, gl_info_cache);
+  if(!checkResolution(limits, width, height) ||
+     (atlas_columns > 0 &&
+      !checkRenderTargetSize(limits, "Atlas", (long long) width * atlas_columns, (long long) height * atlas_rows))) {
+    return EXIT_FAILURE;
   }
 
-  GLint posAttribLocationAttempt = glGetAttribLocation(program, "vert2d");
-  if(posAttribLocationAttempt == -1) {
-    std::cerr << "Error getting vert2d attribute location." << std::endl;
-    return EXIT_FAILURE;
+  if(result_cache.length() > 0 || diagnostics_cache.length() > 0) {
+    pipelineOptions.driverIdentity = driverIdentity(display);
   }
-  GLuint posAttribLocation = (GLuint) posAttribLocationAttempt;
-  glEnableVertexAttribArray(posAttribLocation);
+  DiagnosticsCache diagnostics;
+  diagnostics.dir = diagnostics_cache;
+  diagnostics.driverIdentity = pipelineOptions.driverIdentity;
 
-  glUseProgram(program);
+  Watchdog watchdog(timeout_ms, TIMEOUT_EXIT_CODE);
+  watchdog.arm("compile");
 
-  GLuint vertexBuffer;
-  glGenBuffers(1, &vertexBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  PackWriter packWriter;
+  if(pack.length() > 0) {
+    if(!packWriter.open(pack, (std::uint64_t) pack_sync_mb << 20)) {
+      return EXIT_FAILURE;
+    }
+    pipelineOptions.pack = &packWriter;
+  }
 
-  GLuint indicesBuffer;
-  glGenBuffers(1, &indicesBuffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indicesBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  if(batch.length() > 0) {
+    int result = runBatch(display, surface, jobs, pipelineOptions, watchdog);
+    if(pack.length() > 0 && !packWriter.finish()) {
+      return EXIT_FAILURE;
+    }
+    return result;
+  }
 
-  GLint injectionSwitchLocation = glGetUniformLocation(program, "injectionSwitch");
-  GLint timeLocation = glGetUniformLocation(program, "time");
-  GLint mouseLocation = glGetUniformLocation(program, "mouse");
-  GLint resolutionLocation = glGetUniformLocation(program, "resolution");
+  // A hit skips compiling, linking and drawing altogether.
+  Job job;
+  job.fragment_shader = fragment_shader;
+  job.output = output;
+  ResultCacheKey cacheKey;
+  if(result_cache.length() > 0 && pipelineOptions.stopAfter == BUILD_ALL &&
+     renderCacheKey(job, pipelineOptions, cacheKey) &&
+     fetchCachedResult(result_cache, cacheKey, output)) {
+    return EXIT_SUCCESS;
+  }
+
+  std::string fragContents;
+  if(!readFile(fragment_shader, fragContents)) {
+    return EXIT_FAILURE;
+  }
 
-  if(injectionSwitchLocation != -1) {
-    glUniform2f(injectionSwitchLocation, 0.0f, 1.0f);
+  GLuint program = 0;
+  int result = buildProgram(fragContents, vertex_shader, pipelineOptions.stopAfter, program, watchdog, NULL,
+                            diagnostics.dir.length() > 0 ? &diagnostics : NULL);
+  if(result != EXIT_SUCCESS) {
+    return result;
   }
-  if(mouseLocation != -1) {
-    glUniform2f(mouseLocation, 0.0f, 0.0f);
+  if (exit_compile) {
+    std::cout << "Exiting after fragment shader compilation." << std::endl;
+    return EXIT_SUCCESS;
   }
-  if(timeLocation != -1) {
-    glUniform1f(timeLocation, 0.0f);
+  if (exit_linking) {
+    std::cout << "Exiting after program linking." << std::endl;
+    return EXIT_SUCCESS;
   }
 
-  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-  glVertexAttribPointer(posAttribLocation, 2, GL_FLOAT, GL_FALSE, 0, 0);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indicesBuffer);
+  GLuint vertexBuffer;
+  GLuint indicesBuffer;
+  result = initDrawBuffers(vertexBuffer, indicesBuffer);
+  if(result != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
 
-  int result = setUniforms(program, fragment_shader);
+  UniformState uniforms;
+  result = prepareProgram(program, fragment_shader, vertexBuffer, uniforms, watchdog);
   if(result != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
-  std::cerr << "Uniforms set successfully." << std::endl;
+
+  // The program is linked and prepared once; each combination only changes
+  // uniforms.
+  if(sweep.size() > 0) {
+    std::vector<Job> sweepJobs;
+    std::vector<int> results;
+    result = runUniformSweep(display, surface, uniforms, fragment_shader, sweep, output, pipelineOptions,
+                             watchdog, sweepJobs, results);
+    if((pack.length() > 0 && !packWriter.finish()) || result != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+    return reportBatch(sweepJobs, results);
+  }
 
   int numFrames = 0;
   bool saved = false;
@@ -552,39 +649,46 @@ int main(int argc, char* argv[]) {
   result = render(
       display,
       surface,
-      WIDTH,
-      HEIGHT,
+      width,
+      height,
       animate,
       numFrames,
       saved,
       output,
-      resolutionLocation,
-      timeLocation);
+      uniforms.location("resolution"),
+      uniforms.location("time"),
+      watchdog);
 
   if(result != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
 
+  if(watchdog.enabled()) {
+    result = waitForRender(watchdog);
+    if(result != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+  }
+
 //  ++numFrames;
 
 //  if(numFrames == DELAY && !saved) {
   std::cerr << "Capturing frame." << std::endl;
   saved = true;
-  unsigned uwidth = (unsigned int) WIDTH;
-  unsigned uheight = (unsigned int) HEIGHT;
-  std::vector<std::uint8_t> data(uwidth * uheight * CHANNELS);
-  glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
-  CHECK_ERROR("After glReadPixels");
-  std::vector<std::uint8_t> flipped_data(uwidth * uheight * CHANNELS);
-  for (unsigned int h = 0; h < uheight ; h++)
-    for (unsigned int col = 0; col < uwidth * CHANNELS; col++)
-      flipped_data[h * uwidth * CHANNELS + col] =
-          data[(uheight - h - 1) * uwidth * CHANNELS + col];
-  unsigned png_error = lodepng::encode(output, flipped_data, uwidth, uheight);
-  if (png_error) {
-    std::cerr << "Error producing PNG file: " << lodepng_error_text(png_error) << std::endl;
+  std::vector<std::uint8_t> data;
+  watchdog.setPhase("readback");
+  result = readPixels(width, height, data);
+  if(result != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
+  watchdog.disarm();
+  result = writePNG(output, data, (unsigned int) width, (unsigned int) height);
+  if(result != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if(cacheKey.name.length() > 0) {
+    storeCachedResult(result_cache, cacheKey, output, data);
+  }
   if (!persist) {
     return EXIT_SUCCESS;
   }
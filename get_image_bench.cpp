@@ -0,0 +1,525 @@
+#include "file_util.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+// Measures get_image throughput on generated shaders. Each family of
+// fragment shaders stresses one part of the render path, with a cost that
+// scales with --cost; the family's batch is run through get_image at every
+// resolution and worker count, and the shaders/s and, for in-process runs,
+// the per-phase times from --timing are reported.
+//
+// The shaders are a function of the seed, family, index and cost only, so
+// two runs with the same options render the same work.
+
+namespace {
+
+// Small and deterministic, so every platform generates the same shaders.
+class Random {
+  public:
+    explicit Random(std::uint64_t seed) : state(seed * 2862933555777941757ULL + 3037000493ULL) {}
+
+    // In [0, 1).
+    double next() {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      return (double) (state >> 11) / (double) (1ULL << 53);
+    }
+
+    double range(double low, double high) {
+      return low + (high - low) * next();
+    }
+
+  private:
+    std::uint64_t state;
+};
+
+struct Shader {
+  std::string source;
+  json uniforms;
+};
+
+struct Family {
+  const char* name;
+  const char* description;
+  Shader (*generate)(Random& random, long cost);
+};
+
+struct Configuration {
+  std::string resolution;
+  long workers;
+};
+
+}
+
+// get_image picks its embedded vertex shader by looking for "300" in the
+// fragment shader, so no literal may contain it.
+static std::string literal(double value) {
+  for(;;) {
+    std::ostringstream ss;
+    ss.setf(std::ios::fixed);
+    ss.precision(4);
+    ss << value;
+    if(ss.str().find("300") == std::string::npos) {
+      return ss.str();
+    }
+    value += 0.0001;
+  }
+}
+
+static std::string literal(long value) {
+  while(std::to_string(value).find("300") != std::string::npos) {
+    ++value;
+  }
+  return std::to_string(value);
+}
+
+// Letters only, for the same reason: a, b, ..., z, ba, bb, ...
+static std::string letters(long index) {
+  std::string name;
+  do {
+    name.insert(name.begin(), (char) ('a' + index % 26));
+    index /= 26;
+  } while(index > 0);
+  return name;
+}
+
+static const char* const HEADER =
+    "#version 100\n"
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform vec2 resolution;\n"
+    "uniform float time;\n";
+
+// The usual uniforms, so that get_image does not warn about defaults.
+static json baseUniforms(Random& random) {
+  json uniforms;
+  uniforms["injectionSwitch"] = {{"func", "glUniform2f"}, {"args", {0.0, 1.0}}};
+  uniforms["time"] = {{"func", "glUniform1f"}, {"args", {random.range(0.0, 10.0)}}};
+  uniforms["mouse"] = {{"func", "glUniform2f"}, {"args", {0.0, 0.0}}};
+  uniforms["resolution"] = {{"func", "glUniform2f"}, {"args", {256.0, 256.0}}};
+  return uniforms;
+}
+
+// Arithmetic in a long loop: fragment ALU throughput.
+static Shader generateAlu(Random& random, long cost) {
+  Shader shader;
+  shader.uniforms = baseUniforms(random);
+  std::ostringstream ss;
+  ss << HEADER
+     << "void main() {\n"
+     << "  vec3 c = vec3(gl_FragCoord.xy / resolution, " << literal(random.next()) << ");\n"
+     << "  for(int i = 0; i < " << literal(32 * cost) << "; i++) {\n"
+     << "    c = fract(sin(c * " << literal(random.range(1.0, 9.0)) << " + vec3("
+     << literal(random.next()) << ", " << literal(random.next()) << ", " << literal(random.next())
+     << ") + time) * " << literal(random.range(10.0, 100.0)) << ");\n"
+     << "  }\n"
+     << "  gl_FragColor = vec4(c, 1.0);\n"
+     << "}\n";
+  shader.source = ss.str();
+  return shader;
+}
+
+// Loops of different lengths chosen per pixel: divergent branches.
+static Shader generateBranch(Random& random, long cost) {
+  Shader shader;
+  shader.uniforms = baseUniforms(random);
+  std::ostringstream ss;
+  ss << HEADER
+     << "void main() {\n"
+     << "  float h = fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233))) * 43758.5453);\n"
+     << "  vec2 p = gl_FragCoord.xy / resolution;\n"
+     << "  float v = " << literal(random.next()) << ";\n";
+  const int paths = 4;
+  for(int path = 0; path < paths; path++) {
+    ss << "  " << (path == 0 ? "" : "} else ") << (path + 1 < paths ? "if(h < " + literal((path + 1.0) / paths) + ") " : "")
+       << "{\n"
+       << "    for(int i = 0; i < " << literal(8 * cost * (path + 1)) << "; i++) {\n"
+       << "      v = fract(v * " << literal(random.range(2.0, 9.0)) << " + " << (path % 2 == 0 ? "p.x" : "p.y")
+       << " + sin(v + time));\n"
+       << "    }\n";
+  }
+  ss << "  }\n"
+     << "  gl_FragColor = vec4(v, h, p.x, 1.0);\n"
+     << "}\n";
+  shader.source = ss.str();
+  return shader;
+}
+
+// Many separate uniforms: reflection and upload per job.
+static Shader generateUniforms(Random& random, long cost) {
+  Shader shader;
+  shader.uniforms = baseUniforms(random);
+  const long count = 32 * cost;
+  std::ostringstream declarations;
+  std::ostringstream body;
+  for(long i = 0; i < count; i++) {
+    std::string name = "u_" + letters(i);
+    declarations << "uniform float " << name << ";\n";
+    body << "  v += " << name << " * sin(p.x * " << literal(random.range(1.0, 20.0)) << " + p.y);\n";
+    shader.uniforms[name] = {{"func", "glUniform1f"}, {"args", {random.range(-1.0, 1.0)}}};
+  }
+  std::ostringstream ss;
+  ss << HEADER << declarations.str()
+     << "void main() {\n"
+     << "  vec2 p = gl_FragCoord.xy / resolution;\n"
+     << "  float v = 0.0;\n"
+     << body.str()
+     << "  gl_FragColor = vec4(fract(v), p, 1.0);\n"
+     << "}\n";
+  shader.source = ss.str();
+  return shader;
+}
+
+// One large uniform array, read in a loop. Float elements keep well under
+// the minimum of 224 fragment uniform vectors of OpenGL ES 3.0.
+static Shader generateArray(Random& random, long cost) {
+  Shader shader;
+  shader.uniforms = baseUniforms(random);
+  long count = 48 * cost;
+  if(count > 192) {
+    count = 192;
+  }
+  json args = json::array();
+  for(long i = 0; i < count; i++) {
+    args.push_back(random.range(-1.0, 1.0));
+  }
+  // Arrays are reported by their first element.
+  shader.uniforms["values[0]"] = {{"func", "glUniform1fv"}, {"args", args}};
+  std::ostringstream ss;
+  ss << HEADER
+     << "uniform float values[" << literal(count) << "];\n"
+     << "void main() {\n"
+     << "  vec2 p = gl_FragCoord.xy / resolution;\n"
+     << "  float v = 0.0;\n"
+     << "  for(int i = 0; i < " << literal(count) << "; i++) {\n"
+     << "    v += values[i] * sin(p.x * float(i) + p.y);\n"
+     << "  }\n"
+     << "  gl_FragColor = vec4(fract(v), p, 1.0);\n"
+     << "}\n";
+  shader.source = ss.str();
+  return shader;
+}
+
+// A long chain of functions: compile and link time, cheap to draw.
+static Shader generateLong(Random& random, long cost) {
+  Shader shader;
+  shader.uniforms = baseUniforms(random);
+  const long count = 64 * cost;
+  std::ostringstream ss;
+  ss << HEADER
+     << "float f_a(float x) {\n"
+     << "  return sin(x);\n"
+     << "}\n";
+  for(long i = 1; i < count; i++) {
+    ss << "float f_" << letters(i) << "(float x) {\n"
+       << "  float y = x * " << literal(random.range(0.5, 1.5)) << " + " << literal(random.next()) << ";\n"
+       << "  return f_" << letters(i - 1) << "(y) * " << literal(random.range(0.5, 1.0)) << " + cos(y) * "
+       << literal(random.range(0.0, 0.5)) << ";\n"
+       << "}\n";
+  }
+  ss << "void main() {\n"
+     << "  vec2 p = gl_FragCoord.xy / resolution;\n"
+     << "  gl_FragColor = vec4(fract(f_" << letters(count - 1) << "(p.x + p.y + time)), p, 1.0);\n"
+     << "}\n";
+  shader.source = ss.str();
+  return shader;
+}
+
+static const Family FAMILIES[] = {
+  {"alu", "arithmetic loop", generateAlu},
+  {"branch", "divergent loops", generateBranch},
+  {"uniforms", "many uniforms", generateUniforms},
+  {"array", "uniform array", generateArray},
+  {"long", "long source", generateLong}
+};
+
+static std::vector<std::string> splitList(const std::string& list) {
+  std::vector<std::string> items;
+  std::istringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ',')) {
+    if(item.length() > 0) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+// Writes count shaders of family, with their .json, into dir/<family>/.
+static bool generateFamily(const Family& family, const std::string& dir, long count, long cost, long seed) {
+  std::string familyDir = dir + "/" + family.name;
+  if(!makeDirectory(familyDir)) {
+    std::cerr << "Could not create " << familyDir << std::endl;
+    return false;
+  }
+  for(long i = 0; i < count; i++) {
+    // Seeded per shader, so that changing --count keeps the others as they
+    // were.
+    Random random((std::uint64_t) seed * 1000003ULL + (std::uint64_t) (&family - FAMILIES) * 7919ULL + (std::uint64_t) i);
+    Shader shader = family.generate(random, cost);
+    std::ostringstream name;
+    name << familyDir << "/" << family.name << "_";
+    name.width(3);
+    name.fill('0');
+    name << i;
+    if(!writeFileAtomic(name.str() + ".frag", shader.source) ||
+       !writeFileAtomic(name.str() + ".json", shader.uniforms.dump(2) + "\n")) {
+      std::cerr << "Could not write " << name.str() << ".frag" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string quote(const std::string& arg) {
+  return "\"" + arg + "\"";
+}
+
+// get_image next to this program.
+static std::string defaultGetImage(const char* program) {
+  std::string path(program);
+  size_t slash = path.find_last_of("/\\");
+  std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+#ifdef _WIN32
+  return dir + "\\get_image.exe";
+#else
+  return dir + "/get_image";
+#endif
+}
+
+// Phases shown per shader for in-process runs, in pipeline order.
+static const char* const PHASES[] = {
+  "compile", "link", "setUniforms", "render", "wait_gpu", "readback", "flip", "encode", "write_file"
+};
+
+static void printUsage(const char* program) {
+  std::cerr <<
+      "Usage: " << program << " [options]\n"
+      "\n"
+      "Options:\n"
+      "  --get-image <path>       get_image to run (default: next to this program)\n"
+      "  --dir <dir>              where the shaders are generated (default bench_shaders)\n"
+      "  --families <list>        comma-separated subset of alu,branch,uniforms,array,long\n"
+      "  --count <n>              shaders per family (default 8)\n"
+      "  --cost <n>               cost multiplier of every family (default 1)\n"
+      "  --seed <n>               generator seed (default 1)\n"
+      "  --resolutions <list>     comma-separated <w>x<h> (default 64x64,256x256,1024x1024)\n"
+      "  --workers <list>         comma-separated worker counts; 0 renders in process\n"
+      "                           and adds the per-phase times (default 0,2)\n"
+      "  --encoders <n>           encoder threads of in-process runs (default 1)\n"
+      "  --repeat <n>             runs per configuration, the fastest kept (default 3)\n"
+      "  --json <file>            write every result as JSON too\n"
+      "  --generate-only          write the shaders and stop\n";
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string getImage = defaultGetImage(argv[0]);
+  std::string dir("bench_shaders");
+  std::vector<std::string> familyNames;
+  long count = 8;
+  long cost = 1;
+  long seed = 1;
+  std::vector<std::string> resolutions = splitList("64x64,256x256,1024x1024");
+  std::vector<std::string> workerCounts = splitList("0,2");
+  long encoders = 1;
+  long repeat = 3;
+  std::string jsonFile;
+  bool generateOnly = false;
+
+  for(int i = 1; i < argc; i++) {
+    std::string curr_arg = std::string(argv[i]);
+    bool hasValue = i + 1 < argc;
+    if(curr_arg == "--help") {
+      printUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if(curr_arg == "--generate-only") {
+      generateOnly = true;
+    } else if(curr_arg == "--get-image" && hasValue) {
+      getImage = argv[++i];
+    } else if(curr_arg == "--dir" && hasValue) {
+      dir = argv[++i];
+    } else if(curr_arg == "--families" && hasValue) {
+      familyNames = splitList(argv[++i]);
+    } else if(curr_arg == "--count" && hasValue) {
+      count = std::atol(argv[++i]);
+    } else if(curr_arg == "--cost" && hasValue) {
+      cost = std::atol(argv[++i]);
+    } else if(curr_arg == "--seed" && hasValue) {
+      seed = std::atol(argv[++i]);
+    } else if(curr_arg == "--resolutions" && hasValue) {
+      resolutions = splitList(argv[++i]);
+    } else if(curr_arg == "--workers" && hasValue) {
+      workerCounts = splitList(argv[++i]);
+    } else if(curr_arg == "--encoders" && hasValue) {
+      encoders = std::atol(argv[++i]);
+    } else if(curr_arg == "--repeat" && hasValue) {
+      repeat = std::atol(argv[++i]);
+    } else if(curr_arg == "--json" && hasValue) {
+      jsonFile = argv[++i];
+    } else {
+      std::cerr << "Unknown or incomplete argument " << curr_arg << std::endl;
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(count < 1 || cost < 1 || repeat < 1 || encoders < 1 || resolutions.empty() || workerCounts.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<const Family*> families;
+  for(const Family& family : FAMILIES) {
+    bool wanted = familyNames.empty();
+    for(const std::string& name : familyNames) {
+      wanted = wanted || name == family.name;
+    }
+    if(wanted) {
+      families.push_back(&family);
+    }
+  }
+  if(families.size() < (familyNames.empty() ? 1 : familyNames.size())) {
+    std::cerr << "Unknown family in --families (expected alu, branch, uniforms, array or long)" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if(!makeDirectory(dir)) {
+    std::cerr << "Could not create " << dir << std::endl;
+    return EXIT_FAILURE;
+  }
+  for(const Family* family : families) {
+    if(!generateFamily(*family, dir, count, cost, seed)) {
+      return EXIT_FAILURE;
+    }
+  }
+  std::printf("%zu families of %ld shaders, cost %ld, seed %ld, in %s\n",
+              families.size(), count, cost, seed, dir.c_str());
+  if(generateOnly) {
+    return EXIT_SUCCESS;
+  }
+
+  std::vector<Configuration> configurations;
+  for(const std::string& resolution : resolutions) {
+    for(const std::string& workers : workerCounts) {
+      configurations.push_back({resolution, std::atol(workers.c_str())});
+    }
+  }
+
+  const std::string log = dir + "/bench.log";
+  const std::string timingFile = dir + "/timing.json";
+  json results = json::array();
+  bool failed = false;
+
+  std::printf("%-10s %11s %7s %7s %9s %10s\n", "family", "resolution", "workers", "shaders", "seconds", "shaders/s");
+  for(const Family* family : families) {
+    for(const Configuration& configuration : configurations) {
+      std::ostringstream command;
+      command << quote(getImage) << " --batch " << quote(dir + "/" + family->name)
+              << " --resolution " << configuration.resolution;
+      if(configuration.workers > 0) {
+        command << " --workers " << configuration.workers;
+      } else {
+        command << " --encoders " << encoders << " --timing " << quote(timingFile);
+      }
+      command << " > " << quote(log) << " 2>&1";
+
+      double best = 0;
+      json phases;
+      bool ok = true;
+      for(long r = 0; r < repeat && ok; r++) {
+        auto start = std::chrono::steady_clock::now();
+        int status = std::system(command.str().c_str());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(status != 0) {
+          std::cerr << family->name << " at " << configuration.resolution << " with " << configuration.workers
+                    << " workers failed; see " << log << std::endl;
+          ok = false;
+          failed = true;
+          break;
+        }
+        if(r > 0 && seconds >= best) {
+          continue;
+        }
+        best = seconds;
+        if(configuration.workers == 0) {
+          std::ifstream timing(timingFile.c_str());
+          try {
+            phases = json::parse(timing)["phases"];
+          } catch(const std::exception& e) {
+            phases = json();
+          }
+        }
+      }
+      if(!ok) {
+        continue;
+      }
+
+      std::printf("%-10s %11s %7ld %7ld %9.3f %10.1f\n", family->name, configuration.resolution.c_str(),
+                  configuration.workers, count, best, count / best);
+      json result;
+      result["family"] = family->name;
+      result["resolution"] = configuration.resolution;
+      result["workers"] = configuration.workers;
+      result["shaders"] = count;
+      result["seconds"] = best;
+      result["shaders_per_second"] = count / best;
+      if(phases.is_object()) {
+        result["phases"] = phases;
+      }
+      results.push_back(result);
+    }
+  }
+
+  // Per shader, from the in-process runs. Encoding overlaps with drawing, so
+  // the phases add up to more than the wall time per shader.
+  std::printf("\nms per shader, in-process runs\n%-10s %11s", "family", "resolution");
+  for(const char* phase : PHASES) {
+    std::printf(" %11s", phase);
+  }
+  std::printf("\n");
+  for(const json& result : results) {
+    if(result.count("phases") == 0) {
+      continue;
+    }
+    std::printf("%-10s %11s", result["family"].get<std::string>().c_str(),
+                result["resolution"].get<std::string>().c_str());
+    for(const char* phase : PHASES) {
+      const json& phases = result["phases"];
+      double ms = phases.count(phase) ? phases[phase]["total_ms"].get<double>() / count : 0.0;
+      std::printf(" %11.3f", ms);
+    }
+    std::printf("\n");
+  }
+
+  if(jsonFile.length() > 0) {
+    json out;
+    out["families"] = json::array();
+    for(const Family* family : families) {
+      out["families"].push_back({{"name", family->name}, {"description", family->description}});
+    }
+    out["count"] = count;
+    out["cost"] = cost;
+    out["seed"] = seed;
+    out["results"] = results;
+    if(!writeFileAtomic(jsonFile, out.dump(2) + "\n")) {
+      std::cerr << "Could not write " << jsonFile << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+#include "file_util.h"
+#include "hash.h"
+#include "pack.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Lists and extracts the entries of a pack written by get_image --pack.
+
+static void printUsage(const char* program) {
+  std::cerr <<
+      "Usage: " << program << " list <pack>\n"
+      "       " << program << " extract <pack> <job> [<file>]\n"
+      "       " << program << " extract-all <pack> <dir>\n"
+      "\n"
+      "extract writes to the job's original output unless a file is given (- for\n"
+      "stdout); extract-all writes <dir>/<job>.png or <dir>/<job>.rgba.\n";
+}
+
+static bool loadEntries(const std::string& pack, std::vector<PackEntry>& entries) {
+  bool complete = false;
+  if(!readPackIndex(pack, entries, complete)) {
+    return false;
+  }
+  if(!complete) {
+    std::cerr << "Warning: " << pack << " has no index (unfinished batch?); recovered "
+              << entries.size() << " entries by scanning." << std::endl;
+  }
+  return true;
+}
+
+static bool writeEntry(const std::string& pack, const PackEntry& entry, const std::string& file) {
+  if(entry.kind == PACK_HASH) {
+    std::cerr << "Job " << entry.job << " has no data, only its pixel hash" << std::endl;
+    return false;
+  }
+  std::vector<unsigned char> data;
+  if(!readPackData(pack, entry, data)) {
+    return false;
+  }
+  if(file == "-") {
+    return std::fwrite(data.data(), 1, data.size(), stdout) == data.size() && std::fflush(stdout) == 0;
+  }
+  if(!writeFileAtomic(file, data.data(), data.size())) {
+    std::cerr << "Error writing " << file << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static int list(const std::string& pack) {
+  std::vector<PackEntry> entries;
+  if(!loadEntries(pack, entries)) {
+    return EXIT_FAILURE;
+  }
+  for(const PackEntry& entry : entries) {
+    std::cout << entry.job << "\t" << packKindName(entry.kind) << "\t" << entry.width << "x" << entry.height
+              << "\t" << entry.length << "\t" << hashToHex(entry.pixelHash) << "\t" << entry.name << "\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+static int extract(const std::string& pack, const std::string& job, const std::string& file) {
+  std::vector<PackEntry> entries;
+  if(!loadEntries(pack, entries)) {
+    return EXIT_FAILURE;
+  }
+  for(const PackEntry& entry : entries) {
+    std::ostringstream id;
+    id << entry.job;
+    if(id.str() == job) {
+      return writeEntry(pack, entry, file.length() > 0 ? file : entry.name) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  std::cerr << "No job " << job << " in " << pack << std::endl;
+  return EXIT_FAILURE;
+}
+
+static int extractAll(const std::string& pack, const std::string& dir) {
+  std::vector<PackEntry> entries;
+  if(!loadEntries(pack, entries)) {
+    return EXIT_FAILURE;
+  }
+  if(!makeDirectory(dir)) {
+    std::cerr << "Could not create " << dir << std::endl;
+    return EXIT_FAILURE;
+  }
+  size_t written = 0;
+  for(const PackEntry& entry : entries) {
+    if(entry.kind == PACK_HASH) {
+      continue;
+    }
+    std::ostringstream file;
+    file << dir << "/" << entry.job << (entry.kind == PACK_PNG ? ".png" : ".rgba");
+    if(!writeEntry(pack, entry, file.str())) {
+      return EXIT_FAILURE;
+    }
+    ++written;
+  }
+  std::cerr << "Extracted " << written << " of " << entries.size() << " entries." << std::endl;
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+
+  std::vector<std::string> args(argv + 1, argv + argc);
+  if(args.size() == 2 && args[0] == "list") {
+    return list(args[1]);
+  }
+  if((args.size() == 3 || args.size() == 4) && args[0] == "extract") {
+    return extract(args[1], args[2], args.size() == 4 ? args[3] : std::string());
+  }
+  if(args.size() == 3 && args[0] == "extract-all") {
+    return extractAll(args[1], args[2]);
+  }
+  printUsage(argv[0]);
+  return args.size() == 1 && args[0] == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+#include "gl_dispatch.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#define EGL_DISPATCH_DEFINE(name) PFN_##name dispatch_##name = NULL;
+EGL_DISPATCH_FUNCTIONS(EGL_DISPATCH_DEFINE)
+#undef EGL_DISPATCH_DEFINE
+
+#define GL_DISPATCH_DEFINE(type, name) type dispatch_##name = NULL;
+GL_DISPATCH_FUNCTIONS(GL_DISPATCH_DEFINE)
+#undef GL_DISPATCH_DEFINE
+
+#if defined(_WIN32)
+static const char* const DEFAULT_EGL_LIBS[] = { "libEGL.dll", NULL };
+static const char* const DEFAULT_GLES_LIBS[] = { "libGLESv2.dll", NULL };
+#elif defined(__APPLE__)
+static const char* const DEFAULT_EGL_LIBS[] = { "libEGL.dylib", NULL };
+static const char* const DEFAULT_GLES_LIBS[] = { "libGLESv2.dylib", NULL };
+#else
+static const char* const DEFAULT_EGL_LIBS[] = { "libEGL.so.1", "libEGL.so", NULL };
+static const char* const DEFAULT_GLES_LIBS[] = { "libGLESv2.so.2", "libGLESv2.so", NULL };
+#endif
+
+static std::string configuredEGLLib;
+static std::string configuredGLESLib;
+
+void configureGLLibraries(const std::string& eglLib, const std::string& glesLib) {
+  configuredEGLLib = eglLib;
+  configuredGLESLib = glesLib;
+}
+
+static void* openLibrary(const std::string& name) {
+#ifdef _WIN32
+  return (void*) LoadLibraryA(name.c_str());
+#else
+  return dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+static void* findSymbol(void* library, const char* name) {
+#ifdef _WIN32
+  return (void*) GetProcAddress((HMODULE) library, name);
+#else
+  return dlsym(library, name);
+#endif
+}
+
+static std::string lastLoadError() {
+#ifdef _WIN32
+  return "error " + std::to_string(GetLastError());
+#else
+  const char* error = dlerror();
+  return error == NULL ? std::string("unknown error") : std::string(error);
+#endif
+}
+
+// Tries the configured name, then the environment variable, then defaults.
+static void* openFirst(const std::string& configured, const char* envVar, const char* const* defaults) {
+  std::vector<std::string> candidates;
+  if(configured.length() > 0) {
+    candidates.push_back(configured);
+  } else if(std::getenv(envVar) != NULL && *std::getenv(envVar) != '\0') {
+    candidates.push_back(std::getenv(envVar));
+  } else {
+    for(const char* const* name = defaults; *name != NULL; ++name) {
+      candidates.push_back(*name);
+    }
+  }
+  std::string errors;
+  for(size_t i = 0; i < candidates.size(); i++) {
+    void* library = openLibrary(candidates[i]);
+    if(library != NULL) {
+      return library;
+    }
+    errors += "\n  " + candidates[i] + ": " + lastLoadError();
+  }
+  std::cerr << "Could not load library (set " << envVar << " to override):" << errors << std::endl;
+  return NULL;
+}
+
+static bool loadAll() {
+  void* egl = openFirst(configuredEGLLib, "GET_IMAGE_EGL_LIB", DEFAULT_EGL_LIBS);
+  if(egl == NULL) {
+    return false;
+  }
+  void* gles = openFirst(configuredGLESLib, "GET_IMAGE_GLES_LIB", DEFAULT_GLES_LIBS);
+  if(gles == NULL) {
+    return false;
+  }
+
+  bool ok = true;
+
+#define EGL_DISPATCH_RESOLVE(name) \
+  dispatch_##name = (PFN_##name) findSymbol(egl, #name); \
+  if(dispatch_##name == NULL) { \
+    std::cerr << "Missing EGL entry point " #name << std::endl; \
+    ok = false; \
+  }
+  EGL_DISPATCH_FUNCTIONS(EGL_DISPATCH_RESOLVE)
+#undef EGL_DISPATCH_RESOLVE
+
+  if(!ok) {
+    return false;
+  }
+
+  // Some implementations only expose GLES 3 entry points through
+  // eglGetProcAddress.
+#define GL_DISPATCH_RESOLVE(type, name) \
+  dispatch_##name = (type) findSymbol(gles, #name); \
+  if(dispatch_##name == NULL) { \
+    dispatch_##name = (type) dispatch_eglGetProcAddress(#name); \
+  } \
+  if(dispatch_##name == NULL) { \
+    std::cerr << "Missing GLES entry point " #name << std::endl; \
+    ok = false; \
+  }
+  GL_DISPATCH_FUNCTIONS(GL_DISPATCH_RESOLVE)
+#undef GL_DISPATCH_RESOLVE
+
+  return ok;
+}
+
+bool loadGLLibraries() {
+  static bool loaded = loadAll();
+  return loaded;
+}
@@ -0,0 +1,208 @@
+#ifndef CPP_GL_DISPATCH_H
+#define CPP_GL_DISPATCH_H
+
+// EGL and GLES entry points resolved at runtime from libraries chosen with
+// --egl-lib/--gles-lib (or GET_IMAGE_EGL_LIB/GET_IMAGE_GLES_LIB), so one build
+// can switch between SwiftShader, ANGLE and Mesa.
+//
+// Include this instead of the EGL/GLES headers. Each entry point used by the
+// tools is a function pointer, and a macro maps the usual name onto it, so
+// call sites read as plain GL. A new entry point must be added to the list
+// below and given a matching #define.
+
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+#include "GLES3/gl3.h"
+#include "GLES2/gl2ext.h"
+
+#include <string>
+
+#define EGL_DISPATCH_FUNCTIONS(X) \
+  X(eglChooseConfig) \
+  X(eglCreateContext) \
+  X(eglCreatePbufferSurface) \
+  X(eglDestroyContext) \
+  X(eglDestroySurface) \
+  X(eglGetConfigAttrib) \
+  X(eglGetConfigs) \
+  X(eglGetCurrentContext) \
+  X(eglGetDisplay) \
+  X(eglGetError) \
+  X(eglGetProcAddress) \
+  X(eglInitialize) \
+  X(eglMakeCurrent) \
+  X(eglQueryString) \
+  X(eglReleaseThread) \
+  X(eglSwapBuffers) \
+  X(eglTerminate)
+
+#define GL_DISPATCH_FUNCTIONS(X) \
+  X(PFNGLATTACHSHADERPROC, glAttachShader) \
+  X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+  X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+  X(PFNGLBINDRENDERBUFFERPROC, glBindRenderbuffer) \
+  X(PFNGLBUFFERDATAPROC, glBufferData) \
+  X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
+  X(PFNGLCLEARPROC, glClear) \
+  X(PFNGLCLEARCOLORPROC, glClearColor) \
+  X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync) \
+  X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+  X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+  X(PFNGLCREATESHADERPROC, glCreateShader) \
+  X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+  X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+  X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+  X(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers) \
+  X(PFNGLDELETESHADERPROC, glDeleteShader) \
+  X(PFNGLDELETESYNCPROC, glDeleteSync) \
+  X(PFNGLDISABLEPROC, glDisable) \
+  X(PFNGLDRAWELEMENTSPROC, glDrawElements) \
+  X(PFNGLENABLEPROC, glEnable) \
+  X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray) \
+  X(PFNGLFENCESYNCPROC, glFenceSync) \
+  X(PFNGLFLUSHPROC, glFlush) \
+  X(PFNGLFRAMEBUFFERRENDERBUFFERPROC, glFramebufferRenderbuffer) \
+  X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+  X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+  X(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers) \
+  X(PFNGLGETACTIVEUNIFORMPROC, glGetActiveUniform) \
+  X(PFNGLGETATTRIBLOCATIONPROC, glGetAttribLocation) \
+  X(PFNGLGETERRORPROC, glGetError) \
+  X(PFNGLGETINTEGERVPROC, glGetIntegerv) \
+  X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+  X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+  X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+  X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+  X(PFNGLGETSTRINGPROC, glGetString) \
+  X(PFNGLGETSTRINGIPROC, glGetStringi) \
+  X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+  X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+  X(PFNGLREADPIXELSPROC, glReadPixels) \
+  X(PFNGLRENDERBUFFERSTORAGEPROC, glRenderbufferStorage) \
+  X(PFNGLSCISSORPROC, glScissor) \
+  X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+  X(PFNGLUNIFORM1FPROC, glUniform1f) \
+  X(PFNGLUNIFORM1FVPROC, glUniform1fv) \
+  X(PFNGLUNIFORM1IPROC, glUniform1i) \
+  X(PFNGLUNIFORM1IVPROC, glUniform1iv) \
+  X(PFNGLUNIFORM2FPROC, glUniform2f) \
+  X(PFNGLUNIFORM2FVPROC, glUniform2fv) \
+  X(PFNGLUNIFORM2IPROC, glUniform2i) \
+  X(PFNGLUNIFORM2IVPROC, glUniform2iv) \
+  X(PFNGLUNIFORM3FPROC, glUniform3f) \
+  X(PFNGLUNIFORM3FVPROC, glUniform3fv) \
+  X(PFNGLUNIFORM3IPROC, glUniform3i) \
+  X(PFNGLUNIFORM3IVPROC, glUniform3iv) \
+  X(PFNGLUNIFORM4FPROC, glUniform4f) \
+  X(PFNGLUNIFORM4FVPROC, glUniform4fv) \
+  X(PFNGLUNIFORM4IPROC, glUniform4i) \
+  X(PFNGLUNIFORM4IVPROC, glUniform4iv) \
+  X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+  X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+  X(PFNGLVIEWPORTPROC, glViewport)
+
+// egl.h only has prototypes, so take the pointer types from those before the
+// names are redirected below.
+#define EGL_DISPATCH_TYPEDEF(name) typedef decltype(&::name) PFN_##name;
+EGL_DISPATCH_FUNCTIONS(EGL_DISPATCH_TYPEDEF)
+#undef EGL_DISPATCH_TYPEDEF
+
+#define EGL_DISPATCH_DECLARE(name) extern PFN_##name dispatch_##name;
+EGL_DISPATCH_FUNCTIONS(EGL_DISPATCH_DECLARE)
+#undef EGL_DISPATCH_DECLARE
+
+#define GL_DISPATCH_DECLARE(type, name) extern type dispatch_##name;
+GL_DISPATCH_FUNCTIONS(GL_DISPATCH_DECLARE)
+#undef GL_DISPATCH_DECLARE
+
+#define eglChooseConfig dispatch_eglChooseConfig
+#define eglCreateContext dispatch_eglCreateContext
+#define eglCreatePbufferSurface dispatch_eglCreatePbufferSurface
+#define eglDestroyContext dispatch_eglDestroyContext
+#define eglDestroySurface dispatch_eglDestroySurface
+#define eglGetConfigAttrib dispatch_eglGetConfigAttrib
+#define eglGetConfigs dispatch_eglGetConfigs
+#define eglGetCurrentContext dispatch_eglGetCurrentContext
+#define eglGetDisplay dispatch_eglGetDisplay
+#define eglGetError dispatch_eglGetError
+#define eglGetProcAddress dispatch_eglGetProcAddress
+#define eglInitialize dispatch_eglInitialize
+#define eglMakeCurrent dispatch_eglMakeCurrent
+#define eglQueryString dispatch_eglQueryString
+#define eglReleaseThread dispatch_eglReleaseThread
+#define eglSwapBuffers dispatch_eglSwapBuffers
+#define eglTerminate dispatch_eglTerminate
+
+#define glAttachShader dispatch_glAttachShader
+#define glBindBuffer dispatch_glBindBuffer
+#define glBindFramebuffer dispatch_glBindFramebuffer
+#define glBindRenderbuffer dispatch_glBindRenderbuffer
+#define glBufferData dispatch_glBufferData
+#define glCheckFramebufferStatus dispatch_glCheckFramebufferStatus
+#define glClear dispatch_glClear
+#define glClearColor dispatch_glClearColor
+#define glClientWaitSync dispatch_glClientWaitSync
+#define glCompileShader dispatch_glCompileShader
+#define glCreateProgram dispatch_glCreateProgram
+#define glCreateShader dispatch_glCreateShader
+#define glDeleteBuffers dispatch_glDeleteBuffers
+#define glDeleteFramebuffers dispatch_glDeleteFramebuffers
+#define glDeleteProgram dispatch_glDeleteProgram
+#define glDeleteRenderbuffers dispatch_glDeleteRenderbuffers
+#define glDeleteShader dispatch_glDeleteShader
+#define glDeleteSync dispatch_glDeleteSync
+#define glDisable dispatch_glDisable
+#define glDrawElements dispatch_glDrawElements
+#define glEnable dispatch_glEnable
+#define glEnableVertexAttribArray dispatch_glEnableVertexAttribArray
+#define glFenceSync dispatch_glFenceSync
+#define glFlush dispatch_glFlush
+#define glFramebufferRenderbuffer dispatch_glFramebufferRenderbuffer
+#define glGenBuffers dispatch_glGenBuffers
+#define glGenFramebuffers dispatch_glGenFramebuffers
+#define glGenRenderbuffers dispatch_glGenRenderbuffers
+#define glGetActiveUniform dispatch_glGetActiveUniform
+#define glGetAttribLocation dispatch_glGetAttribLocation
+#define glGetError dispatch_glGetError
+#define glGetIntegerv dispatch_glGetIntegerv
+#define glGetProgramInfoLog dispatch_glGetProgramInfoLog
+#define glGetProgramiv dispatch_glGetProgramiv
+#define glGetShaderInfoLog dispatch_glGetShaderInfoLog
+#define glGetShaderiv dispatch_glGetShaderiv
+#define glGetString dispatch_glGetString
+#define glGetStringi dispatch_glGetStringi
+#define glGetUniformLocation dispatch_glGetUniformLocation
+#define glLinkProgram dispatch_glLinkProgram
+#define glReadPixels dispatch_glReadPixels
+#define glRenderbufferStorage dispatch_glRenderbufferStorage
+#define glScissor dispatch_glScissor
+#define glShaderSource dispatch_glShaderSource
+#define glUniform1f dispatch_glUniform1f
+#define glUniform1fv dispatch_glUniform1fv
+#define glUniform1i dispatch_glUniform1i
+#define glUniform1iv dispatch_glUniform1iv
+#define glUniform2f dispatch_glUniform2f
+#define glUniform2fv dispatch_glUniform2fv
+#define glUniform2i dispatch_glUniform2i
+#define glUniform2iv dispatch_glUniform2iv
+#define glUniform3f dispatch_glUniform3f
+#define glUniform3fv dispatch_glUniform3fv
+#define glUniform3i dispatch_glUniform3i
+#define glUniform3iv dispatch_glUniform3iv
+#define glUniform4f dispatch_glUniform4f
+#define glUniform4fv dispatch_glUniform4fv
+#define glUniform4i dispatch_glUniform4i
+#define glUniform4iv dispatch_glUniform4iv
+#define glUseProgram dispatch_glUseProgram
+#define glVertexAttribPointer dispatch_glVertexAttribPointer
+#define glViewport dispatch_glViewport
+
+// Library names used by loadGLLibraries; empty means the environment variable
+// or, failing that, the platform default. Must be called before loading.
+void configureGLLibraries(const std::string& eglLib, const std::string& glesLib);
+
+// Loads the configured libraries and resolves every entry point, once; later
+// calls return the first result. Reports what failed on stderr.
+bool loadGLLibraries();
+
+#endif //CPP_GL_DISPATCH_H
@@ -0,0 +1,259 @@
+#include "gl_info.h"
+
+#include "file_util.h"
+#include "hash.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using json = nlohmann::json;
+
+// Desktop GL 4.3 / GL_KHR_parallel_shader_compile enums, absent from the ES
+// headers.
+#ifndef GL_NUM_SHADING_LANGUAGE_VERSIONS
+#define GL_NUM_SHADING_LANGUAGE_VERSIONS 0x82E9
+#endif
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+
+// Bumped whenever the layout of collectGLInfo changes, so stale cache entries
+// are ignored rather than misread.
+#define GL_INFO_CACHE_VERSION (1)
+
+static GLint getInt(GLenum name) {
+  GLint temp = 0;
+  glGetIntegerv(name, &temp);
+  return temp;
+}
+
+static std::string getString(GLenum name) {
+  const GLubyte* value = glGetString(name);
+  return value == NULL ? std::string() : std::string((const char*) value);
+}
+
+static std::string getEGLString(EGLDisplay display, EGLint name) {
+  const char* value = eglQueryString(display, name);
+  return value == NULL ? std::string() : std::string(value);
+}
+
+static json splitWords(const std::string& words) {
+  json list = json::array();
+  std::istringstream ss(words);
+  std::string word;
+  while(ss >> word) {
+    list.push_back(word);
+  }
+  return list;
+}
+
+static EGLint getConfigAttrib(EGLDisplay display, EGLConfig config, EGLint attribute) {
+  EGLint value = 0;
+  eglGetConfigAttrib(display, config, attribute, &value);
+  return value;
+}
+
+static json describeConfig(EGLDisplay display, EGLConfig config) {
+  return json {
+    {"EGL_CONFIG_ID", getConfigAttrib(display, config, EGL_CONFIG_ID)},
+    {"EGL_RED_SIZE", getConfigAttrib(display, config, EGL_RED_SIZE)},
+    {"EGL_GREEN_SIZE", getConfigAttrib(display, config, EGL_GREEN_SIZE)},
+    {"EGL_BLUE_SIZE", getConfigAttrib(display, config, EGL_BLUE_SIZE)},
+    {"EGL_ALPHA_SIZE", getConfigAttrib(display, config, EGL_ALPHA_SIZE)},
+    {"EGL_DEPTH_SIZE", getConfigAttrib(display, config, EGL_DEPTH_SIZE)},
+    {"EGL_STENCIL_SIZE", getConfigAttrib(display, config, EGL_STENCIL_SIZE)},
+    {"EGL_SAMPLES", getConfigAttrib(display, config, EGL_SAMPLES)},
+    {"EGL_SURFACE_TYPE", getConfigAttrib(display, config, EGL_SURFACE_TYPE)},
+    {"EGL_RENDERABLE_TYPE", getConfigAttrib(display, config, EGL_RENDERABLE_TYPE)},
+    {"EGL_CONFORMANT", getConfigAttrib(display, config, EGL_CONFORMANT)},
+    {"EGL_MAX_PBUFFER_WIDTH", getConfigAttrib(display, config, EGL_MAX_PBUFFER_WIDTH)},
+    {"EGL_MAX_PBUFFER_HEIGHT", getConfigAttrib(display, config, EGL_MAX_PBUFFER_HEIGHT)},
+    {"EGL_MAX_PBUFFER_PIXELS", getConfigAttrib(display, config, EGL_MAX_PBUFFER_PIXELS)}
+  };
+}
+
+static bool hasGLExtension(const char* name) {
+  GLint numExtensions = getInt(GL_NUM_EXTENSIONS);
+  for(GLint i = 0; i < numExtensions; ++i) {
+    if(std::string((const char*) glGetStringi(GL_EXTENSIONS, i)) == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+json collectLimits(EGLDisplay display, EGLConfig config) {
+  GLint viewportDims[2] = { 0, 0 };
+  glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewportDims);
+
+  json binaryFormats = json::array();
+  GLint numBinaryFormats = getInt(GL_NUM_PROGRAM_BINARY_FORMATS);
+  if(numBinaryFormats > 0) {
+    std::vector<GLint> formats(numBinaryFormats);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+    for(GLint i = 0; i < numBinaryFormats; ++i) {
+      binaryFormats.push_back(formats[i]);
+    }
+  }
+
+  bool parallelShaderCompile = hasGLExtension("GL_KHR_parallel_shader_compile");
+
+  json limits;
+  limits["GL_MAX_VIEWPORT_DIMS"] = { viewportDims[0], viewportDims[1] };
+  limits["GL_MAX_RENDERBUFFER_SIZE"] = getInt(GL_MAX_RENDERBUFFER_SIZE);
+  limits["GL_MAX_TEXTURE_SIZE"] = getInt(GL_MAX_TEXTURE_SIZE);
+  limits["EGL_MAX_PBUFFER_WIDTH"] = getConfigAttrib(display, config, EGL_MAX_PBUFFER_WIDTH);
+  limits["EGL_MAX_PBUFFER_HEIGHT"] = getConfigAttrib(display, config, EGL_MAX_PBUFFER_HEIGHT);
+  limits["EGL_MAX_PBUFFER_PIXELS"] = getConfigAttrib(display, config, EGL_MAX_PBUFFER_PIXELS);
+  limits["GL_PROGRAM_BINARY_FORMATS"] = binaryFormats;
+  limits["GL_KHR_parallel_shader_compile"] = parallelShaderCompile;
+  if(parallelShaderCompile) {
+    limits["GL_MAX_SHADER_COMPILER_THREADS_KHR"] = getInt(GL_MAX_SHADER_COMPILER_THREADS_KHR);
+  }
+  return limits;
+}
+
+std::string driverIdentity(EGLDisplay display) {
+  return getString(GL_VENDOR) + "|" + getString(GL_RENDERER) + "|" + getString(GL_VERSION) + "|" +
+      getEGLString(display, EGL_VENDOR) + "|" + getEGLString(display, EGL_VERSION);
+}
+
+json collectGLInfo(EGLDisplay display, EGLConfig config) {
+  json info;
+
+  // The original get_gl_info keys, still reported as strings.
+  info["GL_VERSION"] = getString(GL_VERSION);
+  info["GL_MAJOR_VERSION"] = std::to_string(getInt(GL_MAJOR_VERSION));
+  info["GL_MINOR_VERSION"] = std::to_string(getInt(GL_MINOR_VERSION));
+  info["GL_SHADING_LANGUAGE_VERSION"] = getString(GL_SHADING_LANGUAGE_VERSION);
+  info["GL_VENDOR"] = getString(GL_VENDOR);
+  info["GL_RENDERER"] = getString(GL_RENDERER);
+
+  json glslVersions = json::array();
+  GLint glslNumVersions = getInt(GL_NUM_SHADING_LANGUAGE_VERSIONS);
+  // Not an ES enum; clear the GL_INVALID_ENUM it raises there.
+  glGetError();
+  for(GLint i = 0; i < glslNumVersions; ++i) {
+    glslVersions.push_back(std::string((const char*) glGetStringi(GL_SHADING_LANGUAGE_VERSION, i)));
+  }
+  info["Supported_GLSL_versions"] = glslVersions;
+
+  json extensions = json::array();
+  GLint numExtensions = getInt(GL_NUM_EXTENSIONS);
+  for(GLint i = 0; i < numExtensions; ++i) {
+    extensions.push_back(std::string((const char*) glGetStringi(GL_EXTENSIONS, i)));
+  }
+  info["GL_EXTENSIONS"] = extensions;
+
+  info["EGL_VENDOR"] = getEGLString(display, EGL_VENDOR);
+  info["EGL_VERSION"] = getEGLString(display, EGL_VERSION);
+  info["EGL_CLIENT_APIS"] = getEGLString(display, EGL_CLIENT_APIS);
+  info["EGL_EXTENSIONS"] = splitWords(getEGLString(display, EGL_EXTENSIONS));
+
+  EGLint numConfigs = 0;
+  eglGetConfigs(display, NULL, 0, &numConfigs);
+  std::vector<EGLConfig> configs(numConfigs > 0 ? numConfigs : 0);
+  json configList = json::array();
+  if(numConfigs > 0 && eglGetConfigs(display, &configs[0], numConfigs, &numConfigs)) {
+    for(EGLint i = 0; i < numConfigs; ++i) {
+      configList.push_back(describeConfig(display, configs[i]));
+    }
+  }
+  info["EGL_configs"] = configList;
+
+  info["limits"] = collectLimits(display, config);
+
+  info["driver_identity"] = driverIdentity(display);
+
+  return info;
+}
+
+GLLimits limitsFromGLInfo(const json& info) {
+  const json& limits = info["limits"];
+  GLLimits result;
+  result.maxViewportWidth = limits["GL_MAX_VIEWPORT_DIMS"][0];
+  result.maxViewportHeight = limits["GL_MAX_VIEWPORT_DIMS"][1];
+  result.maxRenderbufferSize = limits["GL_MAX_RENDERBUFFER_SIZE"];
+  result.maxPbufferWidth = limits["EGL_MAX_PBUFFER_WIDTH"];
+  result.maxPbufferHeight = limits["EGL_MAX_PBUFFER_HEIGHT"];
+  result.maxPbufferPixels = limits["EGL_MAX_PBUFFER_PIXELS"];
+  result.parallelShaderCompile = limits["GL_KHR_parallel_shader_compile"];
+  return result;
+}
+
+bool checkRenderTargetSize(const GLLimits& limits, const char* what, long long width, long long height) {
+  if(width <= 0 || height <= 0) {
+    std::cerr << what << " " << width << "x" << height << " is empty." << std::endl;
+    return false;
+  }
+  if(width > limits.maxViewportWidth || height > limits.maxViewportHeight) {
+    std::cerr << what << " " << width << "x" << height << " exceeds GL_MAX_VIEWPORT_DIMS "
+              << limits.maxViewportWidth << "x" << limits.maxViewportHeight << "." << std::endl;
+    return false;
+  }
+  if(width > limits.maxRenderbufferSize || height > limits.maxRenderbufferSize) {
+    std::cerr << what << " " << width << "x" << height << " exceeds GL_MAX_RENDERBUFFER_SIZE "
+              << limits.maxRenderbufferSize << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool checkResolution(const GLLimits& limits, int width, int height) {
+  if(width <= 0 || height <= 0) {
+    std::cerr << "Invalid resolution " << width << "x" << height << "." << std::endl;
+    return false;
+  }
+  if(!checkRenderTargetSize(limits, "Resolution", width, height)) {
+    return false;
+  }
+  // A zero limit means the config does not report one.
+  if((limits.maxPbufferWidth > 0 && width > limits.maxPbufferWidth) ||
+     (limits.maxPbufferHeight > 0 && height > limits.maxPbufferHeight) ||
+     (limits.maxPbufferPixels > 0 && (long long) width * height > limits.maxPbufferPixels)) {
+    std::cerr << "Resolution " << width << "x" << height << " exceeds the maximum pbuffer size "
+              << limits.maxPbufferWidth << "x" << limits.maxPbufferHeight << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static std::string cachePath(const std::string& cacheDir, const std::string& identity) {
+  Hasher hasher;
+  hasher.update(identity);
+  return cacheDir + "/gl_info-" + hasher.hexDigest() + ".json";
+}
+
+bool loadGLInfoCache(const std::string& cacheDir, const std::string& identity, json& info) {
+  std::ifstream ifs(cachePath(cacheDir, identity).c_str());
+  if(!ifs) {
+    return false;
+  }
+  try {
+    json cached = json::parse(ifs);
+    // Guard against hash collisions and older layouts.
+    if(cached.value("cache_version", 0) != GL_INFO_CACHE_VERSION ||
+       cached.value("driver_identity", std::string()) != identity) {
+      return false;
+    }
+    info = cached;
+  } catch(const std::exception& e) {
+    std::cerr << "Warning: ignoring unreadable GL info cache entry: " << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool storeGLInfoCache(const std::string& cacheDir, const std::string& identity, const json& info) {
+  json cached = info;
+  cached["cache_version"] = GL_INFO_CACHE_VERSION;
+  cached["driver_identity"] = identity;
+  if(!makeDirectory(cacheDir) ||
+     !writeFileAtomic(cachePath(cacheDir, identity), cached.dump(4) + "\n")) {
+    std::cerr << "Warning: could not write GL info cache in " << cacheDir << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#ifndef CPP_GL_INFO_H
+#define CPP_GL_INFO_H
+
+#include "gl_dispatch.h"
+
+#include <string>
+
+#include "json.hpp"
+
+// The limits get_image checks before rendering.
+struct GLLimits {
+  int maxViewportWidth;
+  int maxViewportHeight;
+  int maxRenderbufferSize;
+  int maxPbufferWidth;
+  int maxPbufferHeight;
+  int maxPbufferPixels;
+  bool parallelShaderCompile;
+};
+
+// Identifies the driver behind the current context: GL and EGL vendor,
+// renderer and version strings. Cheap enough to query on every start.
+std::string driverIdentity(EGLDisplay display);
+
+// Everything get_gl_info reports: versions, GL and EGL extensions, all EGL
+// configs and the limits relevant to scheduling renders. Requires a current
+// context; config is the one it was created with.
+nlohmann::json collectGLInfo(EGLDisplay display, EGLConfig config);
+
+// Just the "limits" section of collectGLInfo.
+nlohmann::json collectLimits(EGLDisplay display, EGLConfig config);
+
+GLLimits limitsFromGLInfo(const nlohmann::json& info);
+
+// Checks that a width x height render fits within limits, explaining why not
+// on stderr.
+bool checkResolution(const GLLimits& limits, int width, int height);
+
+// The part of checkResolution that applies to an offscreen renderbuffer
+// target, which the pbuffer limits do not constrain. what names the size in
+// the explanation.
+bool checkRenderTargetSize(const GLLimits& limits, const char* what, long long width, long long height);
+
+// A cached collectGLInfo result lives in cacheDir, keyed by driver identity.
+bool loadGLInfoCache(const std::string& cacheDir, const std::string& identity, nlohmann::json& info);
+
+bool storeGLInfoCache(const std::string& cacheDir, const std::string& identity, const nlohmann::json& info);
+
+#endif //CPP_GL_INFO_H
@@ -0,0 +1,38 @@
+#include "hash.h"
+
+static const std::uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+static const std::uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+Hasher::Hasher() : state(FNV_OFFSET_BASIS) {}
+
+Hasher& Hasher::update(const void* data, size_t length) {
+  const unsigned char* bytes = (const unsigned char*) data;
+  std::uint64_t h = state;
+  for(size_t i = 0; i < length; i++) {
+    h ^= bytes[i];
+    h *= FNV_PRIME;
+  }
+  state = h;
+  return *this;
+}
+
+Hasher& Hasher::update(const std::string& data) {
+  // Length-prefixed, so that ("ab", "c") and ("a", "bc") hash differently.
+  std::uint64_t length = data.size();
+  update(&length, sizeof(length));
+  return update(data.data(), data.size());
+}
+
+std::string Hasher::hexDigest() const {
+  return hashToHex(state);
+}
+
+std::string hashToHex(std::uint64_t hash) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex(16, '0');
+  for(int i = 15; i >= 0; i--) {
+    hex[i] = digits[hash & 0xf];
+    hash >>= 4;
+  }
+  return hex;
+}
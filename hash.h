@@ -0,0 +1,27 @@
+#ifndef CPP_HASH_H
+#define CPP_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a. Used to key on-disk caches and to summarise rendered images;
+// not cryptographic.
+class Hasher {
+  public:
+    Hasher();
+
+    Hasher& update(const void* data, size_t length);
+    Hasher& update(const std::string& data);
+
+    std::uint64_t digest() const { return state; }
+    // 16 lowercase hex digits.
+    std::string hexDigest() const;
+
+  private:
+    std::uint64_t state;
+};
+
+std::string hashToHex(std::uint64_t hash);
+
+#endif //CPP_HASH_H
@@ -0,0 +1,96 @@
+#include "job.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+std::string defaultOutputFor(const std::string& fragment_shader) {
+  size_t dot = fragment_shader.find_last_of('.');
+  size_t slash = fragment_shader.find_last_of("/\\");
+  if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return fragment_shader + ".png";
+  }
+  return fragment_shader.substr(0, dot) + ".png";
+}
+
+bool readJobManifest(const std::string& fileName, std::vector<Job>& jobs) {
+  std::ifstream ifs(fileName.c_str());
+  if(!ifs) {
+    std::cerr << "File " << fileName << " not found" << std::endl;
+    return false;
+  }
+  std::string line;
+  size_t lineNumber = 0;
+  while(std::getline(ifs, line)) {
+    ++lineNumber;
+    std::istringstream fields(line);
+    Job job;
+    if(!(fields >> job.fragment_shader) || job.fragment_shader[0] == '#') {
+      continue;
+    }
+    if(!(fields >> job.output)) {
+      job.output = defaultOutputFor(job.fragment_shader);
+    }
+    std::string extra;
+    if(fields >> extra) {
+      std::cerr << fileName << ":" << lineNumber << ": ignoring extra field " << extra << std::endl;
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+static bool hasSuffix(const std::string& name, const std::string& suffix) {
+  return name.length() >= suffix.length() &&
+      name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+bool readJobDirectory(const std::string& dir, std::vector<Job>& jobs) {
+  std::vector<std::string> names;
+#ifdef _WIN32
+  WIN32_FIND_DATAA entry;
+  HANDLE find = FindFirstFileA((dir + "\\*.frag").c_str(), &entry);
+  if(find != INVALID_HANDLE_VALUE) {
+    do {
+      names.push_back(entry.cFileName);
+    } while(FindNextFileA(find, &entry));
+    FindClose(find);
+  }
+#else
+  DIR* handle = opendir(dir.c_str());
+  if(handle == NULL) {
+    std::cerr << "Directory " << dir << " not found" << std::endl;
+    return false;
+  }
+  while(struct dirent* entry = readdir(handle)) {
+    if(hasSuffix(entry->d_name, ".frag")) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(handle);
+#endif
+  std::sort(names.begin(), names.end());
+  for(size_t i = 0; i < names.size(); i++) {
+    Job job;
+    job.fragment_shader = dir + "/" + names[i];
+    job.output = defaultOutputFor(job.fragment_shader);
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+bool readJobs(const std::string& path, std::vector<Job>& jobs) {
+  struct stat info;
+  if(stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR)) {
+    return readJobDirectory(path, jobs);
+  }
+  return readJobManifest(path, jobs);
+}
@@ -0,0 +1,28 @@
+#ifndef CPP_JOB_H
+#define CPP_JOB_H
+
+#include <string>
+#include <vector>
+
+// One shader to render and where to put the result.
+struct Job {
+  std::string fragment_shader;
+  std::string output;
+};
+
+// The output used for a fragment shader when the manifest does not name one:
+// the shader's path with its extension replaced by ".png".
+std::string defaultOutputFor(const std::string& fragment_shader);
+
+// Reads a batch manifest: one job per line, "<fragment shader> [<output>]".
+// Blank lines and lines starting with '#' are ignored.
+bool readJobManifest(const std::string& fileName, std::vector<Job>& jobs);
+
+// One job per .frag file directly inside dir, in name order, each with the
+// default output.
+bool readJobDirectory(const std::string& dir, std::vector<Job>& jobs);
+
+// readJobDirectory if path is a directory, otherwise readJobManifest.
+bool readJobs(const std::string& path, std::vector<Job>& jobs);
+
+#endif //CPP_JOB_H
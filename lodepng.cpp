@@ -33,6 +33,17 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef LODEPNG_COMPILE_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LODEPNG_NEON
+#include <arm_neon.h>
+#endif
+#endif /*LODEPNG_COMPILE_SIMD*/
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
@@ -60,19 +71,42 @@ lodepng source code. Don't forget to remove "static" if you copypaste them
 from here.*/
 
 #ifdef LODEPNG_COMPILE_ALLOCATORS
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define LODEPNG_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define LODEPNG_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define LODEPNG_THREAD_LOCAL __declspec(thread)
+#else
+#define LODEPNG_THREAD_LOCAL __thread
+#endif
+
+/*the allocator installed with lodepng_set_allocator on this thread, or NULL for malloc, realloc and free*/
+static LODEPNG_THREAD_LOCAL const LodePNGAllocator* lodepng_allocator = 0;
+
+const LodePNGAllocator* lodepng_set_allocator(const LodePNGAllocator* allocator)
+{
+  const LodePNGAllocator* previous = lodepng_allocator;
+  lodepng_allocator = allocator;
+  return previous;
+}
+
 static void* lodepng_malloc(size_t size)
 {
+  if(lodepng_allocator) return lodepng_allocator->malloc(size, lodepng_allocator->context);
   return malloc(size);
 }
 
 static void* lodepng_realloc(void* ptr, size_t new_size)
 {
+  if(lodepng_allocator) return lodepng_allocator->realloc(ptr, new_size, lodepng_allocator->context);
   return realloc(ptr, new_size);
 }
 
 static void lodepng_free(void* ptr)
 {
-  free(ptr);
+  if(lodepng_allocator) lodepng_allocator->free(ptr, lodepng_allocator->context);
+  else free(ptr);
 }
 #else /*LODEPNG_COMPILE_ALLOCATORS*/
 void* lodepng_malloc(size_t size);
@@ -451,15 +485,37 @@ static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char*
   return result;
 }
 
+/*nbits <= 17, and the caller has checked they are all inside the stream. Only the bytes they span are read.*/
 static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  size_t start = *bitpointer >> 3, end = (*bitpointer + nbits + 7) >> 3, i;
+  unsigned word = 0;
+  for(i = start; i != end; ++i) word |= (unsigned)bitstream[i] << (8 * (i - start));
+  word >>= *bitpointer & 7;
+  *bitpointer += nbits;
+  return word & ((1u << nbits) - 1u);
+}
+
+/*
+The next 25 or more bits of the stream, without advancing. Bytes past the end of the stream read as zero, so
+the caller must still check how many bits it actually uses.
+*/
+static unsigned peekBitsFromStream(size_t bitpointer, const unsigned char* bitstream, size_t bytelength)
+{
+  size_t start = bitpointer >> 3;
+  unsigned word;
+  if(start + 4 <= bytelength)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    word = (unsigned)bitstream[start] | ((unsigned)bitstream[start + 1] << 8)
+         | ((unsigned)bitstream[start + 2] << 16) | ((unsigned)bitstream[start + 3] << 24);
   }
-  return result;
+  else
+  {
+    size_t i;
+    word = 0;
+    for(i = start; i < bytelength; ++i) word |= (unsigned)bitstream[i] << (8 * (i - start));
+  }
+  return word >> (bitpointer & 7);
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -513,6 +569,9 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*decoder lookup table built from tree2d, see HuffmanTree_makeTable*/
+  unsigned char* table_len;
+  unsigned short* table_value;
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -533,6 +592,8 @@ static void HuffmanTree_init(HuffmanTree* tree)
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -540,6 +601,8 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -940,6 +1003,103 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
+/*
+The decoder looks symbols up in a table instead of walking tree2d a bit at a time. The first FIRSTBITS bits
+of the stream index the first-level table. An entry there holds the symbol and its code length, or, for
+codes longer than FIRSTBITS, the total length of the longest code below it (as table_len > FIRSTBITS) and
+where its subtable starts; the subtable is indexed by the next table_len - FIRSTBITS bits.
+*/
+#define FIRSTBITS 9u
+
+/*depth of the deepest leaf below internal node treepos of tree2d, counting the step into the node's children*/
+static unsigned HuffmanTree_subtreeDepth(const HuffmanTree* tree, unsigned treepos)
+{
+  unsigned depth = 1, bit;
+  for(bit = 0; bit != 2; ++bit)
+  {
+    unsigned ct = tree->tree2d[2 * treepos + bit];
+    if(ct >= tree->numcodes)
+    {
+      unsigned below = 1 + HuffmanTree_subtreeDepth(tree, ct - tree->numcodes);
+      if(below > depth) depth = below;
+    }
+  }
+  return depth;
+}
+
+/*
+Fills the entries for everything below node treepos, reached by the depth bits in prefix (first bit in the
+least significant position). Entries are laid out in table space of 2^bits entries starting at offset, where
+bits is FIRSTBITS for the first-level table. Subtables are appended from *next.
+*/
+static void HuffmanTree_fillTable(HuffmanTree* tree, unsigned treepos, unsigned depth, unsigned prefix,
+                                  size_t offset, unsigned bits, unsigned base, size_t* next)
+{
+  unsigned bit;
+  for(bit = 0; bit != 2; ++bit)
+  {
+    unsigned ct = tree->tree2d[2 * treepos + bit];
+    unsigned childprefix = prefix | (bit << (depth - base));
+    unsigned childdepth = depth + 1;
+    if(ct < tree->numcodes)
+    {
+      /*a leaf (or an unused slot, which tree2d holds as symbol 0 just like a leaf): replicate it over every
+      entry whose low bits are its path*/
+      unsigned used = childdepth - base, j;
+      for(j = 0; j != (1u << (bits - used)); ++j)
+      {
+        size_t index = offset + (childprefix | (j << used));
+        tree->table_len[index] = (unsigned char)childdepth;
+        tree->table_value[index] = (unsigned short)ct;
+      }
+    }
+    else if(childdepth == FIRSTBITS && base == 0)
+    {
+      /*the code continues past the first-level table: start a subtable sized for the deepest code below*/
+      unsigned subbits = HuffmanTree_subtreeDepth(tree, ct - tree->numcodes);
+      size_t start = *next;
+      *next += (size_t)1u << subbits;
+      tree->table_len[offset + childprefix] = (unsigned char)(FIRSTBITS + subbits);
+      tree->table_value[offset + childprefix] = (unsigned short)start;
+      HuffmanTree_fillTable(tree, ct - tree->numcodes, FIRSTBITS, 0, start, subbits, FIRSTBITS, next);
+    }
+    else
+    {
+      HuffmanTree_fillTable(tree, ct - tree->numcodes, childdepth, childprefix, offset, bits, base, next);
+    }
+  }
+}
+
+/*number of entries the subtables below node treepos at the given depth need*/
+static size_t HuffmanTree_subtableSize(const HuffmanTree* tree, unsigned treepos, unsigned depth)
+{
+  size_t size = 0;
+  unsigned bit;
+  for(bit = 0; bit != 2; ++bit)
+  {
+    unsigned ct = tree->tree2d[2 * treepos + bit];
+    if(ct < tree->numcodes) continue;
+    if(depth + 1 == FIRSTBITS) size += (size_t)1u << HuffmanTree_subtreeDepth(tree, ct - tree->numcodes);
+    else size += HuffmanTree_subtableSize(tree, ct - tree->numcodes, depth + 1);
+  }
+  return size;
+}
+
+/*
+Builds table_len and table_value from tree2d. Because the table is read off the same tree, it decodes every bit
+sequence exactly as walking tree2d would, including the unused slots of an incomplete code. return value is error.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  size_t size = ((size_t)1u << FIRSTBITS) + HuffmanTree_subtableSize(tree, 0, 0);
+  size_t next = (size_t)1u << FIRSTBITS;
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(unsigned char));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(unsigned short));
+  if(!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+  HuffmanTree_fillTable(tree, 0, 0, 0, 0, FIRSTBITS, 0, &next);
+  return 0;
+}
+
 /*
 returns the code, or (unsigned)(-1) if error happened
 inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
@@ -947,21 +1107,24 @@ inbitlength is the length of the complete buffer, in bits (so its byte length ti
 static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
                                     const HuffmanTree* codetree, size_t inbitlength)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  unsigned bits = peekBitsFromStream(*bp, in, inbitlength >> 3);
+  unsigned index = bits & ((1u << FIRSTBITS) - 1u);
+  unsigned len = codetree->table_len[index];
+  unsigned value = codetree->table_value[index];
+  if(len > FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    index = value + ((bits >> FIRSTBITS) & ((1u << (len - FIRSTBITS)) - 1u));
+    len = codetree->table_len[index];
+    value = codetree->table_value[index];
+  }
+  if(*bp + len > inbitlength)
+  {
+    /*error: end of input memory reached without endcode. The bitwise walk would have stopped at the end*/
+    *bp = inbitlength;
+    return (unsigned)(-1);
   }
+  *bp += len;
+  return value;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -972,11 +1135,13 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* ////////////////////////////////////////////////////////////////////////// */
 
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  unsigned error = generateFixedLitLenTree(tree_ll);
+  if(!error) error = generateFixedDistanceTree(tree_d);
+  if(!error) error = HuffmanTree_makeTable(tree_ll);
+  if(!error) error = HuffmanTree_makeTable(tree_d);
+  return error;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
@@ -1022,6 +1187,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     }
 
     error = HuffmanTree_makeFromLengths(&tree_cl, bitlen_cl, NUM_CODE_LENGTH_CODES, 7);
+    if(!error) error = HuffmanTree_makeTable(&tree_cl);
     if(error) break;
 
     /*now we can use this tree to read the lengths for the tree that this function will return*/
@@ -1115,6 +1281,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     error = HuffmanTree_makeFromLengths(tree_ll, bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 15);
     if(error) break;
     error = HuffmanTree_makeFromLengths(tree_d, bitlen_d, NUM_DISTANCE_SYMBOLS, 15);
+    if(!error) error = HuffmanTree_makeTable(tree_ll);
+    if(!error) error = HuffmanTree_makeTable(tree_d);
 
     break; /*end of error-while*/
   }
@@ -1139,7 +1307,7 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
+  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
@@ -1376,22 +1544,60 @@ typedef struct Hash
   int* headz; /*similar to head, but for chainz*/
   unsigned short* chainz; /*those with same amount of zeros*/
   unsigned short* zeros; /*length of zeros streak, used as a second hash chain*/
+
+  /*for the match finder of compression levels 1-9 (encodeLZ77Fast), null otherwise*/
+  int* fasthead; /*hash value to most recent absolute position, or -1*/
+  int* fastprev; /*absolute position & FAST_WINDOW_MASK to the previous position with the same hash*/
 } Hash;
 
-static unsigned hash_init(Hash* hash, unsigned windowsize)
+/*the match finder of compression levels 1-9 always uses the largest window deflate allows*/
+#define FAST_HASH_BITS 16
+#define FAST_WINDOW_SIZE 32768
+#define FAST_WINDOW_MASK 32767
+
+/*allocates the tables of the match finder of compression levels 1-9 (fast) and/or those of level 0 (slow), leaving the others null*/
+static unsigned hash_alloc(Hash* hash, unsigned windowsize, unsigned fast, unsigned slow)
 {
-  unsigned i;
-  hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
-  hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
-  hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+  hash->head = 0;
+  hash->val = 0;
+  hash->chain = 0;
+  hash->zeros = 0;
+  hash->headz = 0;
+  hash->chainz = 0;
+  hash->fasthead = 0;
+  hash->fastprev = 0;
+  if(fast)
+  {
+    hash->fasthead = (int*)lodepng_malloc(sizeof(int) * (1u << FAST_HASH_BITS));
+    hash->fastprev = (int*)lodepng_malloc(sizeof(int) * FAST_WINDOW_SIZE);
+    if(!hash->fasthead || !hash->fastprev) return 83; /*alloc fail*/
+  }
+  if(slow)
+  {
+    hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
+    hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
+    hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
 
-  hash->zeros = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
-  hash->headz = (int*)lodepng_malloc(sizeof(int) * (MAX_SUPPORTED_DEFLATE_LENGTH + 1));
-  hash->chainz = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+    hash->zeros = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
+    hash->headz = (int*)lodepng_malloc(sizeof(int) * (MAX_SUPPORTED_DEFLATE_LENGTH + 1));
+    hash->chainz = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
 
-  if(!hash->head || !hash->chain || !hash->val  || !hash->headz|| !hash->chainz || !hash->zeros)
+    if(!hash->head || !hash->chain || !hash->val  || !hash->headz|| !hash->chainz || !hash->zeros)
+    {
+      return 83; /*alloc fail*/
+    }
+  }
+  return 0;
+}
+
+/*makes the tables level uses, allocated for at least windowsize, as good as new*/
+static void hash_reset(Hash* hash, unsigned windowsize, unsigned level)
+{
+  unsigned i;
+  if(level)
   {
-    return 83; /*alloc fail*/
+    for(i = 0; i != (1u << FAST_HASH_BITS); ++i) hash->fasthead[i] = -1;
+    return;
   }
 
   /*initialize hash table*/
@@ -1401,8 +1607,13 @@ static unsigned hash_init(Hash* hash, unsigned windowsize)
 
   for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i) hash->headz[i] = -1;
   for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
+}
 
-  return 0;
+static unsigned hash_init(Hash* hash, unsigned windowsize, unsigned level)
+{
+  unsigned error = hash_alloc(hash, windowsize, level != 0, level == 0);
+  if(!error) hash_reset(hash, windowsize, level);
+  return error;
 }
 
 static void hash_cleanup(Hash* hash)
@@ -1414,9 +1625,73 @@ static void hash_cleanup(Hash* hash)
   lodepng_free(hash->zeros);
   lodepng_free(hash->headz);
   lodepng_free(hash->chainz);
+
+  lodepng_free(hash->fasthead);
+  lodepng_free(hash->fastprev);
 }
 
+/*returns the hash tables kept in buffers, (re)allocated if level needs tables they lack or a larger windowsize*/
+static Hash* hash_reuse(LodePNGEncoderBuffers* buffers, unsigned windowsize, unsigned level, unsigned* error)
+{
+  Hash* hash = (Hash*)buffers->hash;
+  unsigned fast = level != 0;
+  unsigned slow = level == 0;
+  if(hash && (fast ? !hash->fasthead : !hash->head || buffers->hash_windowsize < windowsize))
+  {
+    /*keep the tables of every level asked for so far, the level 0 ones for the largest window, so that alternating
+    settings do not reallocate every time*/
+    if(hash->fasthead) fast = 1;
+    if(hash->head)
+    {
+      slow = 1;
+      if(windowsize < buffers->hash_windowsize) windowsize = buffers->hash_windowsize;
+    }
+    hash_cleanup(hash);
+    lodepng_free(hash);
+    hash = 0;
+    buffers->hash = 0;
+  }
+  if(!hash)
+  {
+    hash = (Hash*)lodepng_malloc(sizeof(Hash));
+    if(!hash)
+    {
+      *error = 83; /*alloc fail*/
+      return 0;
+    }
+    *error = hash_alloc(hash, windowsize, fast, slow);
+    if(*error)
+    {
+      hash_cleanup(hash);
+      lodepng_free(hash);
+      return 0;
+    }
+    buffers->hash = hash;
+    buffers->hash_windowsize = slow ? windowsize : 0;
+  }
+  return hash;
+}
+
+/*the LZ77 output of a deflate block starts out empty, with the capacity kept in buffers if there are any*/
+static void lz77_init(uivector* lz77, const LodePNGCompressSettings* settings)
+{
+  uivector_init(lz77);
+  if(settings->buffers)
+  {
+    lz77->data = settings->buffers->lz77;
+    lz77->allocsize = settings->buffers->lz77_size;
+  }
+}
 
+static void lz77_cleanup(uivector* lz77, const LodePNGCompressSettings* settings)
+{
+  if(settings->buffers)
+  {
+    settings->buffers->lz77 = lz77->data;
+    settings->buffers->lz77_size = lz77->allocsize;
+  }
+  else uivector_cleanup(lz77);
+}
 
 static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
 {
@@ -1650,6 +1925,161 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
+/*
+The match finder for compression levels 1-9. Compared to encodeLZ77 it hashes 3 bytes multiplicatively
+into a wider table, walks hash chains only to a depth fixed per level, extends matches 8 bytes at a time,
+and takes a run of any repeated byte as a distance 1 match without walking a chain at all (encodeLZ77
+only special-cases zeros). The output has the same form as encodeLZ77's.
+*/
+
+typedef struct FastMatchLevel
+{
+  unsigned chain; /*hash chain entries to try per position*/
+  unsigned nice; /*stop searching at this length*/
+  unsigned lazy; /*also try the next position before taking a match*/
+} FastMatchLevel;
+
+static const FastMatchLevel FAST_MATCH_LEVELS[10] =
+{
+  {0, 0, 0}, /*level 0 uses encodeLZ77*/
+  {4, 16, 0}, {8, 32, 0}, {16, 64, 0},
+  {16, 64, 1}, {32, 128, 1}, {64, 128, 1},
+  {256, 258, 1}, {1024, 258, 1}, {4096, 258, 1}
+};
+
+static unsigned fastHash(const unsigned char* data)
+{
+  unsigned v = (unsigned)data[0] | ((unsigned)data[1] << 8u) | ((unsigned)data[2] << 16u);
+  return (v * 2654435761u) >> (32u - FAST_HASH_BITS);
+}
+
+/*length of the common prefix of a and b, at most max*/
+static unsigned matchLength(const unsigned char* a, const unsigned char* b, unsigned max)
+{
+  unsigned length = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  while(length + 8 <= max)
+  {
+    unsigned long long x, y;
+    memcpy(&x, a + length, 8);
+    memcpy(&y, b + length, 8);
+    /*the lowest differing bit is in the first differing byte*/
+    if(x != y) return length + ((unsigned)__builtin_ctzll(x ^ y) >> 3u);
+    length += 8;
+  }
+#endif /*little endian GCC-compatible*/
+  while(length != max && a[length] == b[length]) ++length;
+  return length;
+}
+
+/*pos + 2 < insize*/
+static void fastInsert(Hash* hash, const unsigned char* in, size_t pos)
+{
+  unsigned hashval = fastHash(&in[pos]);
+  hash->fastprev[pos & FAST_WINDOW_MASK] = hash->fasthead[hashval];
+  hash->fasthead[hashval] = (int)pos;
+}
+
+/*longest match for pos among earlier positions, not including pos itself*/
+static unsigned fastFindMatch(const Hash* hash, const unsigned char* in, size_t pos, size_t insize,
+                              const FastMatchLevel* level, unsigned* distance)
+{
+  unsigned max = insize - pos < MAX_SUPPORTED_DEFLATE_LENGTH ? (unsigned)(insize - pos)
+                                                             : (unsigned)MAX_SUPPORTED_DEFLATE_LENGTH;
+  unsigned best = 0;
+  unsigned chain = level->chain;
+  int candidate;
+
+  if(max < 3) return 0;
+
+  /*a run of the previous byte: distance 1, whatever the byte is*/
+  if(pos > 0)
+  {
+    best = matchLength(&in[pos], &in[pos - 1], max);
+    if(best >= 3)
+    {
+      *distance = 1;
+      if(best >= level->nice) return best;
+    }
+    else best = 0;
+  }
+
+  candidate = hash->fasthead[fastHash(&in[pos])];
+  while(candidate >= 0 && chain-- != 0)
+  {
+    size_t offset = pos - (size_t)candidate;
+    int next;
+    /*older entries of fastprev have been overwritten*/
+    if(offset >= FAST_WINDOW_SIZE) break;
+    /*nothing can beat a match that runs to the end of the input*/
+    if(best == max) break;
+    /*cheap rejection: a longer match must at least agree at the byte after the best one*/
+    if(in[candidate + best] == in[pos + best])
+    {
+      unsigned length = matchLength(&in[candidate], &in[pos], max);
+      if(length > best)
+      {
+        best = length;
+        *distance = (unsigned)offset;
+        if(best >= level->nice) break;
+      }
+    }
+    next = hash->fastprev[candidate & FAST_WINDOW_MASK];
+    if(next >= candidate) break;
+    candidate = next;
+  }
+  return best >= 3 ? best : 0;
+}
+
+static unsigned encodeLZ77Fast(uivector* out, Hash* hash, const unsigned char* in, size_t inpos, size_t insize,
+                               const LodePNGCompressSettings* settings)
+{
+  const FastMatchLevel* level = &FAST_MATCH_LEVELS[settings->level > 9 ? 9 : settings->level];
+  size_t pos = inpos;
+
+  while(pos < insize)
+  {
+    unsigned distance = 0, length, i;
+
+    length = fastFindMatch(hash, in, pos, insize, level, &distance);
+    if(pos + 2 < insize) fastInsert(hash, in, pos);
+
+    if(level->lazy && length != 0 && length < level->nice && pos + 1 < insize)
+    {
+      unsigned nextdistance = 0;
+      unsigned nextlength = fastFindMatch(hash, in, pos + 1, insize, level, &nextdistance);
+      if(nextlength > length)
+      {
+        /*the match one byte further on is better: emit this byte as a literal and take that one*/
+        if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+        ++pos;
+        if(pos + 2 < insize) fastInsert(hash, in, pos);
+        length = nextlength;
+        distance = nextdistance;
+      }
+    }
+
+    /*a length of only 3 may not be worth the extra bits of a far distance*/
+    if(length < 3 || length < settings->minmatch || (length == 3 && distance > 4096))
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+      ++pos;
+      continue;
+    }
+
+    addLengthDistance(out, length, distance);
+    for(i = 1; i != length; ++i)
+    {
+      if(pos + i + 2 < insize) fastInsert(hash, in, pos + i);
+    }
+    pos += length;
+  }
+
+  return 0;
+}
+
+/* /////////////////////////////////////////////////////////////////////////// */
+
 static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
@@ -1765,7 +2195,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   size_t numcodes_ll, numcodes_d, i;
   unsigned HLIT, HDIST, HCLEN;
 
-  uivector_init(&lz77_encoded);
+  lz77_init(&lz77_encoded, settings);
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
   HuffmanTree_init(&tree_cl);
@@ -1782,8 +2212,9 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   {
     if(settings->use_lz77)
     {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      if(settings->level) error = encodeLZ77Fast(&lz77_encoded, hash, data, datapos, dataend, settings);
+      else error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+                              settings->minmatch, settings->nicematch, settings->lazymatching);
       if(error) break;
     }
     else
@@ -1952,7 +2383,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   }
 
   /*cleanup*/
-  uivector_cleanup(&lz77_encoded);
+  lz77_cleanup(&lz77_encoded, settings);
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
   HuffmanTree_cleanup(&tree_cl);
@@ -1991,11 +2422,12 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   if(settings->use_lz77) /*LZ77 encoded*/
   {
     uivector lz77_encoded;
-    uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
+    lz77_init(&lz77_encoded, settings);
+    if(settings->level) error = encodeLZ77Fast(&lz77_encoded, hash, data, datapos, dataend, settings);
+    else error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+                            settings->minmatch, settings->nicematch, settings->lazymatching);
     if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
-    uivector_cleanup(&lz77_encoded);
+    lz77_cleanup(&lz77_encoded, settings);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
@@ -2020,7 +2452,8 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   size_t bp = 0; /*the bit pointer*/
-  Hash hash;
+  Hash ownhash;
+  Hash* hash;
 
   if(settings->btype > 2) return 61;
   else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
@@ -2036,8 +2469,22 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   numdeflateblocks = (insize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
+  if(settings->buffers)
+  {
+    hash = hash_reuse(settings->buffers, settings->windowsize, settings->level, &error);
+    if(error) return error;
+    hash_reset(hash, settings->windowsize, settings->level);
+  }
+  else
+  {
+    hash = &ownhash;
+    error = hash_init(hash, settings->windowsize, settings->level);
+    if(error)
+    {
+      hash_cleanup(hash);
+      return error;
+    }
+  }
 
   for(i = 0; i != numdeflateblocks && !error; ++i)
   {
@@ -2046,11 +2493,11 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     size_t end = start + blocksize;
     if(end > insize) end = insize;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if(settings->btype == 1) error = deflateFixed(out, &bp, hash, in, start, end, settings, final);
+    else if(settings->btype == 2) error = deflateDynamic(out, &bp, hash, in, start, end, settings, final);
   }
 
-  hash_cleanup(&hash);
+  if(!settings->buffers) hash_cleanup(hash);
 
   return error;
 }
@@ -2068,31 +2515,86 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
-static unsigned deflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGCompressSettings* settings)
-{
-  if(settings->custom_deflate)
-  {
-    return settings->custom_deflate(out, outsize, in, insize, settings);
-  }
-  else
-  {
-    return lodepng_deflate(out, outsize, in, insize, settings);
-  }
-}
-
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#if defined(LODEPNG_SSE2) || defined(LODEPNG_NEON)
+/*
+Adds blocks * 16 bytes to the sums. Over one block of bytes b[0..15], s1 grows by the sum of the bytes and s2
+by 16 * s1 plus the sum of (16 - i) * b[i]. The vector lanes keep the byte sums, the weighted sums and the running
+total of earlier byte sums separately; they are folded into s1 and s2 at the end. blocks must be small enough that
+the scalar sums would not overflow either, i.e. at most 5552 / 16.
+*/
+static void adler32Blocks(unsigned* s1, unsigned* s2, const unsigned char* data, unsigned blocks)
+{
+  unsigned sum1, sumPrefix, sum2;
+  unsigned lanes[4];
+  unsigned i;
+#if defined(LODEPNG_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weightsLow = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+  const __m128i weightsHigh = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  __m128i vs1 = zero, vprefix = zero, vs2 = zero;
+  for(i = 0; i != blocks; ++i)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(data + i * 16));
+    vprefix = _mm_add_epi32(vprefix, vs1);
+    vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(bytes, zero));
+    vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow));
+    vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+  }
+  _mm_storeu_si128((__m128i*)lanes, vs1);
+  sum1 = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm_storeu_si128((__m128i*)lanes, vprefix);
+  sumPrefix = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm_storeu_si128((__m128i*)lanes, vs2);
+  sum2 = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else /*LODEPNG_NEON*/
+  static const unsigned char weights[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+  const uint8x8_t weightsLow = vld1_u8(weights);
+  const uint8x8_t weightsHigh = vld1_u8(weights + 8);
+  uint32x4_t vs1 = vdupq_n_u32(0), vprefix = vdupq_n_u32(0), vs2 = vdupq_n_u32(0);
+  for(i = 0; i != blocks; ++i)
+  {
+    uint8x16_t bytes = vld1q_u8(data + i * 16);
+    vprefix = vaddq_u32(vprefix, vs1);
+    vs1 = vpadalq_u16(vs1, vpaddlq_u8(bytes));
+    vs2 = vpadalq_u16(vs2, vmull_u8(vget_low_u8(bytes), weightsLow));
+    vs2 = vpadalq_u16(vs2, vmull_u8(vget_high_u8(bytes), weightsHigh));
+  }
+  vst1q_u32(lanes, vs1);
+  sum1 = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  vst1q_u32(lanes, vprefix);
+  sumPrefix = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  vst1q_u32(lanes, vs2);
+  sum2 = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif /*LODEPNG_SSE2 / LODEPNG_NEON*/
+  *s2 += 16 * (blocks * *s1 + sumPrefix) + sum2;
+  *s1 += sum1;
+}
+#endif /*LODEPNG_SSE2 || LODEPNG_NEON*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
    unsigned s1 = adler & 0xffff;
    unsigned s2 = (adler >> 16) & 0xffff;
 
+#if defined(LODEPNG_SSE2) || defined(LODEPNG_NEON)
+  while(len >= 16)
+  {
+    /*5552 is the largest multiple of 16 for which the sums cannot overflow*/
+    unsigned blocks = (len > 5552 ? 5552 : len) / 16;
+    adler32Blocks(&s1, &s2, data, blocks);
+    data += blocks * 16;
+    len -= blocks * 16;
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+#endif /*LODEPNG_SSE2 || LODEPNG_NEON*/
+
   while(len > 0)
   {
     /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
@@ -2185,16 +2687,11 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
-unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                               size_t insize, const LodePNGCompressSettings* settings)
+/*appends the zlib stream of in to out*/
+static unsigned lodepng_zlib_compressv(ucvector* out, const unsigned char* in, size_t insize,
+                                       const LodePNGCompressSettings* settings)
 {
-  /*initially, *out must be NULL and outsize 0, if you just give some random *out
-  that's pointing to a non allocated buffer, this'll crash*/
-  ucvector outv;
-  size_t i;
   unsigned error;
-  unsigned char* deflatedata = 0;
-  size_t deflatesize = 0;
 
   /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
   unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
@@ -2204,21 +2701,41 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned FCHECK = 31 - CMFFLG % 31;
   CMFFLG += FCHECK;
 
-  /*ucvector-controlled version of the output buffer, for dynamic array*/
-  ucvector_init_buffer(&outv, *out, *outsize);
-
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG >> 8));
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG & 255));
+  ucvector_push_back(out, (unsigned char)(CMFFLG >> 8));
+  ucvector_push_back(out, (unsigned char)(CMFFLG & 255));
 
-  error = deflate(&deflatedata, &deflatesize, in, insize, settings);
-
-  if(!error)
+  if(settings->custom_deflate)
   {
-    unsigned ADLER32 = adler32(in, (unsigned)insize);
-    for(i = 0; i != deflatesize; ++i) ucvector_push_back(&outv, deflatedata[i]);
+    unsigned char* deflatedata = 0;
+    size_t deflatesize = 0;
+    size_t pos = out->size;
+    error = settings->custom_deflate(&deflatedata, &deflatesize, in, insize, settings);
+    if(!error && !ucvector_resize(out, pos + deflatesize)) error = 83; /*alloc fail*/
+    if(!error && deflatesize) memcpy(out->data + pos, deflatedata, deflatesize);
     lodepng_free(deflatedata);
-    lodepng_add32bitInt(&outv, ADLER32);
   }
+  else
+  {
+    /*the built in deflate appends to out directly, which saves copying its output*/
+    error = lodepng_deflatev(out, in, insize, settings);
+  }
+
+  if(!error) lodepng_add32bitInt(out, adler32(in, (unsigned)insize));
+
+  return error;
+}
+
+unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                               size_t insize, const LodePNGCompressSettings* settings)
+{
+  /*initially, *out must be NULL and outsize 0, if you just give some random *out
+  that's pointing to a non allocated buffer, this'll crash*/
+  ucvector outv;
+  unsigned error;
+
+  /*ucvector-controlled version of the output buffer, for dynamic array*/
+  ucvector_init_buffer(&outv, *out, *outsize);
+  error = lodepng_zlib_compressv(&outv, in, insize, settings);
 
   *out = outv.data;
   *outsize = outv.size;
@@ -2279,13 +2796,39 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->level = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
+  settings->buffers = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0, 0};
+
+void lodepng_encoder_buffers_init(LodePNGEncoderBuffers* buffers)
+{
+  buffers->converted = buffers->filtered = buffers->attempts = buffers->png = 0;
+  buffers->converted_size = buffers->filtered_size = buffers->attempts_size = buffers->png_size = 0;
+  buffers->lz77 = 0;
+  buffers->lz77_size = 0;
+  buffers->hash = 0;
+  buffers->hash_windowsize = 0;
+}
+
+void lodepng_encoder_buffers_cleanup(LodePNGEncoderBuffers* buffers)
+{
+  lodepng_free(buffers->converted);
+  lodepng_free(buffers->filtered);
+  lodepng_free(buffers->attempts);
+  lodepng_free(buffers->png);
+  lodepng_free(buffers->lz77);
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(buffers->hash) hash_cleanup((Hash*)buffers->hash);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  lodepng_free(buffers->hash);
+  lodepng_encoder_buffers_init(buffers);
+}
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2319,50 +2862,302 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 
 #ifndef LODEPNG_NO_COMPILE_CRC
-/* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
-           0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
-   249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
-   498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
-   325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
-   997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
-   901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
-   651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
-   671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
-  1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
-  2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
-  1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
-  1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
-  1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
-  1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
-  1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
-  1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
-  3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
-  3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
-  4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
-  4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
-  3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
-  3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
-  3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
-  3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
-  2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
-  2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
-  2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
-  2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
-  2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
-  2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
-  3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
-  3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+/* CRC polynomial: 0xedb88320. Row 0 is the classic byte-wise table; row k advances a byte's CRC past k
+further zero bytes, so that eight bytes can be folded in at once (slice-by-8). */
+static unsigned lodepng_crc32_table[8][256] = {
+  {
+            0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
+    249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
+    498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
+    325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
+    997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
+    901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
+    651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
+    671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
+   1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
+   2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
+   1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
+   1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
+   1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
+   1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
+   1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
+   1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
+   3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
+   3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
+   4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
+   4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
+   3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+   3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
+   3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
+   3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
+   2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
+   2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
+   2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
+   2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
+   2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
+   2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
+   3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
+   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+  },
+  {
+            0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+   3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+   1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+   2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+   2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+   1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+   3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+    396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+   4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+    950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+   3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+   1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+   1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+   2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+    792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+   3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+    998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+   4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+   1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+   3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+   2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+   1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+   3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+    740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+   3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+     52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+   2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+   1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+   1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+   2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+    347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+   3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+  },
+  {
+            0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+    236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+    472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+    305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+    944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+    912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+    611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+    712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+   1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+   2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+   1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+   1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+   1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+   1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+   1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+   1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+   3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+   4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+   4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+   4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+   3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+   3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+   3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+   3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+   2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+   2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+   2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+   2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+   2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+   2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+   3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+   3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+            0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+   3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+   1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+   2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+   2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+   1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+   4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+    899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+   2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+   1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+   3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+    247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+    992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+   4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+   1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+   2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+   3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+    686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+   3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+   2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+   1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+   2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+    494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+   3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+   1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+   3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+    643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+   3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+   3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+    332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+   2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+   1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+            0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+    812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+   1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+   1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+   3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+   4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+   2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+   2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+   1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+   1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+    940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+    140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+   2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+   2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+   4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+   3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+   2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+   2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+   3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+   3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+   1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+   1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+    281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+    548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+   3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+   3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+   2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+   3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+    685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+    413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+   1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+   2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+  },
+  {
+            0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+   3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+     64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+   4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+    128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+   3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+     75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+   3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+    257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+   3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+    210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+   3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+    150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+   3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+    186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+   3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+    514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+   4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+    493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+   4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+    421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+   4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+    449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+   4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+    300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+   4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+    306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+   4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+    373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+   4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+    361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+   4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+  },
+  {
+            0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+    871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+   1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+   1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+   3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+   4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+   2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+   2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+   1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+   2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+    601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+    272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+   2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+   3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+   3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+   3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+   2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+   3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+   4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+   3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+   1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+   1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+    544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+    328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+   3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+   4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+   2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+   2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+     60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+    810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+   1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+   1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+  },
+  {
+            0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+   3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+   2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+   2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+   4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+    714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+   2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+   1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+    698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+   4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+   1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+   2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+   3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+     51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+   2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+   2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+   1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+   2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+    796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+   4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+   2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+   2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+   3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+     85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+   2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+   2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+    102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+   3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+   2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+   1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+   4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+    747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+  }
 };
 
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+  size_t i = 0;
+  for(; i + 8 <= length; i += 8)
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    unsigned one = r ^ ((unsigned)data[i] | ((unsigned)data[i + 1] << 8)
+                     | ((unsigned)data[i + 2] << 16) | ((unsigned)data[i + 3] << 24));
+    unsigned two = (unsigned)data[i + 4] | ((unsigned)data[i + 5] << 8)
+                 | ((unsigned)data[i + 6] << 16) | ((unsigned)data[i + 7] << 24);
+    r = lodepng_crc32_table[7][one & 0xff] ^ lodepng_crc32_table[6][(one >> 8) & 0xff]
+      ^ lodepng_crc32_table[5][(one >> 16) & 0xff] ^ lodepng_crc32_table[4][one >> 24]
+      ^ lodepng_crc32_table[3][two & 0xff] ^ lodepng_crc32_table[2][(two >> 8) & 0xff]
+      ^ lodepng_crc32_table[1][(two >> 16) & 0xff] ^ lodepng_crc32_table[0][two >> 24];
+  }
+  for(; i < length; ++i)
+  {
+    r = lodepng_crc32_table[0][(r ^ data[i]) & 0xff] ^ (r >> 8);
   }
   return r ^ 0xffffffffu;
 }
@@ -3562,6 +4357,56 @@ static unsigned getValueRequiredBits(unsigned char value)
   return 8;
 }
 
+/*
+One pass over 8-bit RGBA pixels that tells whether all of them are opaque and whether all of them are grey
+(r == g == b). Rendered frames nearly always are opaque, and then the per-pixel alpha and colour checks in
+lodepng_get_color_profile can be skipped. Stops early once neither can hold.
+*/
+static void scanRGBA8(unsigned* opaque, unsigned* grey, const unsigned char* in, size_t numpixels)
+{
+  size_t i = 0;
+  *opaque = 1;
+  *grey = 1;
+  while(i != numpixels && (*opaque || *grey))
+  {
+    size_t end = numpixels - i > 4096 ? i + 4096 : numpixels;
+#if defined(LODEPNG_SSE2)
+    __m128i alpha = _mm_set1_epi32(-1);
+    __m128i differ = _mm_setzero_si128();
+    for(; i + 4 <= end; i += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i * 4));
+      alpha = _mm_and_si128(alpha, v);
+      /*bytes 0 and 1 of each pixel become r ^ g and g ^ b*/
+      differ = _mm_or_si128(differ, _mm_xor_si128(v, _mm_srli_epi32(v, 8)));
+    }
+    if((_mm_movemask_epi8(_mm_cmpeq_epi8(alpha, _mm_set1_epi8(-1))) & 0x8888) != 0x8888) *opaque = 0;
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(differ, _mm_set1_epi32(0xffff)),
+                                        _mm_setzero_si128())) != 0xffff) *grey = 0;
+#elif defined(LODEPNG_NEON)
+    uint8x16_t alpha = vdupq_n_u8(255);
+    uint8x16_t differ = vdupq_n_u8(0);
+    uint64x2_t lanes;
+    for(; i + 16 <= end; i += 16)
+    {
+      uint8x16x4_t v = vld4q_u8(in + i * 4);
+      alpha = vandq_u8(alpha, v.val[3]);
+      differ = vorrq_u8(differ, vorrq_u8(veorq_u8(v.val[0], v.val[1]), veorq_u8(v.val[1], v.val[2])));
+    }
+    lanes = vreinterpretq_u64_u8(alpha);
+    if(vgetq_lane_u64(lanes, 0) != ~(uint64_t)0 || vgetq_lane_u64(lanes, 1) != ~(uint64_t)0) *opaque = 0;
+    lanes = vreinterpretq_u64_u8(differ);
+    if(vgetq_lane_u64(lanes, 0) != 0 || vgetq_lane_u64(lanes, 1) != 0) *grey = 0;
+#endif /*LODEPNG_SSE2 / LODEPNG_NEON*/
+    for(; i != end; ++i)
+    {
+      const unsigned char* p = &in[i * 4];
+      if(p[3] != 255) *opaque = 0;
+      if(p[0] != p[1] || p[1] != p[2]) *grey = 0;
+    }
+  }
+}
+
 /*profile must already have been inited with mode.
 It's ok to set some parameters of profile to done already.*/
 unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
@@ -3659,8 +4504,29 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   else /* < 16-bit */
   {
     unsigned char r = 0, g = 0, b = 0, a = 0;
+    unsigned rgba8 = mode->colortype == LCT_RGBA && mode->bitdepth == 8;
+    if(rgba8)
+    {
+      unsigned opaque, grey;
+      scanRGBA8(&opaque, &grey, in, numpixels);
+      /*no pixel with alpha below 255: neither an alpha channel nor a color key*/
+      if(opaque) alpha_done = 1;
+      if(!grey)
+      {
+        profile->colored = 1;
+        if(profile->bits < 8) profile->bits = 8; /*PNG has no colored modes with less than 8-bit per channel*/
+      }
+      colored_done = 1;
+      /*only the palette is left to find; the loop below stops as soon as it has 257 colors*/
+    }
+    /*bits only ever grows while it is below 8*/
+    bits_done = profile->bits >= bpp || profile->bits >= 8;
     for(i = 0; i != numpixels; ++i)
     {
+      /*a run of identical pixels cannot change the profile*/
+      if(rgba8 && i != 0 && !memcmp(&in[i * 4], &in[i * 4 - 4], 4)) continue;
+      if(alpha_done && numcolors_done && colored_done && bits_done) break;
+
       getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
 
       if(!bits_done && profile->bits < 8)
@@ -3669,7 +4535,7 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
         unsigned bits = getValueRequiredBits(r);
         if(bits > profile->bits) profile->bits = bits;
       }
-      bits_done = (profile->bits >= bpp);
+      bits_done = profile->bits >= bpp || profile->bits >= 8;
 
       if(!colored_done && (r != g || r != b))
       {
@@ -3960,6 +4826,48 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+/*
+Vectorised Up unfilter for the decoder, 16 bytes at a time; it starts at index i and returns where the scalar loop
+has to continue. Sub, Average and Paeth depend on the pixel just reconstructed to the left, and doing one pixel per
+vector measured no faster than the scalar loops, which already work on the channels independently.
+*/
+#if defined(LODEPNG_SSE2)
+
+static size_t unfilterUpSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t i, size_t length)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*)&scanline[i]),
+                               _mm_loadu_si128((const __m128i*)&precon[i]));
+    _mm_storeu_si128((__m128i*)&recon[i], sum);
+  }
+  return i;
+}
+
+#elif defined(LODEPNG_NEON)
+
+static size_t unfilterUpSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t i, size_t length)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    vst1q_u8(&recon[i], vaddq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&precon[i])));
+  }
+  return i;
+}
+
+#else /*no SIMD: the scalar loop does all the work*/
+
+static size_t unfilterUpSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t i, size_t length)
+{
+  (void)recon; (void)scanline; (void)precon; (void)length;
+  return i;
+}
+
+#endif /*LODEPNG_SSE2 / LODEPNG_NEON*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -3985,7 +4893,7 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     case 2:
       if(precon)
       {
-        for(i = 0; i != length; ++i) recon[i] = scanline[i] + precon[i];
+        for(i = unfilterUpSIMD(recon, scanline, precon, 0, length); i != length; ++i) recon[i] = scanline[i] + precon[i];
       }
       else
       {
@@ -4858,11 +5766,35 @@ void lodepng_state_copy(LodePNGState* dest, const LodePNGState* source)
 /* / PNG Encoder                                                            / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*returns at least size bytes, kept in *buffer from call to call. The old contents are not kept.*/
+static unsigned char* reuseBuffer(unsigned char** buffer, size_t* buffersize, size_t size)
+{
+  if(size > *buffersize)
+  {
+    lodepng_free(*buffer); /*cheaper than realloc, which would copy*/
+    *buffer = (unsigned char*)lodepng_malloc(size);
+    *buffersize = *buffer ? size : 0;
+  }
+  return *buffer;
+}
+
+/*size bytes from the named member of buffers if there are buffers, else new memory to free afterwards*/
+#define getEncoderBuffer(buffers, name, size)\
+  ((buffers) ? reuseBuffer(&(buffers)->name, &(buffers)->name##_size, size) : (unsigned char*)lodepng_malloc(size))
+
 /*chunkName must be string of 4 characters*/
 static unsigned addChunk(ucvector* out, const char* chunkName, const unsigned char* data, size_t length)
 {
-  CERROR_TRY_RETURN(lodepng_chunk_create(&out->data, &out->size, (unsigned)length, chunkName, data));
-  out->allocsize = out->size; /*fix the allocsize again*/
+  size_t pos = out->size;
+  unsigned char* chunk;
+  if(pos + length + 12 < length + 12) return 77; /*integer overflow happened*/
+  /*grow the way the vector does rather than to the exact size, so a reused output buffer keeps its capacity*/
+  if(!ucvector_resize(out, pos + length + 12)) return 83; /*alloc fail*/
+  chunk = &out->data[pos];
+  lodepng_set32bitInt(chunk, (unsigned)length);
+  memcpy(&chunk[4], chunkName, 4);
+  if(length) memcpy(&chunk[8], data, length);
+  lodepng_chunk_generate_crc(chunk);
   return 0;
 }
 
@@ -4962,15 +5894,41 @@ static unsigned addChunk_tRNS(ucvector* out, const LodePNGColorMode* info)
   return error;
 }
 
+static void encoderStage(const LodePNGEncoderSettings* settings, const char* stage, unsigned begin)
+{
+  if(settings->stage_callback) settings->stage_callback(stage, begin, settings->stage_context);
+}
+
 static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t datasize,
-                              LodePNGCompressSettings* zlibsettings)
+                              LodePNGEncoderSettings* settings)
 {
+  LodePNGCompressSettings* zlibsettings = &settings->zlibsettings;
   ucvector zlibdata;
   unsigned error = 0;
 
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(!zlibsettings->custom_zlib)
+  {
+    /*compress straight into the chunk, then fill in its length and CRC*/
+    size_t pos = out->size;
+    if(!ucvector_resize(out, pos + 8)) return 83; /*alloc fail*/
+    encoderStage(settings, "deflate", 1);
+    error = lodepng_zlib_compressv(out, data, datasize, zlibsettings);
+    encoderStage(settings, "deflate", 0);
+    if(!error && !ucvector_resize(out, out->size + 4)) error = 83; /*alloc fail*/
+    if(error) return error;
+    lodepng_set32bitInt(&out->data[pos], (unsigned)(out->size - pos - 12));
+    memcpy(&out->data[pos + 4], "IDAT", 4);
+    lodepng_chunk_generate_crc(&out->data[pos]);
+    return 0;
+  }
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
   /*compress with the Zlib compressor*/
   ucvector_init(&zlibdata);
+  encoderStage(settings, "deflate", 1);
   error = zlib_compress(&zlibdata.data, &zlibdata.size, data, datasize, zlibsettings);
+  encoderStage(settings, "deflate", 0);
   if(!error) error = addChunk(out, "IDAT", zlibdata.data, zlibdata.size);
   ucvector_cleanup(&zlibdata);
 
@@ -5135,6 +6093,232 @@ static unsigned addChunk_pHYs(ucvector* out, const LodePNGInfo* info)
 
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
+/*
+Vectorised filter kernels for the encoder. When encoding, every filtered byte depends only on the input
+rows, never on earlier output, so 16 bytes can be filtered at once for any bytewidth. Each kernel starts
+at index i, stops before the last partial vector and returns where the scalar loop has to continue.
+*/
+#if defined(LODEPNG_SSE2)
+
+static __m128i loadBytes(const unsigned char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static void storeBytes(unsigned char* p, __m128i v) { _mm_storeu_si128((__m128i*)p, v); }
+
+/*(a + b) >> 1 per byte; _mm_avg_epu8 rounds up, so take the lost low bit back off*/
+static __m128i averageFloor(__m128i a, __m128i b)
+{
+  __m128i carry = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+  return _mm_sub_epi8(_mm_avg_epu8(a, b), carry);
+}
+
+/*paethPredictor on 8 lanes of 16 bits*/
+static __m128i paethPredictor16(__m128i a, __m128i b, __m128i c)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i pa = _mm_sub_epi16(b, c);
+  __m128i pb = _mm_sub_epi16(a, c);
+  __m128i pc = _mm_add_epi16(pa, pb);
+  __m128i notA, useC;
+  pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+  pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+  pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+  /*a if pa <= pb and pa <= pc, else b if pb <= pc, else c: the same choice as paethPredictor*/
+  notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  useC = _mm_and_si128(notA, _mm_cmpgt_epi16(pb, pc));
+  b = _mm_or_si128(_mm_and_si128(useC, c), _mm_andnot_si128(useC, b));
+  return _mm_or_si128(_mm_and_si128(notA, b), _mm_andnot_si128(notA, a));
+}
+
+static size_t filterSubSIMD(unsigned char* out, const unsigned char* scanline,
+                            size_t i, size_t length, size_t bytewidth)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    storeBytes(&out[i], _mm_sub_epi8(loadBytes(&scanline[i]), loadBytes(&scanline[i - bytewidth])));
+  }
+  return i;
+}
+
+static size_t filterUpSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t i, size_t length)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    storeBytes(&out[i], _mm_sub_epi8(loadBytes(&scanline[i]), loadBytes(&prevline[i])));
+  }
+  return i;
+}
+
+static size_t filterAverageSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                size_t i, size_t length, size_t bytewidth)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i average = averageFloor(loadBytes(&scanline[i - bytewidth]), loadBytes(&prevline[i]));
+    storeBytes(&out[i], _mm_sub_epi8(loadBytes(&scanline[i]), average));
+  }
+  return i;
+}
+
+static size_t filterPaethSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                              size_t i, size_t length, size_t bytewidth)
+{
+  __m128i zero = _mm_setzero_si128();
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i a = loadBytes(&scanline[i - bytewidth]);
+    __m128i b = loadBytes(&prevline[i]);
+    __m128i c = loadBytes(&prevline[i - bytewidth]);
+    __m128i low = paethPredictor16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                   _mm_unpacklo_epi8(c, zero));
+    __m128i high = paethPredictor16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                    _mm_unpackhi_epi8(c, zero));
+    storeBytes(&out[i], _mm_sub_epi8(loadBytes(&scanline[i]), _mm_packus_epi16(low, high)));
+  }
+  return i;
+}
+
+/*sum of the bytes (signedBytes == 0) or of their absolute values as signed bytes, as LFS_MINSUM scores
+them: s < 128 ? s : 255 - s. Returns where the scalar loop has to continue.*/
+static size_t sumScanlineSIMD(const unsigned char* data, size_t length, int signedBytes, size_t* sum)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  unsigned long long lanes[2];
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i v = loadBytes(&data[i]);
+    /*255 - s is ~s for the bytes with the top bit set*/
+    if(signedBytes) v = _mm_xor_si128(v, _mm_cmpgt_epi8(zero, v));
+    total = _mm_add_epi64(total, _mm_sad_epu8(v, zero));
+  }
+  _mm_storeu_si128((__m128i*)lanes, total);
+  *sum += (size_t)(lanes[0] + lanes[1]);
+  return i;
+}
+
+#elif defined(LODEPNG_NEON)
+
+static uint8x8_t paethPredictor8(uint8x8_t a, uint8x8_t b, uint8x8_t c)
+{
+  int16x8_t a16 = vreinterpretq_s16_u16(vmovl_u8(a));
+  int16x8_t b16 = vreinterpretq_s16_u16(vmovl_u8(b));
+  int16x8_t c16 = vreinterpretq_s16_u16(vmovl_u8(c));
+  int16x8_t pa = vsubq_s16(b16, c16);
+  int16x8_t pb = vsubq_s16(a16, c16);
+  int16x8_t pc = vabsq_s16(vaddq_s16(pa, pb));
+  uint16x8_t notA, useC;
+  pa = vabsq_s16(pa);
+  pb = vabsq_s16(pb);
+  /*a if pa <= pb and pa <= pc, else b if pb <= pc, else c: the same choice as paethPredictor*/
+  notA = vorrq_u16(vcgtq_s16(pa, pb), vcgtq_s16(pa, pc));
+  useC = vandq_u16(notA, vcgtq_s16(pb, pc));
+  return vbsl_u8(vmovn_u16(notA), vbsl_u8(vmovn_u16(useC), c, b), a);
+}
+
+static size_t filterSubSIMD(unsigned char* out, const unsigned char* scanline,
+                            size_t i, size_t length, size_t bytewidth)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    vst1q_u8(&out[i], vsubq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&scanline[i - bytewidth])));
+  }
+  return i;
+}
+
+static size_t filterUpSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t i, size_t length)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    vst1q_u8(&out[i], vsubq_u8(vld1q_u8(&scanline[i]), vld1q_u8(&prevline[i])));
+  }
+  return i;
+}
+
+static size_t filterAverageSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                size_t i, size_t length, size_t bytewidth)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    /*vhaddq_u8 is (a + b) >> 1 without overflow*/
+    uint8x16_t average = vhaddq_u8(vld1q_u8(&scanline[i - bytewidth]), vld1q_u8(&prevline[i]));
+    vst1q_u8(&out[i], vsubq_u8(vld1q_u8(&scanline[i]), average));
+  }
+  return i;
+}
+
+static size_t filterPaethSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                              size_t i, size_t length, size_t bytewidth)
+{
+  for(; i + 16 <= length; i += 16)
+  {
+    uint8x16_t a = vld1q_u8(&scanline[i - bytewidth]);
+    uint8x16_t b = vld1q_u8(&prevline[i]);
+    uint8x16_t c = vld1q_u8(&prevline[i - bytewidth]);
+    uint8x16_t predicted = vcombine_u8(paethPredictor8(vget_low_u8(a), vget_low_u8(b), vget_low_u8(c)),
+                                       paethPredictor8(vget_high_u8(a), vget_high_u8(b), vget_high_u8(c)));
+    vst1q_u8(&out[i], vsubq_u8(vld1q_u8(&scanline[i]), predicted));
+  }
+  return i;
+}
+
+/*sum of the bytes (signedBytes == 0) or of their absolute values as signed bytes, as LFS_MINSUM scores
+them: s < 128 ? s : 255 - s. Returns where the scalar loop has to continue.*/
+static size_t sumScanlineSIMD(const unsigned char* data, size_t length, int signedBytes, size_t* sum)
+{
+  uint32x4_t total = vdupq_n_u32(0);
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    uint8x16_t v = vld1q_u8(&data[i]);
+    /*255 - s is ~s for the bytes with the top bit set*/
+    if(signedBytes) v = veorq_u8(v, vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(v), 7)));
+    total = vpadalq_u16(total, vpaddlq_u8(v));
+  }
+  *sum += (size_t)vgetq_lane_u32(total, 0) + vgetq_lane_u32(total, 1)
+        + vgetq_lane_u32(total, 2) + vgetq_lane_u32(total, 3);
+  return i;
+}
+
+#else /*no SIMD: everything is left to the scalar loops*/
+
+static size_t filterSubSIMD(unsigned char* out, const unsigned char* scanline,
+                            size_t i, size_t length, size_t bytewidth)
+{
+  (void)out; (void)scanline; (void)length; (void)bytewidth;
+  return i;
+}
+
+static size_t filterUpSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                           size_t i, size_t length)
+{
+  (void)out; (void)scanline; (void)prevline; (void)length;
+  return i;
+}
+
+static size_t filterAverageSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                size_t i, size_t length, size_t bytewidth)
+{
+  (void)out; (void)scanline; (void)prevline; (void)length; (void)bytewidth;
+  return i;
+}
+
+static size_t filterPaethSIMD(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                              size_t i, size_t length, size_t bytewidth)
+{
+  (void)out; (void)scanline; (void)prevline; (void)length; (void)bytewidth;
+  return i;
+}
+
+static size_t sumScanlineSIMD(const unsigned char* data, size_t length, int signedBytes, size_t* sum)
+{
+  (void)data; (void)length; (void)signedBytes; (void)sum;
+  return 0;
+}
+
+#endif /*LODEPNG_SSE2 / LODEPNG_NEON*/
+
 static void filterScanline(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
                            size_t length, size_t bytewidth, unsigned char filterType)
 {
@@ -5146,12 +6330,15 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       break;
     case 1: /*Sub*/
       for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+      for(i = filterSubSIMD(out, scanline, bytewidth, length, bytewidth); i < length; ++i)
+      {
+        out[i] = scanline[i] - scanline[i - bytewidth];
+      }
       break;
     case 2: /*Up*/
       if(prevline)
       {
-        for(i = 0; i != length; ++i) out[i] = scanline[i] - prevline[i];
+        for(i = filterUpSIMD(out, scanline, prevline, 0, length); i != length; ++i) out[i] = scanline[i] - prevline[i];
       }
       else
       {
@@ -5162,7 +6349,10 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       if(prevline)
       {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i] - (prevline[i] >> 1);
-        for(i = bytewidth; i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+        for(i = filterAverageSIMD(out, scanline, prevline, bytewidth, length, bytewidth); i < length; ++i)
+        {
+          out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+        }
       }
       else
       {
@@ -5175,7 +6365,7 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       {
         /*paethPredictor(0, prevline[i], 0) is always prevline[i]*/
         for(i = 0; i != bytewidth; ++i) out[i] = (scanline[i] - prevline[i]);
-        for(i = bytewidth; i < length; ++i)
+        for(i = filterPaethSIMD(out, scanline, prevline, bytewidth, length, bytewidth); i < length; ++i)
         {
           out[i] = (scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]));
         }
@@ -5184,7 +6374,10 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
       {
         for(i = 0; i != bytewidth; ++i) out[i] = scanline[i];
         /*paethPredictor(scanline[i - bytewidth], 0, 0) is always scanline[i - bytewidth]*/
-        for(i = bytewidth; i < length; ++i) out[i] = (scanline[i] - scanline[i - bytewidth]);
+        for(i = filterSubSIMD(out, scanline, bytewidth, length, bytewidth); i < length; ++i)
+        {
+          out[i] = (scanline[i] - scanline[i - bytewidth]);
+        }
       }
       break;
     default: return; /*unexisting filter type given*/
@@ -5218,6 +6411,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   unsigned x, y;
   unsigned error = 0;
   LodePNGFilterStrategy strategy = settings->filter_strategy;
+  LodePNGEncoderBuffers* buffers = settings->zlibsettings.buffers;
+  unsigned char* attempts; /*the five filter attempts of the adaptive strategies, one after the other*/
 
   /*
   There is a heuristic called the minimum sum of absolute differences heuristic, suggested by the PNG standard:
@@ -5256,11 +6451,9 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     size_t smallest = 0;
     unsigned char type, bestType = 0;
 
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    attempts = getEncoderBuffer(buffers, attempts, linebytes * 5);
+    if(!attempts) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts[type * linebytes];
 
     if(!error)
     {
@@ -5273,13 +6466,14 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
 
           /*calculate the sum of the result*/
           sum[type] = 0;
+          x = (unsigned)sumScanlineSIMD(attempt[type], linebytes, type != 0, &sum[type]);
           if(type == 0)
           {
-            for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
+            for(; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
           }
           else
           {
-            for(x = 0; x != linebytes; ++x)
+            for(; x != linebytes; ++x)
             {
               /*For differences, each byte should be treated as signed, values above 127 are negative
               (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
@@ -5305,7 +6499,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       }
     }
 
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
+    if(!buffers) lodepng_free(attempts);
   }
   else if(strategy == LFS_ENTROPY)
   {
@@ -5315,11 +6509,9 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     unsigned type, bestType = 0;
     unsigned count[256];
 
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    attempts = getEncoderBuffer(buffers, attempts, linebytes * 5);
+    if(!attempts) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts[type * linebytes];
 
     for(y = 0; y != h; ++y)
     {
@@ -5351,7 +6543,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
 
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
+    if(!buffers) lodepng_free(attempts);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5385,11 +6577,9 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     images only, so disable it*/
     zlibsettings.custom_zlib = 0;
     zlibsettings.custom_deflate = 0;
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    attempts = getEncoderBuffer(buffers, attempts, linebytes * 5);
+    if(!attempts) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts[type * linebytes];
     for(y = 0; y != h; ++y) /*try the 5 filter types*/
     {
       for(type = 0; type != 5; ++type)
@@ -5413,7 +6603,7 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
+    if(!buffers) lodepng_free(attempts);
   }
   else return 88; /* unknown filter strategy */
 
@@ -5503,6 +6693,7 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
 }
 
 /*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
+*out comes from the encoder buffers if settings has them, and is to be freed by the caller otherwise.
 return value is error**/
 static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
                                     unsigned w, unsigned h,
@@ -5515,11 +6706,12 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
   */
   unsigned bpp = lodepng_get_bpp(&info_png->color);
   unsigned error = 0;
+  LodePNGEncoderBuffers* buffers = settings->zlibsettings.buffers;
 
   if(info_png->interlace_method == 0)
   {
     *outsize = h + (h * ((w * bpp + 7) / 8)); /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
+    *out = getEncoderBuffer(buffers, filtered, *outsize);
     if(!(*out) && (*outsize)) error = 83; /*alloc fail*/
 
     if(!error)
@@ -5552,7 +6744,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
     *outsize = filter_passstart[7]; /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
+    *out = getEncoderBuffer(buffers, filtered, *outsize);
     if(!(*out)) error = 83; /*alloc fail*/
 
     adam7 = (unsigned char*)lodepng_malloc(passstart[7]);
@@ -5639,6 +6831,8 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
   ucvector outv;
   unsigned char* data = 0; /*uncompressed version of the IDAT chunk data*/
   size_t datasize = 0;
+  LodePNGEncoderBuffers* buffers = state->encoder.zlibsettings.buffers;
+  unsigned chunksStarted; /*whether the "chunks" stage needs ending*/
 
   /*provide some proper output values if error will happen*/
   *out = 0;
@@ -5657,7 +6851,9 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
 
   if(state->encoder.auto_convert)
   {
+    encoderStage(&state->encoder, "color_profile", 1);
     state->error = lodepng_auto_choose_color(&info.color, image, w, h, &state->info_raw);
+    encoderStage(&state->encoder, "color_profile", 0);
   }
   if(state->error) return state->error;
 
@@ -5680,18 +6876,39 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     unsigned char* converted;
     size_t size = (w * h * (size_t)lodepng_get_bpp(&info.color) + 7) / 8;
 
-    converted = (unsigned char*)lodepng_malloc(size);
+    converted = getEncoderBuffer(buffers, converted, size);
     if(!converted && size) state->error = 83; /*alloc fail*/
     if(!state->error)
     {
+      encoderStage(&state->encoder, "convert", 1);
       state->error = lodepng_convert(converted, image, &info.color, &state->info_raw, w, h);
+      encoderStage(&state->encoder, "convert", 0);
     }
-    if(!state->error) preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder);
-    lodepng_free(converted);
+    if(!state->error)
+    {
+      encoderStage(&state->encoder, "filter", 1);
+      preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder);
+      encoderStage(&state->encoder, "filter", 0);
+    }
+    if(!buffers) lodepng_free(converted);
+  }
+  else
+  {
+    encoderStage(&state->encoder, "filter", 1);
+    preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder);
+    encoderStage(&state->encoder, "filter", 0);
   }
-  else preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder);
 
-  ucvector_init(&outv);
+  if(buffers)
+  {
+    /*start from an empty vector with the capacity of the previous output*/
+    outv.data = buffers->png;
+    outv.allocsize = buffers->png_size;
+    outv.size = 0;
+  }
+  else ucvector_init(&outv);
+  chunksStarted = !state->error;
+  if(chunksStarted) encoderStage(&state->encoder, "chunks", 1);
   while(!state->error) /*while only executed once, to break on error*/
   {
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
@@ -5741,7 +6958,7 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
-    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
+    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder);
     if(state->error) break;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*tIME*/
@@ -5814,9 +7031,15 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
 
     break; /*this isn't really a while loop; no error happened so break out now!*/
   }
+  if(chunksStarted) encoderStage(&state->encoder, "chunks", 0);
 
   lodepng_info_cleanup(&info);
-  lodepng_free(data);
+  if(!buffers) lodepng_free(data);
+  if(buffers)
+  {
+    buffers->png = outv.data;
+    buffers->png_size = outv.allocsize;
+  }
   /*instead of cleaning the vector up, give it to the output*/
   *out = outv.data;
   *outsize = outv.size;
@@ -5885,6 +7108,8 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   settings->add_id = 0;
   settings->text_compression = 1;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  settings->stage_callback = 0;
+  settings->stage_context = 0;
 }
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -6186,7 +7411,8 @@ unsigned encode(std::vector<unsigned char>& out,
   if(buffer)
   {
     out.insert(out.end(), &buffer[0], &buffer[buffersize]);
-    lodepng_free(buffer);
+    /*with buffers, the output belongs to them*/
+    if(!state.encoder.zlibsettings.buffers) lodepng_free(buffer);
   }
   return error;
 }
@@ -6199,6 +7425,65 @@ unsigned encode(std::vector<unsigned char>& out,
   return encode(out, in.empty() ? 0 : &in[0], w, h, state);
 }
 
+Encoder::Encoder()
+{
+  lodepng_encoder_buffers_init(&buffers);
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+  installed = 0;
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+}
+
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+Encoder::Encoder(const LodePNGAllocator& allocator) : allocator(allocator)
+{
+  lodepng_encoder_buffers_init(&buffers);
+  installed = &this->allocator;
+}
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+
+Encoder::~Encoder()
+{
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+  const LodePNGAllocator* previous = installed ? lodepng_set_allocator(installed) : 0;
+  lodepng_encoder_buffers_cleanup(&buffers);
+  if(installed) lodepng_set_allocator(previous);
+#else /*LODEPNG_COMPILE_ALLOCATORS*/
+  lodepng_encoder_buffers_cleanup(&buffers);
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+}
+
+unsigned Encoder::encode(const unsigned char** out, size_t* outsize,
+                         const unsigned char* in, unsigned w, unsigned h)
+{
+  unsigned char* buffer;
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+  const LodePNGAllocator* previous = 0;
+  if(installed)
+  {
+    previous = lodepng_set_allocator(installed);
+    lodepng_encoder_buffers_cleanup(&buffers);
+  }
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+  /*set on every call, since copying settings in from another State would have overwritten it*/
+  encoder.zlibsettings.buffers = &buffers;
+  lodepng_encode(&buffer, outsize, in, w, h, this);
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+  if(installed) lodepng_set_allocator(previous);
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+  *out = buffer;
+  return error;
+}
+
+unsigned Encoder::encode(std::vector<unsigned char>& out,
+                         const unsigned char* in, unsigned w, unsigned h)
+{
+  const unsigned char* buffer;
+  size_t buffersize;
+  unsigned error = encode(&buffer, &buffersize, in, w, h);
+  if(buffer) out.insert(out.end(), &buffer[0], &buffer[buffersize]);
+  return error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned encode(const std::string& filename,
                 const unsigned char* in, unsigned w, unsigned h,
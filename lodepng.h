@@ -74,6 +74,11 @@ source files with custom allocators.*/
 #ifndef LODEPNG_NO_COMPILE_ALLOCATORS
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
+/*SSE2 or NEON versions of hot loops (PNG filters, ...), used where the compiler targets those
+instruction sets. They give exactly the same output as the portable code, which stays as the fallback.*/
+#ifndef LODEPNG_NO_COMPILE_SIMD
+#define LODEPNG_COMPILE_SIMD
+#endif
 /*compile the C++ version (you can disable the C++ wrapper here even when compiling for C++)*/
 #ifdef __cplusplus
 #ifndef LODEPNG_NO_COMPILE_CPP
@@ -86,6 +91,27 @@ source files with custom allocators.*/
 #include <string>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+/*
+Replacement memory functions, e.g. to allocate from an arena. context is passed to each of them as is. realloc and
+free must accept NULL like the C functions do.
+*/
+typedef struct LodePNGAllocator
+{
+  void* (*malloc)(size_t size, void* context);
+  void* (*realloc)(void* ptr, size_t new_size, void* context);
+  void (*free)(void* ptr, void* context);
+  void* context;
+} LodePNGAllocator;
+
+/*
+Makes every allocation lodepng does on the calling thread go to allocator, or back to malloc, realloc and free if it
+is NULL. Returns the allocator that was installed before. Memory must be given back to the allocator it came from, so
+install it around whole calls, and not while a result of another allocator is still to be freed by lodepng.
+*/
+const LodePNGAllocator* lodepng_set_allocator(const LodePNGAllocator* allocator);
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+
 #ifdef LODEPNG_COMPILE_PNG
 /*The PNG color types (also used for raw).*/
 typedef enum LodePNGColorType
@@ -276,6 +302,25 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
+/*
+Working memory that lodepng_encode keeps from one image to the next when
+LodePNGCompressSettings::buffers points to it: once an image has been encoded,
+images of the same or smaller size need none of these allocated again. The
+members are for lodepng's own use; sizes are in bytes.
+*/
+typedef struct LodePNGEncoderBuffers
+{
+  unsigned char* converted; size_t converted_size; /*the image in the color type of the PNG, if that differs*/
+  unsigned char* filtered; size_t filtered_size; /*the filtered scanlines, which are the input of zlib*/
+  unsigned char* attempts; size_t attempts_size; /*the filter attempts for one scanline*/
+  unsigned char* png; size_t png_size; /*the PNG file, returned by lodepng_encode*/
+  unsigned* lz77; size_t lz77_size; /*the LZ77 output of one deflate block*/
+  void* hash; unsigned hash_windowsize; /*the LZ77 hash tables*/
+} LodePNGEncoderBuffers;
+
+void lodepng_encoder_buffers_init(LodePNGEncoderBuffers* buffers);
+void lodepng_encoder_buffers_cleanup(LodePNGEncoderBuffers* buffers);
+
 /*
 Settings for zlib compression. Tweaking these settings tweaks the balance
 between speed and compression ratio.
@@ -290,6 +335,10 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*0 uses the LZ77 match finder configured by windowsize, nicematch and lazymatching above. 1 (fastest)
+  to 9 (smallest) use a faster match finder over the full 32K window instead, with a per-level bound on
+  hash chain depth; windowsize, nicematch and lazymatching are then ignored. Default: 0*/
+  unsigned level;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -303,6 +352,10 @@ struct LodePNGCompressSettings /*deflate = compress*/
                              const LodePNGCompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*working memory to reuse between calls, see LodePNGEncoderBuffers. With it, the output of lodepng_encode
+  belongs to the buffers: it stays valid until the next call and must not be freed. Default: null*/
+  LodePNGEncoderBuffers* buffers;
 };
 
 extern const LodePNGCompressSettings lodepng_default_compress_settings;
@@ -611,6 +664,13 @@ typedef struct LodePNGEncoderSettings
   /*encode text chunks as zTXt chunks instead of tEXt chunks, and use compression in iTXt chunks*/
   unsigned text_compression;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+
+  /*For profiling: called as each stage of lodepng_encode begins (begin 1) and ends
+  (begin 0). The stages are "color_profile" (choosing the PNG color type with
+  auto_convert), "convert", "filter", and "chunks" (writing every chunk), which
+  contains "deflate". NULL, the default, for none.*/
+  void (*stage_callback)(const char* stage, unsigned begin, void* context);
+  void* stage_context; /*passed to stage_callback*/
 } LodePNGEncoderSettings;
 
 void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings);
@@ -844,6 +904,45 @@ unsigned encode(std::vector<unsigned char>& out,
 unsigned encode(std::vector<unsigned char>& out,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 State& state);
+
+/*
+A State that encodes a series of images, keeping its working memory (see
+LodePNGEncoderBuffers) from one to the next. After the first image, images of
+the same or smaller size are encoded without allocating those buffers again.
+*/
+class Encoder : public State
+{
+  public:
+    Encoder();
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+    /*
+    Everything the encoder allocates, in its calls and for its buffers, comes
+    from allocator, which must outlive it. The buffers are given back at the
+    start of each call rather than kept, so an arena that starts over once all
+    of its memory has been freed serves every image from the same memory.
+    */
+    explicit Encoder(const LodePNGAllocator& allocator);
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+    virtual ~Encoder();
+
+    /*Encodes with this state. out points into the encoder's memory and stays
+    valid until the next call or until the encoder is destroyed.*/
+    unsigned encode(const unsigned char** out, size_t* outsize,
+                    const unsigned char* in, unsigned w, unsigned h);
+    /*Same, but appends a copy of the PNG to out.*/
+    unsigned encode(std::vector<unsigned char>& out,
+                    const unsigned char* in, unsigned w, unsigned h);
+
+  private:
+    Encoder(const Encoder& other); /*not copyable: the buffers belong to one encoder*/
+    Encoder& operator=(const Encoder& other);
+
+    LodePNGEncoderBuffers buffers;
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+    LodePNGAllocator allocator;
+    const LodePNGAllocator* installed; /*&allocator, or NULL to use whatever the thread has installed*/
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+};
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DISK
@@ -1582,6 +1681,7 @@ state.encoder.zlibsettings.windowsize: tweak LZ77 windowsize
 state.encoder.zlibsettings.minmatch: tweak min LZ77 length to match
 state.encoder.zlibsettings.nicematch: tweak LZ77 match where to stop searching
 state.encoder.zlibsettings.lazymatching: try one more LZ77 matching
+state.encoder.zlibsettings.level: 1-9 to use the faster LZ77 match finder at that level
 state.encoder.zlibsettings.custom_...: use custom deflate function
 state.encoder.auto_convert: choose optimal PNG color type, if 0 uses info_png
 state.encoder.filter_palette_zero: PNG filter strategy for palette
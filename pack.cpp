@@ -0,0 +1,337 @@
+#include "pack.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char FILE_MAGIC[8] = {'G', 'I', 'P', 'A', 'C', 'K', '0', '1'};
+const char ENTRY_MAGIC[4] = {'G', 'I', 'P', 'E'};
+const char INDEX_MAGIC[4] = {'G', 'I', 'P', 'I'};
+const char TRAILER_MAGIC[8] = {'G', 'I', 'P', 'K', 'E', 'N', 'D', '1'};
+
+// Fixed part of a record, before the name.
+const size_t RECORD_SIZE = 8 + 4 + 4 + 4 + 8 + 8 + 4;
+const size_t TRAILER_SIZE = 8 + sizeof(TRAILER_MAGIC);
+// Sanity limit when reading names back.
+const std::uint32_t MAX_NAME = 1 << 16;
+
+// Large enough that a 1024x1024 PNG goes out in one or two writes.
+const size_t BUFFER_SIZE = 4 << 20;
+
+void putU32(std::string& out, std::uint32_t value) {
+  for(int i = 0; i < 4; i++) {
+    out += (char) (value >> (8 * i));
+  }
+}
+
+void putU64(std::string& out, std::uint64_t value) {
+  for(int i = 0; i < 8; i++) {
+    out += (char) (value >> (8 * i));
+  }
+}
+
+std::uint32_t getU32(const unsigned char* in) {
+  std::uint32_t value = 0;
+  for(int i = 3; i >= 0; i--) {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+std::uint64_t getU64(const unsigned char* in) {
+  std::uint64_t value = 0;
+  for(int i = 7; i >= 0; i--) {
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+void putRecord(std::string& out, const PackEntry& entry) {
+  putU64(out, entry.job);
+  putU32(out, (std::uint32_t) entry.kind);
+  putU32(out, entry.width);
+  putU32(out, entry.height);
+  putU64(out, entry.length);
+  putU64(out, entry.pixelHash);
+  putU32(out, (std::uint32_t) entry.name.length());
+  out += entry.name;
+}
+
+bool seekTo(std::FILE* file, std::uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, (__int64) offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+bool fileSize(std::FILE* file, std::uint64_t& size) {
+#ifdef _WIN32
+  if(_fseeki64(file, 0, SEEK_END) != 0) {
+    return false;
+  }
+  size = (std::uint64_t) _ftelli64(file);
+#else
+  if(fseeko(file, 0, SEEK_END) != 0) {
+    return false;
+  }
+  size = (std::uint64_t) ftello(file);
+#endif
+  return true;
+}
+
+bool readExactly(std::FILE* file, void* data, size_t length) {
+  return std::fread(data, 1, length, file) == length;
+}
+
+// Reads a record at the current position; end is the end of the region it
+// must fit in.
+bool readRecord(std::FILE* file, std::uint64_t position, std::uint64_t end, PackEntry& entry, std::uint64_t& next) {
+  unsigned char fixed[RECORD_SIZE];
+  if(end - position < RECORD_SIZE || !readExactly(file, fixed, RECORD_SIZE)) {
+    return false;
+  }
+  entry.job = getU64(fixed);
+  std::uint32_t kind = getU32(fixed + 8);
+  entry.width = getU32(fixed + 12);
+  entry.height = getU32(fixed + 16);
+  entry.length = getU64(fixed + 20);
+  entry.pixelHash = getU64(fixed + 28);
+  std::uint32_t nameLength = getU32(fixed + 36);
+  if(kind > PACK_HASH || nameLength > MAX_NAME || end - position - RECORD_SIZE < nameLength) {
+    return false;
+  }
+  entry.kind = (PackKind) kind;
+  entry.name.resize(nameLength);
+  if(nameLength > 0 && !readExactly(file, &entry.name[0], nameLength)) {
+    return false;
+  }
+  next = position + RECORD_SIZE + nameLength;
+  return true;
+}
+
+bool readIndex(std::FILE* file, std::uint64_t size, std::vector<PackEntry>& entries) {
+  unsigned char trailer[TRAILER_SIZE];
+  if(size < sizeof(FILE_MAGIC) + TRAILER_SIZE || !seekTo(file, size - TRAILER_SIZE) ||
+     !readExactly(file, trailer, TRAILER_SIZE) ||
+     std::memcmp(trailer + 8, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0) {
+    return false;
+  }
+  std::uint64_t position = getU64(trailer);
+  std::uint64_t end = size - TRAILER_SIZE;
+  unsigned char header[4 + 8];
+  if(position > end || end - position < sizeof(header) || !seekTo(file, position) ||
+     !readExactly(file, header, sizeof(header)) || std::memcmp(header, INDEX_MAGIC, 4) != 0) {
+    return false;
+  }
+  std::uint64_t count = getU64(header + 4);
+  position += sizeof(header);
+  std::vector<PackEntry> index;
+  for(std::uint64_t i = 0; i < count; i++) {
+    PackEntry entry;
+    unsigned char offset[8];
+    if(!readRecord(file, position, end, entry, position) || end - position < 8 ||
+       !readExactly(file, offset, 8)) {
+      return false;
+    }
+    position += 8;
+    entry.offset = getU64(offset);
+    if(entry.offset > size || size - entry.offset < entry.length) {
+      return false;
+    }
+    index.push_back(entry);
+  }
+  entries.swap(index);
+  return true;
+}
+
+// Walks the entries from the start, stopping at the first one that is cut
+// short or is not an entry at all (such as an index).
+void scanEntries(std::FILE* file, std::uint64_t size, std::vector<PackEntry>& entries) {
+  entries.clear();
+  std::uint64_t position = sizeof(FILE_MAGIC);
+  while(seekTo(file, position)) {
+    char magic[4];
+    PackEntry entry;
+    if(size - position < sizeof(magic) || !readExactly(file, magic, sizeof(magic)) ||
+       std::memcmp(magic, ENTRY_MAGIC, sizeof(magic)) != 0 ||
+       !readRecord(file, position + sizeof(magic), size, entry, position)) {
+      return;
+    }
+    if(size - position < entry.length) {
+      return;
+    }
+    entry.offset = position;
+    position += entry.length;
+    entries.push_back(entry);
+  }
+}
+
+} // namespace
+
+const char* packKindName(PackKind kind) {
+  switch(kind) {
+    case PACK_PNG:
+      return "png";
+    case PACK_RAW:
+      return "raw";
+    case PACK_HASH:
+      return "hash";
+  }
+  return "unknown";
+}
+
+bool parsePackKind(const std::string& name, PackKind& kind) {
+  for(PackKind candidate : {PACK_PNG, PACK_RAW, PACK_HASH}) {
+    if(name == packKindName(candidate)) {
+      kind = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+PackWriter::PackWriter() : file(NULL), offset(0), syncBytes(0), unsynced(0), failed(false) {}
+
+PackWriter::~PackWriter() {
+  finish();
+}
+
+bool PackWriter::open(const std::string& path, std::uint64_t syncBytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->path = path;
+  this->syncBytes = syncBytes;
+  file = std::fopen(path.c_str(), "wb");
+  if(!file) {
+    std::cerr << "Could not create pack " << path << std::endl;
+    return false;
+  }
+  buffer.resize(BUFFER_SIZE);
+  std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+  offset = 0;
+  unsynced = 0;
+  failed = false;
+  entries.clear();
+  return write(FILE_MAGIC, sizeof(FILE_MAGIC));
+}
+
+bool PackWriter::append(PackEntry entry, const void* data) {
+  std::string header(ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+  putRecord(header, entry);
+  std::lock_guard<std::mutex> lock(mutex);
+  if(!file || !write(header.data(), header.size())) {
+    return false;
+  }
+  entry.offset = offset;
+  if(entry.length > 0 && !write(data, (size_t) entry.length)) {
+    return false;
+  }
+  entries.push_back(entry);
+  if(syncBytes > 0 && unsynced >= syncBytes && !sync()) {
+    return false;
+  }
+  return true;
+}
+
+bool PackWriter::finish() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(!file) {
+    return !failed;
+  }
+  std::uint64_t indexOffset = offset;
+  std::string index(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  putU64(index, entries.size());
+  for(const PackEntry& entry : entries) {
+    putRecord(index, entry);
+    putU64(index, entry.offset);
+  }
+  putU64(index, indexOffset);
+  index.append(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+  bool ok = write(index.data(), index.size()) && sync();
+  if(std::fclose(file) != 0) {
+    ok = false;
+  }
+  file = NULL;
+  if(!ok) {
+    failed = true;
+    std::cerr << "Error finishing pack " << path << std::endl;
+  }
+  return ok;
+}
+
+bool PackWriter::write(const void* data, size_t length) {
+  if(failed) {
+    return false;
+  }
+  if(std::fwrite(data, 1, length, file) != length) {
+    std::cerr << "Error writing pack " << path << std::endl;
+    failed = true;
+    return false;
+  }
+  offset += length;
+  unsynced += length;
+  return true;
+}
+
+bool PackWriter::sync() {
+  if(std::fflush(file) != 0) {
+    failed = true;
+    return false;
+  }
+#ifdef _WIN32
+  int result = _commit(_fileno(file));
+#else
+  int result = fsync(fileno(file));
+#endif
+  if(result != 0) {
+    std::cerr << "Error syncing pack " << path << std::endl;
+    failed = true;
+    return false;
+  }
+  unsynced = 0;
+  return true;
+}
+
+bool readPackIndex(const std::string& path, std::vector<PackEntry>& entries, bool& complete) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if(!file) {
+    std::cerr << "Could not open pack " << path << std::endl;
+    return false;
+  }
+  char magic[sizeof(FILE_MAGIC)];
+  std::uint64_t size = 0;
+  if(!readExactly(file, magic, sizeof(magic)) || std::memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+     !fileSize(file, size)) {
+    std::cerr << path << " is not a pack" << std::endl;
+    std::fclose(file);
+    return false;
+  }
+  complete = readIndex(file, size, entries);
+  if(!complete) {
+    scanEntries(file, size, entries);
+  }
+  std::fclose(file);
+  return true;
+}
+
+bool readPackData(const std::string& path, const PackEntry& entry, std::vector<unsigned char>& data) {
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if(!file) {
+    std::cerr << "Could not open pack " << path << std::endl;
+    return false;
+  }
+  data.resize((size_t) entry.length);
+  bool ok = seekTo(file, entry.offset) && (data.empty() || readExactly(file, data.data(), data.size()));
+  std::fclose(file);
+  if(!ok) {
+    std::cerr << "Error reading job " << entry.job << " from " << path << std::endl;
+  }
+  return ok;
+}
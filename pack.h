@@ -0,0 +1,93 @@
+#ifndef CPP_PACK_H
+#define CPP_PACK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A pack holds a whole batch of renders in one file, so that large batches do
+// not create, write and close one small file per image.
+//
+// Layout, all integers little-endian:
+//
+//   "GIPACK01"
+//   entry*     "GIPE", record, data
+//   index      "GIPI", u64 count, (record, u64 offset)*
+//   trailer    u64 offset of the index, "GIPKEND1"
+//
+// where a record is u64 job, u32 kind, u32 width, u32 height, u64 data length,
+// u64 pixel hash, u32 name length and the name. The file is only ever
+// appended to. Every entry carries its own record, so a pack whose index was
+// never written (the batch was killed) can still be read by scanning it.
+
+enum PackKind {
+  PACK_PNG = 0,   // an encoded PNG
+  PACK_RAW = 1,   // top-down RGBA, width * height * 4 bytes
+  PACK_HASH = 2   // no data, only the pixel hash
+};
+
+// "png", "raw" or "hash".
+const char* packKindName(PackKind kind);
+bool parsePackKind(const std::string& name, PackKind& kind);
+
+struct PackEntry {
+  std::uint64_t job;
+  PackKind kind;
+  std::uint32_t width;
+  std::uint32_t height;
+  // Where the data starts in the pack, and its length.
+  std::uint64_t offset;
+  std::uint64_t length;
+  // Hasher digest of the top-down RGBA pixels, as the result cache records.
+  std::uint64_t pixelHash;
+  // The output the job would have been written to without a pack.
+  std::string name;
+};
+
+// Appends entries from any number of threads. Writes go through one large
+// stdio buffer, and the file is synced every syncBytes so that a crash loses
+// at most that much of the batch.
+class PackWriter {
+  public:
+    PackWriter();
+    ~PackWriter();
+
+    // Creates (or truncates) path. syncBytes 0 syncs only in finish.
+    bool open(const std::string& path, std::uint64_t syncBytes);
+
+    // entry.offset is filled in; data may be NULL for PACK_HASH.
+    bool append(PackEntry entry, const void* data);
+
+    // Writes the index and trailer, syncs and closes. Safe to call twice.
+    bool finish();
+
+    const std::string& getPath() const { return path; }
+
+  private:
+    PackWriter(const PackWriter&);
+    PackWriter& operator=(const PackWriter&);
+
+    bool write(const void* data, size_t length);
+    bool sync();
+
+    std::mutex mutex;
+    std::string path;
+    std::FILE* file;
+    std::vector<char> buffer;
+    std::uint64_t offset;
+    std::uint64_t syncBytes;
+    std::uint64_t unsynced;
+    bool failed;
+    std::vector<PackEntry> entries;
+};
+
+// Reads the index of a pack, or recovers the entries by scanning when it has
+// none. complete is set to whether the index was found. Errors go to stderr.
+bool readPackIndex(const std::string& path, std::vector<PackEntry>& entries, bool& complete);
+
+// Reads the data of one entry.
+bool readPackData(const std::string& path, const PackEntry& entry, std::vector<unsigned char>& data);
+
+#endif //CPP_PACK_H
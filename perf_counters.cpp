@@ -0,0 +1,120 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perfCounterName(PerfCounter counter) {
+  switch(counter) {
+    case PERF_CYCLES: return "cycles";
+    case PERF_INSTRUCTIONS: return "instructions";
+    case PERF_CACHE_MISSES: return "cache_misses";
+    case PERF_BRANCH_MISSES: return "branch_misses";
+    default: return "unknown";
+  }
+}
+
+PerfCounters::PerfCounters() : leader(-1) {
+  for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    fds[i] = -1;
+  }
+}
+
+#ifdef __linux__
+
+PerfCounters::~PerfCounters() {
+  for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    if(fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+}
+
+static int openCounter(std::uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = groupFd < 0 ? 1 : 0;
+  // The default perf_event_paranoid (2) allows user-space counts of one's
+  // own threads, and nothing more.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+bool PerfCounters::open(std::string& error) {
+  static const std::uint64_t configs[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+  };
+  fds[PERF_CYCLES] = openCounter(configs[PERF_CYCLES], -1);
+  if(fds[PERF_CYCLES] < 0) {
+    int openErrno = errno;
+    error = std::string("perf_event_open: ") + std::strerror(openErrno);
+    if(openErrno == EACCES || openErrno == EPERM) {
+      error += " (see /proc/sys/kernel/perf_event_paranoid)";
+    }
+    return false;
+  }
+  leader = fds[PERF_CYCLES];
+  for(int i = PERF_CYCLES + 1; i < PERF_COUNTER_COUNT; i++) {
+    fds[i] = openCounter(configs[i], leader);
+  }
+  ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+bool PerfCounters::read(std::uint64_t values[PERF_COUNTER_COUNT]) {
+  for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    values[i] = 0;
+  }
+  if(leader < 0) {
+    return false;
+  }
+  // nr, time enabled, time running, then one value per member in the order
+  // they joined the group.
+  std::uint64_t data[3 + PERF_COUNTER_COUNT];
+  ssize_t size = ::read(leader, data, sizeof(data));
+  if(size < (ssize_t) (3 * sizeof(std::uint64_t))) {
+    return false;
+  }
+  std::uint64_t members = data[0];
+  double scale = data[2] > 0 ? (double) data[1] / data[2] : 0.0;
+  std::uint64_t member = 0;
+  for(int i = 0; i < PERF_COUNTER_COUNT && member < members; i++) {
+    if(fds[i] >= 0) {
+      values[i] = (std::uint64_t) (data[3 + member] * scale);
+      ++member;
+    }
+  }
+  return true;
+}
+
+#else
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::open(std::string& error) {
+  error = "hardware counters need Linux perf_event_open";
+  return false;
+}
+
+bool PerfCounters::read(std::uint64_t values[PERF_COUNTER_COUNT]) {
+  for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    values[i] = 0;
+  }
+  return false;
+}
+
+#endif
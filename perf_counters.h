@@ -0,0 +1,45 @@
+#ifndef CPP_PERF_COUNTERS_H
+#define CPP_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+enum PerfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTER_COUNT
+};
+
+// "cycles", "instructions", "cache_misses" or "branch_misses".
+const char* perfCounterName(PerfCounter counter);
+
+// Hardware counters of the calling thread, user space only, opened with
+// perf_event_open as one group so that they are read together. Linux only:
+// elsewhere, and wherever the kernel refuses (perf_event_paranoid, a
+// container without CAP_PERFMON, a VM without a PMU), open fails with a
+// reason and callers go without. Counters the CPU lacks are left out of the
+// group; the rest still count.
+class PerfCounters {
+  public:
+    PerfCounters();
+    ~PerfCounters();
+
+    bool open(std::string& error);
+    bool isOpen() const { return leader >= 0; }
+    bool has(PerfCounter counter) const { return fds[counter] >= 0; }
+
+    // Counts since open, scaled up for any time the kernel had the group
+    // multiplexed out. Counters the group lacks read 0.
+    bool read(std::uint64_t values[PERF_COUNTER_COUNT]);
+
+  private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+    int leader;
+    int fds[PERF_COUNTER_COUNT];
+};
+
+#endif //CPP_PERF_COUNTERS_H
@@ -0,0 +1,285 @@
+#include "pipeline.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+
+// Frames drawn but not yet read back; one offscreen target each.
+#define FRAMES_IN_FLIGHT (2)
+
+namespace {
+
+struct InFlight {
+  bool active;
+  size_t job;
+  GLsync fence;
+  ResultCacheKey cacheKey;
+};
+
+}
+
+// Waits for an in-flight draw and reads its target back into frame.
+static int finishJob(
+    InFlight& inFlight,
+    const RenderTarget& target,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    EncoderPool& encoders,
+    Frame& frame) {
+
+  inFlight.active = false;
+  watchdog.arm("draw");
+  int result = waitForFence(inFlight.fence, watchdog);
+  if(result != EXIT_SUCCESS) {
+    return result;
+  }
+
+  watchdog.setPhase("readback");
+  glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+  frame.job = inFlight.job;
+  frame.cacheKey = inFlight.cacheKey;
+  frame.width = options.width;
+  frame.height = options.height;
+  frame.pixels = encoders.acquireBuffer();
+  result = readPixels(options.width, options.height, frame.pixels);
+  watchdog.disarm();
+  return result;
+}
+
+static void releaseDrawing(GLuint& vertexBuffer, GLuint& indicesBuffer, RenderTarget* targets) {
+  for(int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+    destroyRenderTarget(targets[i]);
+  }
+  glDeleteBuffers(1, &vertexBuffer);
+  glDeleteBuffers(1, &indicesBuffer);
+}
+
+// Creates the draw buffers and a width x height target per frame in flight.
+// On failure whatever was created is released again and every job is left
+// failed.
+static bool prepareDrawing(
+    int width, int height, GLuint& vertexBuffer, GLuint& indicesBuffer, RenderTarget* targets) {
+  bool ok = initDrawBuffers(vertexBuffer, indicesBuffer) == EXIT_SUCCESS;
+  for(int i = 0; ok && i < FRAMES_IN_FLIGHT; i++) {
+    ok = createRenderTarget(width, height, targets[i]) == EXIT_SUCCESS;
+  }
+  if(!ok) {
+    std::cerr << "Batch: could not create " << width << "x" << height << " render targets; no job was drawn."
+              << std::endl;
+    releaseDrawing(vertexBuffer, indicesBuffer, targets);
+  }
+  return ok;
+}
+
+void runPipeline(
+    EGLDisplay display,
+    EGLSurface surface,
+    const std::vector<Job>& jobs,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<int>& results) {
+
+  results.assign(jobs.size(), EXIT_FAILURE);
+
+  GLuint vertexBuffer = 0;
+  GLuint indicesBuffer = 0;
+  RenderTarget targets[FRAMES_IN_FLIGHT] = {};
+  if(!prepareDrawing(options.width, options.height, vertexBuffer, indicesBuffer, targets)) {
+    return;
+  }
+
+  EncoderPool encoders(
+      options.encoders, options.depth, options.resultCache, options.pack, options.packKind, jobs, results);
+
+  ProgramCache programs(options.programCacheEntries, options.programCacheBytes);
+  PipelineOptions drawOptions = options;
+  drawOptions.programCache = &programs;
+
+  InFlight inFlight[FRAMES_IN_FLIGHT] = {};
+  for(size_t i = 0; i <= jobs.size(); i++) {
+    size_t slot = i % FRAMES_IN_FLIGHT;
+    size_t previous = (i + FRAMES_IN_FLIGHT - 1) % FRAMES_IN_FLIGHT;
+
+    if(i < jobs.size()) {
+      std::cerr << "Job " << i << ": " << jobs[i].fragment_shader << std::endl;
+      watchdog.arm("compile");
+      glBindFramebuffer(GL_FRAMEBUFFER, targets[slot].framebuffer);
+      GLsync fence = 0;
+      ResultCacheKey cacheKey;
+      int result = drawJob(display, surface, jobs[i], drawOptions, vertexBuffer, watchdog, fence, cacheKey);
+      watchdog.disarm();
+      if(fence != 0) {
+        inFlight[slot].active = true;
+        inFlight[slot].job = i;
+        inFlight[slot].fence = fence;
+        inFlight[slot].cacheKey = cacheKey;
+      } else {
+        results[i] = result;
+      }
+    }
+
+    // The next draw is queued behind the fence, so reading back the previous
+    // frame now overlaps with it.
+    if(inFlight[previous].active) {
+      Frame frame;
+      size_t job = inFlight[previous].job;
+      int result = finishJob(inFlight[previous], targets[previous], options, watchdog, encoders, frame);
+      if(result == EXIT_SUCCESS) {
+        encoders.submit(std::move(frame));
+      } else {
+        results[job] = result;
+      }
+    }
+  }
+
+  encoders.finish();
+  encoders.reportStats();
+  programs.reportStats();
+
+  releaseDrawing(vertexBuffer, indicesBuffer, targets);
+}
+
+namespace {
+
+struct AtlasInFlight {
+  bool active;
+  size_t first;
+  // Which tiles hold a drawn job; the rest are left over from earlier use.
+  std::vector<bool> drawn;
+  // The last fence of the atlas, covering every draw before it.
+  GLsync fence;
+};
+
+}
+
+// Copies one tile out of a bottom-up atlas readback, keeping it bottom-up as
+// a readback of the tile alone would be.
+static void sliceTile(
+    const std::vector<std::uint8_t>& atlas,
+    int atlasWidth,
+    const Tile& tile,
+    int width,
+    int height,
+    std::vector<std::uint8_t>& pixels) {
+  TraceSpan span("slice");
+  const size_t stride = (size_t) width * CHANNELS;
+  const size_t atlasStride = (size_t) atlasWidth * CHANNELS;
+  pixels.resize(stride * height);
+  for(int y = 0; y < height; y++) {
+    std::copy(atlas.begin() + (tile.y + y) * atlasStride + (size_t) tile.x * CHANNELS,
+              atlas.begin() + (tile.y + y) * atlasStride + (size_t) tile.x * CHANNELS + stride,
+              pixels.begin() + y * stride);
+  }
+}
+
+static Tile tileAt(const PipelineOptions& options, size_t index) {
+  Tile tile;
+  tile.x = (int) (index % options.atlasColumns) * options.width;
+  tile.y = (int) (index / options.atlasColumns) * options.height;
+  return tile;
+}
+
+void runAtlasPipeline(
+    EGLDisplay display,
+    EGLSurface surface,
+    const std::vector<Job>& jobs,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<int>& results) {
+
+  results.assign(jobs.size(), EXIT_FAILURE);
+
+  const size_t tiles = (size_t) options.atlasColumns * options.atlasRows;
+  const int atlasWidth = options.atlasColumns * options.width;
+  const int atlasHeight = options.atlasRows * options.height;
+
+  GLuint vertexBuffer = 0;
+  GLuint indicesBuffer = 0;
+  RenderTarget targets[FRAMES_IN_FLIGHT] = {};
+  if(!prepareDrawing(atlasWidth, atlasHeight, vertexBuffer, indicesBuffer, targets)) {
+    return;
+  }
+
+  EncoderPool encoders(
+      options.encoders, options.depth, options.resultCache, options.pack, options.packKind, jobs, results);
+
+  ProgramCache programs(options.programCacheEntries, options.programCacheBytes);
+  PipelineOptions drawOptions = options;
+  drawOptions.programCache = &programs;
+
+  std::vector<std::uint8_t> atlasPixels;
+  size_t atlases = (jobs.size() + tiles - 1) / tiles;
+  AtlasInFlight inFlight[FRAMES_IN_FLIGHT] = {};
+  for(size_t a = 0; a <= atlases; a++) {
+    size_t slot = a % FRAMES_IN_FLIGHT;
+    size_t previous = (a + FRAMES_IN_FLIGHT - 1) % FRAMES_IN_FLIGHT;
+
+    if(a < atlases) {
+      AtlasInFlight& atlas = inFlight[slot];
+      atlas.first = a * tiles;
+      atlas.drawn.assign(tiles, false);
+      atlas.fence = 0;
+      glBindFramebuffer(GL_FRAMEBUFFER, targets[slot].framebuffer);
+      for(size_t t = 0; t < tiles && atlas.first + t < jobs.size(); t++) {
+        size_t i = atlas.first + t;
+        std::cerr << "Job " << i << ": " << jobs[i].fragment_shader << std::endl;
+        Tile tile = tileAt(options, t);
+        watchdog.arm("compile");
+        GLsync fence = 0;
+        ResultCacheKey cacheKey;
+        int result = drawJob(display, surface, jobs[i], drawOptions, vertexBuffer, watchdog, fence, cacheKey, &tile);
+        watchdog.disarm();
+        if(fence != 0) {
+          if(atlas.fence != 0) {
+            glDeleteSync(atlas.fence);
+          }
+          atlas.fence = fence;
+          atlas.drawn[t] = true;
+        } else {
+          results[i] = result;
+        }
+      }
+      atlas.active = atlas.fence != 0;
+    }
+
+    // As in runPipeline, the next atlas is queued behind the fence.
+    AtlasInFlight& done = inFlight[previous];
+    if(done.active) {
+      done.active = false;
+      watchdog.arm("draw");
+      int result = waitForFence(done.fence, watchdog);
+      if(result == EXIT_SUCCESS) {
+        watchdog.setPhase("readback");
+        glBindFramebuffer(GL_FRAMEBUFFER, targets[previous].framebuffer);
+        result = readPixels(atlasWidth, atlasHeight, atlasPixels);
+      }
+      watchdog.disarm();
+      for(size_t t = 0; t < tiles; t++) {
+        if(!done.drawn[t]) {
+          continue;
+        }
+        if(result != EXIT_SUCCESS) {
+          results[done.first + t] = result;
+          continue;
+        }
+        Frame frame;
+        frame.job = done.first + t;
+        frame.width = options.width;
+        frame.height = options.height;
+        frame.pixels = encoders.acquireBuffer();
+        sliceTile(atlasPixels, atlasWidth, tileAt(options, t), options.width, options.height, frame.pixels);
+        encoders.submit(std::move(frame));
+      }
+    }
+  }
+
+  encoders.finish();
+  encoders.reportStats();
+  programs.reportStats();
+  std::cerr << "Atlas: " << atlases << " readbacks of " << atlasWidth << "x" << atlasHeight << " for "
+            << jobs.size() << " jobs." << std::endl;
+
+  releaseDrawing(vertexBuffer, indicesBuffer, targets);
+}
@@ -0,0 +1,45 @@
+#ifndef CPP_PIPELINE_H
+#define CPP_PIPELINE_H
+
+#include "encoder_pool.h"
+#include "renderer.h"
+
+struct PipelineOptions : RenderOptions {
+  // Capacity of the queue between readback and encoding.
+  size_t depth;
+  // Number of PNG encoder/writer threads.
+  size_t encoders;
+  // Where finished frames go instead of one file per job, or NULL.
+  PackWriter* pack;
+  PackKind packKind;
+  // Tiles per atlas, across and down; 0 renders each job on its own.
+  int atlasColumns;
+  int atlasRows;
+};
+
+// Renders jobs with the GL thread (the caller) and the PNG encoders overlapped:
+// job N+1 is compiled and drawn into one offscreen target while job N, fenced
+// in the other, is read back and handed to the encoder pool. results[i] is
+// set to the exit code for jobs[i]. Queue occupancy is reported on stderr.
+void runPipeline(
+    EGLDisplay display,
+    EGLSurface surface,
+    const std::vector<Job>& jobs,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<int>& results);
+
+// runPipeline for atlas mode: jobs are drawn in groups of atlasColumns *
+// atlasRows, each into its own width x height tile of one large target, and
+// each group is read back with a single glReadPixels. The tiles are sliced out
+// into frames for the encoder pool. As in runPipeline, one atlas is drawn
+// while the previous one is read back.
+void runAtlasPipeline(
+    EGLDisplay display,
+    EGLSurface surface,
+    const std::vector<Job>& jobs,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<int>& results);
+
+#endif //CPP_PIPELINE_H
@@ -0,0 +1,121 @@
+#include "arena.h"
+#include "deflate_backend.h"
+#include "lodepng.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Compares the deflate backends on rendered frames: each PNG given is decoded
+// once and re-encoded with every configuration, as writePNG would.
+
+struct Frame {
+  std::string path;
+  std::vector<unsigned char> pixels;
+  unsigned width;
+  unsigned height;
+};
+
+struct Configuration {
+  const DeflateBackend* backend;
+  unsigned level;
+};
+
+static void printUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [--repeat <n>] <frame.png>...\n";
+}
+
+int main(int argc, char* argv[]) {
+
+  long repeat = 5;
+  std::vector<Frame> frames;
+
+  for(int i = 1; i < argc; i++) {
+    std::string curr_arg = std::string(argv[i]);
+    if(curr_arg == "--repeat" && i + 1 < argc) {
+      repeat = std::atol(argv[++i]);
+      continue;
+    }
+    if(curr_arg == "--help") {
+      printUsage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    Frame frame;
+    frame.path = curr_arg;
+    unsigned error = lodepng::decode(frame.pixels, frame.width, frame.height, curr_arg);
+    if(error) {
+      std::cerr << "Error reading " << curr_arg << ": " << lodepng_error_text(error) << std::endl;
+      return EXIT_FAILURE;
+    }
+    frames.push_back(frame);
+  }
+
+  if(frames.empty() || repeat < 1) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t rawBytes = 0;
+  for(const Frame& frame : frames) {
+    rawBytes += frame.pixels.size();
+  }
+
+  std::vector<Configuration> configurations;
+  for(const DeflateBackend& backend : deflateBackends()) {
+    if(backend.deflate) {
+      configurations.push_back({&backend, 0});
+      continue;
+    }
+    for(unsigned level : {0u, 1u, 6u}) {
+      configurations.push_back({&backend, level});
+    }
+  }
+
+  std::printf("%zu frames, %.1f MB of RGBA, %ld repeats\n", frames.size(), rawBytes / 1e6, repeat);
+  std::printf("%-10s %5s %12s %10s %8s\n", "backend", "level", "bytes", "MB/s", "ratio");
+  for(const Configuration& configuration : configurations) {
+    size_t encodedBytes = 0;
+    double seconds = 0;
+    Arena arena;
+    lodepng::Encoder encoder(arena.lodepngAllocator());
+    encoder.encoder.zlibsettings.level = configuration.level;
+    useDeflateBackend(*configuration.backend, encoder.encoder.zlibsettings);
+    for(long r = 0; r < repeat; r++) {
+      for(const Frame& frame : frames) {
+        const unsigned char* png;
+        size_t pngSize;
+        auto start = std::chrono::steady_clock::now();
+        unsigned error = encoder.encode(&png, &pngSize, frame.pixels.data(), frame.width, frame.height);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(error) {
+          std::cerr << "Error encoding " << frame.path << " with " << configuration.backend->name << ": "
+                    << lodepng_error_text(error) << std::endl;
+          return EXIT_FAILURE;
+        }
+        if(r > 0) {
+          continue;
+        }
+        encodedBytes += pngSize;
+        std::vector<unsigned char> decoded;
+        unsigned width, height;
+        if(lodepng::decode(decoded, width, height, png, pngSize) || decoded != frame.pixels) {
+          std::cerr << "Round trip of " << frame.path << " with " << configuration.backend->name
+                    << " does not match" << std::endl;
+          return EXIT_FAILURE;
+        }
+      }
+    }
+    std::printf("%-10s %5u %12zu %10.1f %8.3f\n",
+                configuration.backend->name,
+                configuration.level,
+                encodedBytes,
+                rawBytes * (double) repeat / 1e6 / seconds,
+                (double) encodedBytes / rawBytes);
+  }
+
+  return EXIT_SUCCESS;
+}
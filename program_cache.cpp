@@ -0,0 +1,73 @@
+#include "program_cache.h"
+
+#include "hash.h"
+
+#include <iostream>
+
+ProgramCache::ProgramCache(size_t maxEntries, size_t maxBytes)
+  : maxEntries(maxEntries),
+    maxBytes(maxBytes),
+    bytes(0),
+    hits(0),
+    misses(0),
+    evictions(0) {}
+
+ProgramCache::~ProgramCache() {
+  for(const Entry& entry : entries) {
+    glDeleteProgram(entry.program);
+  }
+}
+
+std::string ProgramCache::key(const std::string& fragContents, const std::string& vertexContents) {
+  return Hasher().update(fragContents).hexDigest() + Hasher().update(vertexContents).hexDigest();
+}
+
+ProgramCache::Entry* ProgramCache::find(const std::string& key) {
+  std::unordered_map<std::string, std::list<Entry>::iterator>::iterator found = byKey.find(key);
+  if(found == byKey.end()) {
+    ++misses;
+    return NULL;
+  }
+  ++hits;
+  entries.splice(entries.begin(), entries, found->second);
+  return &entries.front();
+}
+
+ProgramCache::Entry* ProgramCache::insert(const std::string& key, GLuint program, size_t sourceBytes) {
+  // Drivers without program binaries answer GL_INVALID_ENUM.
+  GLint binaryLength = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+  size_t size = glGetError() == GL_NO_ERROR && binaryLength > 0 ? (size_t) binaryLength : sourceBytes;
+  if(maxEntries == 0 || size > maxBytes || byKey.count(key) > 0) {
+    return NULL;
+  }
+  while(!entries.empty() && (entries.size() >= maxEntries || bytes + size > maxBytes)) {
+    evictLeastRecentlyUsed();
+  }
+  Entry entry;
+  entry.key = key;
+  entry.program = program;
+  entry.bytes = size;
+  entries.push_front(entry);
+  byKey[key] = entries.begin();
+  bytes += size;
+  return &entries.front();
+}
+
+void ProgramCache::evictLeastRecentlyUsed() {
+  const Entry& entry = entries.back();
+  // Deletion is deferred by GL while a queued draw still uses the program.
+  glDeleteProgram(entry.program);
+  bytes -= entry.bytes;
+  byKey.erase(entry.key);
+  entries.pop_back();
+  ++evictions;
+}
+
+void ProgramCache::reportStats() const {
+  if(!enabled()) {
+    return;
+  }
+  std::cerr << "Program cache: " << hits << " hits, " << misses << " misses, " << evictions << " evictions, "
+            << entries.size() << " programs (" << bytes << " bytes) held." << std::endl;
+}
@@ -0,0 +1,67 @@
+#ifndef CPP_PROGRAM_CACHE_H
+#define CPP_PROGRAM_CACHE_H
+
+#include "common.h"
+#include "uniform_state.h"
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Linked programs kept for later jobs with the same shaders, least recently
+// used first out. Entries are keyed by hashes of the fragment and vertex
+// shader sources and carry the program's UniformState, so that a repeat job
+// skips compiling, linking and reflection, and only uploads the uniforms its
+// .json changes.
+//
+// Programs belong to the context that was current when they were linked; a
+// cache must only be used, and destroyed, with that context current.
+class ProgramCache {
+  public:
+    struct Entry {
+      std::string key;
+      GLuint program;
+      size_t bytes;
+      UniformState uniforms;
+    };
+
+    // maxEntries 0 disables the cache. maxBytes limits the estimated size of
+    // the programs held (their binary length where the driver reports one,
+    // otherwise the length of their sources).
+    ProgramCache(size_t maxEntries, size_t maxBytes);
+    ~ProgramCache();
+
+    static std::string key(const std::string& fragContents, const std::string& vertexContents);
+
+    bool enabled() const { return maxEntries > 0; }
+
+    // The entry for key, now the most recently used, or NULL.
+    Entry* find(const std::string& key);
+
+    // Takes ownership of a newly linked program and evicts what no longer
+    // fits. Returns NULL, leaving the program with the caller, if it does not
+    // fit on its own.
+    Entry* insert(const std::string& key, GLuint program, size_t sourceBytes);
+
+    // Hits, misses, evictions and occupancy, on stderr.
+    void reportStats() const;
+
+  private:
+    ProgramCache(const ProgramCache&);
+    ProgramCache& operator=(const ProgramCache&);
+
+    void evictLeastRecentlyUsed();
+
+    const size_t maxEntries;
+    const size_t maxBytes;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> byKey;
+    size_t bytes;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+#endif //CPP_PROGRAM_CACHE_H
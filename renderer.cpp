@@ -0,0 +1,875 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "arena.h"
+#include "diagnostics_cache.h"
+#include "file_util.h"
+#include "lodepng.h"
+#include "result_cache.h"
+#include "trace.h"
+#include "json.hpp"
+using json = nlohmann::json;
+
+#define DELAY (2)
+// Upper bound on a single glClientWaitSync, so the deadline is re-checked often.
+#define FENCE_WAIT_SLICE_MS (50)
+
+static const float vertices[] = {
+  -1.0f,  1.0f,
+  -1.0f, -1.0f,
+   1.0f, -1.0f,
+   1.0f,  1.0f
+};
+
+static const GLubyte indices[] = {
+  0, 1, 2,
+  2, 3, 0
+};
+
+static const char* vertex_shader_wo_version =
+"attribute vec2 vert2d;\n"
+"void main(void) {\n"
+"  gl_Position = vec4(vert2d, 0.0, 1.0);\n"
+"}\n";
+
+static const char* vertex_shader_v300es =
+"in vec3 aVertexPosition;\n"
+"void main(void) {\n"
+"    gl_Position = vec4(aVertexPosition, 1.0);\n"
+"}\n";
+
+bool readFile(const std::string& fileName, std::string& contentsOut) {
+  TraceSpan span("read_file", fileName);
+  std::ifstream ifs(fileName.c_str());
+  if(!ifs) {
+    std::cerr << "File " << fileName << " not found" << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  contentsOut = ss.str();
+  return true;
+}
+
+std::string shaderInfoLog(GLuint shader) {
+  GLint length = 0;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+  if(length <= 0) {
+    return std::string();
+  }
+
+  // The maxLength includes the NULL character
+
+  std::vector<GLchar> errorLog((size_t) length, 0);
+
+  glGetShaderInfoLog(shader, length, &length, &errorLog[0]);
+  return std::string(&errorLog[0], (size_t) length);
+}
+
+std::string programInfoLog(GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+  if(length <= 0) {
+    return std::string();
+  }
+
+  // The maxLength includes the NULL character
+
+  std::vector<GLchar> errorLog((size_t) length, 0);
+
+  glGetProgramInfoLog(program, length, &length, &errorLog[0]);
+  return std::string(&errorLog[0], (size_t) length);
+}
+
+void printShaderError(GLuint shader) {
+  std::string s = shaderInfoLog(shader);
+  if(s.length() > 0) {
+    std::cout << s << std::endl;
+  }
+}
+
+void printProgramError(GLuint program) {
+  std::string s = programInfoLog(program);
+  if(s.length() > 0) {
+    std::cout << s << std::endl;
+  }
+}
+
+int checkForGLError(const char loc[]) {
+  GLenum res = glGetError();
+  if(res != GL_NO_ERROR) {
+    std::cerr << loc << ": glGetError: " << std::hex << res << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+static void reportContextReset() {
+  PFNGLGETGRAPHICSRESETSTATUSEXTPROC getGraphicsResetStatus =
+      (PFNGLGETGRAPHICSRESETSTATUSEXTPROC) eglGetProcAddress("glGetGraphicsResetStatusEXT");
+  if(getGraphicsResetStatus == NULL) {
+    return;
+  }
+  switch(getGraphicsResetStatus()) {
+    case GL_NO_ERROR:
+      break;
+    case GL_GUILTY_CONTEXT_RESET_EXT:
+      std::cerr << "Context was reset (guilty)." << std::endl;
+      break;
+    case GL_INNOCENT_CONTEXT_RESET_EXT:
+      std::cerr << "Context was reset (innocent)." << std::endl;
+      break;
+    default:
+      std::cerr << "Context was reset (unknown cause)." << std::endl;
+      break;
+  }
+}
+
+int waitForFence(GLsync fence, Watchdog& watchdog) {
+  TraceSpan span("wait_gpu");
+  // Only the first wait needs to flush; later slices just keep waiting.
+  GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  for(;;) {
+    long remaining = watchdog.enabled() ? watchdog.remainingMs() : FENCE_WAIT_SLICE_MS;
+    if(remaining <= 0) {
+      reportContextReset();
+      watchdog.expire();
+    }
+    long slice = remaining < FENCE_WAIT_SLICE_MS ? remaining : FENCE_WAIT_SLICE_MS;
+    GLenum status = glClientWaitSync(fence, flags, (GLuint64) slice * 1000000);
+    flags = 0;
+    if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      break;
+    }
+    if(status == GL_WAIT_FAILED) {
+      checkForGLError("After glClientWaitSync");
+      glDeleteSync(fence);
+      return EXIT_FAILURE;
+    }
+  }
+  glDeleteSync(fence);
+  return EXIT_SUCCESS;
+}
+
+int waitForRender(Watchdog& watchdog) {
+  GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  CHECK_ERROR("After glFenceSync");
+  return waitForFence(fence, watchdog);
+}
+
+int render(
+    EGLDisplay display,
+    EGLSurface surface,
+    int width,
+    int height,
+    bool animate,
+    int numFrames,
+    bool& saved,
+    const std::string& output,
+    GLint resolutionLocation,
+    GLint timeLocation,
+    Watchdog& watchdog,
+    const Tile* tile) {
+
+  TraceSpan span("render");
+  if(tile != NULL) {
+    glViewport(tile->x, tile->y, width, height);
+    glScissor(tile->x, tile->y, width, height);
+    glEnable(GL_SCISSOR_TEST);
+  } else {
+    glViewport(0, 0, width, height);
+    glDisable(GL_SCISSOR_TEST);
+  }
+  CHECK_ERROR("After glViewport");
+
+  if(resolutionLocation != -1) {
+    glUniform2f(resolutionLocation, width, height);
+    CHECK_ERROR("After glUniform2f");
+  }
+
+  if(animate && timeLocation != -1 && numFrames > DELAY) {
+    glUniform1f(timeLocation, numFrames / 10.0f);
+    CHECK_ERROR("After glUniform1f");
+  }
+
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  CHECK_ERROR("After glClearColor");
+  glClear(GL_COLOR_BUFFER_BIT);
+  CHECK_ERROR("After glClear");
+
+  watchdog.setPhase("draw");
+  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0);
+  CHECK_ERROR("After glDrawElements");
+
+  glFlush();
+  CHECK_ERROR("After glFlush");
+
+  eglSwapBuffers(display, surface);
+  CHECK_ERROR("After swapBuffers");
+
+  return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Initialisation of uniforms
+
+template<typename T>
+T *getArray(const json& j) {
+  T *a = new T[j.size()];
+  for (unsigned int i = 0; i < j.size(); i++) {
+    a[i] = j[i];
+  }
+  return a;
+}
+
+#define GLUNIFORM_ARRAYINIT(funcname, uniformloc, gltype, jsonarray) \
+  gltype *a = getArray<gltype>(jsonarray); \
+  funcname(uniformloc, jsonarray.size(), a); \
+  delete [] a
+
+static void setJSONDefaultEntries(json& j) {
+
+  if (j.count("injectionSwitch") == 0) {
+    std::cerr << "Warning: uniform injectionSwitch not found in JSON, using default value" << std::endl;
+    j["injectionSwitch"] = {
+      {"func", "glUniform2f"},
+      { "args", { 0.0f, 1.0f }}
+    };
+  }
+
+  if (j.count("time") == 0) {
+    std::cerr << "Warning: uniform time not found in JSON, using default value" << std::endl;
+    j["time"] = {
+      {"func", "glUniform1f"},
+      { "args", { 0.0f }}
+    };
+  }
+
+
+  if (j.count("mouse") == 0) {
+    std::cerr << "Warning: uniform mouse not found in JSON, using default value" << std::endl;
+    j["mouse"] = {
+      {"func", "glUniform2f"},
+      { "args", { 0.0f, 0.0f }}
+    };
+  }
+
+  if (j.count("resolution") == 0) {
+    std::cerr << "Warning: uniform resolution not found in JSON, using default value" << std::endl;
+    j["resolution"] = {
+      {"func", "glUniform2f"},
+      { "args", { float(WIDTH), float(HEIGHT) }}
+    };
+  }
+
+}
+
+bool readUniformValues(const std::string& fragment_shader, json& uniforms) {
+  std::string jsonFilename(fragment_shader);
+  jsonFilename.replace(jsonFilename.end()-4, jsonFilename.end(), "json");
+  std::string jsonContent;
+  if (!readFile(jsonFilename, jsonContent)) {
+    return false;
+  }
+  uniforms = json::parse(jsonContent);
+
+  setJSONDefaultEntries(uniforms);
+  return true;
+}
+
+int setUniform(GLint uniformLocation, const std::string& uniformName, const json& uniformInfo) {
+  // Check presence of func and args entries
+  if (uniformInfo.find("func") == uniformInfo.end()) {
+    std::cerr << "Error: malformed JSON: no \"func\" entry for uniform: " << uniformName << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (uniformInfo.find("args") == uniformInfo.end()) {
+    std::cerr << "Error: malformed JSON: no \"args\" entry for uniform: " << uniformName << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Dispatch to matching init function
+  std::string uniformFunc = uniformInfo["func"];
+  json args = uniformInfo["args"];
+
+  // TODO: check that args has the good number of fields and type
+
+  if (uniformFunc == "glUniform1f") {
+    glUniform1f(uniformLocation, args[0]);
+  } else if (uniformFunc == "glUniform2f") {
+    glUniform2f(uniformLocation, args[0], args[1]);
+  } else if (uniformFunc == "glUniform3f") {
+    glUniform3f(uniformLocation, args[0], args[1], args[2]);
+  } else if (uniformFunc == "glUniform4f") {
+    glUniform4f(uniformLocation, args[0], args[1], args[2], args[3]);
+  }
+
+  else if (uniformFunc == "glUniform1i") {
+    glUniform1i(uniformLocation, args[0]);
+  } else if (uniformFunc == "glUniform2i") {
+    glUniform2i(uniformLocation, args[0], args[1]);
+  } else if (uniformFunc == "glUniform3i") {
+    glUniform3i(uniformLocation, args[0], args[1], args[2]);
+  } else if (uniformFunc == "glUniform4i") {
+    glUniform4i(uniformLocation, args[0], args[1], args[2], args[3]);
+  }
+
+  // Note: no "glUniformXui" variant in OpenGL ES
+
+  // else if (uniformFunc == "glUniform1ui") {
+  //   glUniform1ui(uniformLocation, args[0]);
+  // } else if (uniformFunc == "glUniform2ui") {
+  //   glUniform2ui(uniformLocation, args[0], args[1]);
+  // } else if (uniformFunc == "glUniform3ui") {
+  //   glUniform3ui(uniformLocation, args[0], args[1], args[2]);
+  // } else if (uniformFunc == "glUniform4ui") {
+  //   glUniform4ui(uniformLocation, args[0], args[1], args[2], args[3]);
+  // }
+
+  else if (uniformFunc == "glUniform1fv") {
+    GLUNIFORM_ARRAYINIT(glUniform1fv, uniformLocation, GLfloat, args);
+  } else if (uniformFunc == "glUniform2fv") {
+    GLUNIFORM_ARRAYINIT(glUniform2fv, uniformLocation, GLfloat, args);
+  } else if (uniformFunc == "glUniform3fv") {
+    GLUNIFORM_ARRAYINIT(glUniform3fv, uniformLocation, GLfloat, args);
+  } else if (uniformFunc == "glUniform4fv") {
+    GLUNIFORM_ARRAYINIT(glUniform4fv, uniformLocation, GLfloat, args);
+  }
+
+  else if (uniformFunc == "glUniform1iv") {
+    GLUNIFORM_ARRAYINIT(glUniform1iv, uniformLocation, GLint, args);
+  } else if (uniformFunc == "glUniform2iv") {
+    GLUNIFORM_ARRAYINIT(glUniform2iv, uniformLocation, GLint, args);
+  } else if (uniformFunc == "glUniform3iv") {
+    GLUNIFORM_ARRAYINIT(glUniform3iv, uniformLocation, GLint, args);
+  } else if (uniformFunc == "glUniform4iv") {
+    GLUNIFORM_ARRAYINIT(glUniform4iv, uniformLocation, GLint, args);
+  }
+
+  else {
+    std::cerr << "Error: unknown/unsupported uniform init func: " << uniformFunc << std::endl;
+    return EXIT_FAILURE;
+  }
+  CHECK_ERROR("After uniform initialisation");
+
+  return EXIT_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+// Per-job stages, shared by the single-shader and batch paths
+
+static std::string embeddedVertexShader(const std::string& fragContents) {
+  std::stringstream ss;
+  size_t i = fragContents.find('\n');
+  if(i != std::string::npos && fragContents[0] == '#') {
+    ss << fragContents.substr(0,i);
+    ss << "\n";
+  } else {
+    std::cerr << "Warning: Could not find #version string of fragment shader." << std::endl;
+  }
+  // the vertex shader is different for versio 300 es
+  i = fragContents.find("300");
+  if (i != std::string::npos) {
+      ss << vertex_shader_v300es;
+  } else {
+      ss << vertex_shader_wo_version;
+  }
+  return ss.str();
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool readVertexShader(
+    const std::string& fragContents,
+    const std::string& vertex_shader,
+    std::string& vertexContents) {
+  if(vertex_shader.length() == 0) {
+    // Use embedded vertex shader.
+    vertexContents = embeddedVertexShader(fragContents);
+    return true;
+  }
+  return readFile(vertex_shader, vertexContents);
+}
+
+// Reports a failure remembered by the diagnostics cache as if the driver had
+// just produced it.
+static int cachedBuildFailure(int exitCode, const std::string& infoLog, BuildReport* report) {
+  std::cerr << (exitCode == COMPILE_ERROR_EXIT_CODE ? "Error compiling fragment shader" : "Error in linking program")
+            << " (cached)." << std::endl;
+  if(infoLog.length() > 0 && report == NULL) {
+    std::cout << infoLog << std::endl;
+  }
+  if(report != NULL) {
+    report->infoLog = infoLog;
+    report->cached = true;
+  }
+  return exitCode;
+}
+
+int buildProgram(
+    const std::string& fragContents,
+    const std::string& vertex_shader,
+    BuildStage stopAfter,
+    GLuint& program,
+    Watchdog& watchdog,
+    BuildReport* report,
+    const DiagnosticsCache* diagnostics) {
+
+  program = 0;
+  std::string vertexContents;
+  bool haveVertexContents = false;
+  BuildFailureKey compileKey;
+  BuildFailureKey linkKey;
+  if(diagnostics != NULL) {
+    int cachedExitCode;
+    std::string cachedLog;
+    compileKey = compileFailureKey(*diagnostics, fragContents);
+    if(lookupBuildFailure(*diagnostics, compileKey, cachedExitCode, cachedLog)) {
+      return cachedBuildFailure(cachedExitCode, cachedLog, report);
+    }
+    if(stopAfter != BUILD_COMPILE) {
+      if(!readVertexShader(fragContents, vertex_shader, vertexContents)) {
+        return EXIT_FAILURE;
+      }
+      haveVertexContents = true;
+      linkKey = linkFailureKey(*diagnostics, fragContents, vertexContents);
+      if(lookupBuildFailure(*diagnostics, linkKey, cachedExitCode, cachedLog)) {
+        return cachedBuildFailure(cachedExitCode, cachedLog, report);
+      }
+    }
+  }
+
+  program = glCreateProgram();
+  int compileOk = 0;
+  const char* temp;
+
+  watchdog.setPhase("compile");
+  auto start = std::chrono::steady_clock::now();
+  temp = fragContents.c_str();
+  GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(fragmentShader, 1, &temp, NULL);
+  traceBegin("compile");
+  glCompileShader(fragmentShader);
+  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &compileOk);
+  traceEnd("compile");
+  if(report != NULL) {
+    report->compileMs = millisecondsSince(start);
+    report->infoLog = shaderInfoLog(fragmentShader);
+  }
+  if (!compileOk) {
+    std::cerr << "Error compiling fragment shader." << std::endl;
+    // With a report the log goes to the caller instead: stdout may be
+    // carrying its records.
+    if(report == NULL) {
+      printShaderError(fragmentShader);
+    }
+    if(diagnostics != NULL) {
+      storeBuildFailure(*diagnostics, compileKey, COMPILE_ERROR_EXIT_CODE, shaderInfoLog(fragmentShader));
+    }
+    glDeleteShader(fragmentShader);
+    return COMPILE_ERROR_EXIT_CODE;
+  }
+  std::cerr << "Fragment shader compiled successfully." << std::endl;
+  glAttachShader(program, fragmentShader);
+  // Flagged for deletion; it goes away with the program.
+  glDeleteShader(fragmentShader);
+  if (stopAfter == BUILD_COMPILE) {
+    return EXIT_SUCCESS;
+  }
+
+  if(!haveVertexContents && !readVertexShader(fragContents, vertex_shader, vertexContents)) {
+    return EXIT_FAILURE;
+  }
+
+  start = std::chrono::steady_clock::now();
+  GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+  temp = vertexContents.c_str();
+  glShaderSource(vertexShader, 1, &temp, NULL);
+  traceBegin("compile_vertex");
+  glCompileShader(vertexShader);
+  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &compileOk);
+  traceEnd("compile_vertex");
+  if (!compileOk) {
+    std::cerr << "Error compiling vertex shader." << std::endl;
+    if(report == NULL) {
+      printShaderError(vertexShader);
+    }
+    if(report != NULL) {
+      report->infoLog = shaderInfoLog(vertexShader);
+    }
+    glDeleteShader(vertexShader);
+    return EXIT_FAILURE;
+  }
+  std::cerr << "Vertex shader compiled successfully." << std::endl;
+
+  glAttachShader(program, vertexShader);
+  glDeleteShader(vertexShader);
+
+  std::cerr << "Linking program." << std::endl;
+  watchdog.setPhase("link");
+  traceBegin("link");
+  glLinkProgram(program);
+  glGetProgramiv(program, GL_LINK_STATUS, &compileOk);
+  traceEnd("link");
+  if(report != NULL) {
+    // Includes compiling the vertex shader, which is part of getting a
+    // linked program.
+    report->linkMs = millisecondsSince(start);
+    std::string linkLog = programInfoLog(program);
+    if(!compileOk || linkLog.length() > 0) {
+      report->infoLog = linkLog;
+    }
+  }
+  if (!compileOk) {
+    std::cerr << "Error in linking program." << std::endl;
+    if(report == NULL) {
+      printProgramError(program);
+    }
+    if(diagnostics != NULL) {
+      storeBuildFailure(*diagnostics, linkKey, LINK_ERROR_EXIT_CODE, programInfoLog(program));
+    }
+    return LINK_ERROR_EXIT_CODE;
+  }
+  std::cerr << "Program linked successfully." << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+std::string atlasShaderSource(const std::string& fragContents) {
+  if(fragContents.find("gl_FragCoord") == std::string::npos) {
+    return fragContents;
+  }
+  // The declaration goes after the leading #version, #extension, comment and
+  // blank lines, as #extension must come before anything else, but before
+  // any other directive: inside an #if it would only exist on one branch.
+  // #line keeps the line numbers of info logs.
+  size_t insert = 0;
+  size_t line = 1;
+  while(insert < fragContents.length()) {
+    size_t end = fragContents.find('\n', insert);
+    std::string text = fragContents.substr(insert, end == std::string::npos ? std::string::npos : end - insert);
+    size_t first = text.find_first_not_of(" \t\r");
+    if(first != std::string::npos && text.compare(first, 2, "//") != 0) {
+      if(text[first] != '#') {
+        break;
+      }
+      size_t directive = text.find_first_not_of(" \t", first + 1);
+      if(directive == std::string::npos ||
+         (text.compare(directive, 7, "version") != 0 && text.compare(directive, 9, "extension") != 0)) {
+        break;
+      }
+    }
+    if(end == std::string::npos) {
+      insert = fragContents.length();
+      break;
+    }
+    insert = end + 1;
+    line++;
+  }
+  std::ostringstream ss;
+  ss << fragContents.substr(0, insert);
+  if(insert > 0 && fragContents[insert - 1] != '\n') {
+    ss << "\n";
+  }
+  // The offset has the precision of gl_FragCoord itself, so that expressions
+  // using it are evaluated as they were.
+  ss << "#if __VERSION__ > 100\n"
+     << "uniform highp vec2 " ATLAS_OFFSET_UNIFORM ";\n"
+     << "#else\n"
+     << "uniform mediump vec2 " ATLAS_OFFSET_UNIFORM ";\n"
+     << "#endif\n"
+     << "#define gl_FragCoord (gl_FragCoord - vec4(" ATLAS_OFFSET_UNIFORM ", 0.0, 0.0))\n"
+     << "#line " << line << "\n"
+     << fragContents.substr(insert);
+  return ss.str();
+}
+
+int initDrawBuffers(GLuint& vertexBuffer, GLuint& indicesBuffer) {
+  glGenBuffers(1, &vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+  glGenBuffers(1, &indicesBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indicesBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+  CHECK_ERROR("After initDrawBuffers");
+
+  return EXIT_SUCCESS;
+}
+
+int prepareProgram(
+    GLuint program,
+    const std::string& fragment_shader,
+    GLuint vertexBuffer,
+    UniformState& uniforms,
+    Watchdog& watchdog,
+    const Tile* tile) {
+
+  GLint posAttribLocationAttempt = glGetAttribLocation(program, "vert2d");
+  if(posAttribLocationAttempt == -1) {
+    std::cerr << "Error getting vert2d attribute location." << std::endl;
+    return EXIT_FAILURE;
+  }
+  GLuint posAttribLocation = (GLuint) posAttribLocationAttempt;
+  glEnableVertexAttribArray(posAttribLocation);
+
+  glUseProgram(program);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glVertexAttribPointer(posAttribLocation, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+  // Every active uniform must have an entry in the .json (defaults included),
+  // so all of them are set here.
+  watchdog.setPhase("uniforms");
+  TraceSpan span("setUniforms");
+  if(uniforms.reflect(program) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if(uniforms.size() > 0) {
+    json values;
+    if(!readUniformValues(fragment_shader, values)) {
+      return EXIT_FAILURE;
+    }
+    if(tile != NULL) {
+      values[ATLAS_OFFSET_UNIFORM] = {
+        {"func", "glUniform2f"},
+        {"args", {float(tile->x), float(tile->y)}}
+      };
+    }
+    if(uniforms.setAll(values) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+  }
+  std::cerr << "Uniforms set successfully." << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+int createRenderTarget(int width, int height, RenderTarget& target) {
+  glGenRenderbuffers(1, &target.renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, target.renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  CHECK_ERROR("After glRenderbufferStorage");
+
+  glGenFramebuffers(1, &target.framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.renderbuffer);
+  if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Render target framebuffer is incomplete." << std::endl;
+    return EXIT_FAILURE;
+  }
+  CHECK_ERROR("After createRenderTarget");
+
+  return EXIT_SUCCESS;
+}
+
+void destroyRenderTarget(RenderTarget& target) {
+  glDeleteFramebuffers(1, &target.framebuffer);
+  glDeleteRenderbuffers(1, &target.renderbuffer);
+  target.framebuffer = 0;
+  target.renderbuffer = 0;
+}
+
+int drawJob(
+    EGLDisplay display,
+    EGLSurface surface,
+    const Job& job,
+    const RenderOptions& options,
+    GLuint vertexBuffer,
+    Watchdog& watchdog,
+    GLsync& fence,
+    ResultCacheKey& cacheKey,
+    const Tile* tile) {
+
+  fence = 0;
+  cacheKey = ResultCacheKey();
+  TraceSpan span("draw_job", job.fragment_shader);
+
+  if(options.resultCache.length() > 0 && options.stopAfter == BUILD_ALL) {
+    ResultCacheKey key;
+    if(renderCacheKey(job, options, key)) {
+      if(fetchCachedResult(options.resultCache, key, job.output)) {
+        return EXIT_SUCCESS;
+      }
+      cacheKey = key;
+    }
+  }
+
+  std::string fragContents;
+  if(!readFile(job.fragment_shader, fragContents)) {
+    return EXIT_FAILURE;
+  }
+  if(tile != NULL) {
+    fragContents = atlasShaderSource(fragContents);
+  }
+
+  DiagnosticsCache diagnostics;
+  diagnostics.dir = options.diagnosticsCache;
+  diagnostics.driverIdentity = options.driverIdentity;
+
+  // A program linked for an earlier job with the same sources is used as is.
+  ProgramCache* programCache =
+      options.programCache != NULL && options.programCache->enabled() && options.stopAfter == BUILD_ALL
+          ? options.programCache : NULL;
+  std::string programKey;
+  std::string vertexContents;
+  ProgramCache::Entry* cached = NULL;
+  if(programCache != NULL) {
+    if(!readVertexShader(fragContents, options.vertex_shader, vertexContents)) {
+      return EXIT_FAILURE;
+    }
+    programKey = ProgramCache::key(fragContents, vertexContents);
+    cached = programCache->find(programKey);
+  }
+
+  GLuint program = 0;
+  UniformState localUniforms;
+  UniformState* uniforms = &localUniforms;
+  int result = EXIT_SUCCESS;
+  if(cached != NULL) {
+    std::cerr << "Reusing linked program." << std::endl;
+    program = cached->program;
+    uniforms = &cached->uniforms;
+  } else {
+    result = buildProgram(fragContents, options.vertex_shader, options.stopAfter, program, watchdog, NULL,
+                          diagnostics.dir.length() > 0 ? &diagnostics : NULL);
+    if(result != EXIT_SUCCESS || options.stopAfter != BUILD_ALL) {
+      glDeleteProgram(program);
+      return result;
+    }
+    if(programCache != NULL) {
+      cached = programCache->insert(programKey, program, fragContents.length() + vertexContents.length());
+      if(cached != NULL) {
+        uniforms = &cached->uniforms;
+      }
+    }
+  }
+
+  result = prepareProgram(program, job.fragment_shader, vertexBuffer, *uniforms, watchdog, tile);
+  if(result == EXIT_SUCCESS) {
+    bool saved = false;
+    result = render(display, surface, options.width, options.height, options.animate, 0, saved, job.output,
+                    uniforms->location("resolution"), uniforms->location("time"), watchdog, tile);
+    // render sets the resolution itself.
+    uniforms->invalidate("resolution");
+  }
+  if(result == EXIT_SUCCESS) {
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    CHECK_ERROR("After glFenceSync");
+  }
+  // Deletion is deferred by GL until the draw no longer needs the program.
+  if(cached == NULL) {
+    glDeleteProgram(program);
+  }
+  return result == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int renderJob(
+    EGLDisplay display,
+    EGLSurface surface,
+    const Job& job,
+    const RenderOptions& options,
+    GLuint vertexBuffer,
+    Watchdog& watchdog,
+    std::vector<std::uint8_t>& pixels) {
+
+  GLsync fence = 0;
+  ResultCacheKey cacheKey;
+  int result = drawJob(display, surface, job, options, vertexBuffer, watchdog, fence, cacheKey);
+  if(fence == 0) {
+    return result;
+  }
+  result = waitForFence(fence, watchdog);
+  if(result != EXIT_SUCCESS) {
+    return result;
+  }
+  watchdog.setPhase("readback");
+  result = readPixels(options.width, options.height, pixels);
+  if(result != EXIT_SUCCESS) {
+    return result;
+  }
+  watchdog.setPhase("encode");
+  result = writePNG(job.output, pixels, (unsigned) options.width, (unsigned) options.height);
+  if(result == EXIT_SUCCESS && cacheKey.name.length() > 0) {
+    storeCachedResult(options.resultCache, cacheKey, job.output, pixels);
+  }
+  return result;
+}
+
+int readPixels(int width, int height, std::vector<std::uint8_t>& data) {
+  TraceSpan span("readback");
+  data.resize((size_t) width * height * CHANNELS);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
+  CHECK_ERROR("After glReadPixels");
+  return EXIT_SUCCESS;
+}
+
+static unsigned pngCompressionLevel = 0;
+
+void setPNGCompressionLevel(unsigned level) {
+  pngCompressionLevel = level;
+}
+
+static const DeflateBackend* pngDeflateBackend = NULL;
+
+void setPNGDeflateBackend(const DeflateBackend& backend) {
+  pngDeflateBackend = &backend;
+}
+
+void flipRows(std::vector<std::uint8_t>& data, unsigned width, unsigned height) {
+  TraceSpan span("flip");
+  const size_t stride = (size_t) width * CHANNELS;
+  for (unsigned int h = 0; h < height / 2; h++)
+    std::swap_ranges(data.begin() + h * stride, data.begin() + (h + 1) * stride,
+                     data.begin() + (height - h - 1) * stride);
+}
+
+int encodePNG(
+    const std::vector<std::uint8_t>& data,
+    unsigned width,
+    unsigned height,
+    const unsigned char** png,
+    size_t* pngSize) {
+  // One encoder per thread (the main one or an encoder pool worker), so that
+  // a batch reuses its buffers, and the arena its scratch memory, from frame
+  // to frame. The arena is declared first so that it outlives the encoder.
+  static thread_local Arena arena;
+  static thread_local lodepng::Encoder encoder(arena.lodepngAllocator());
+  encoder.encoder.zlibsettings.level = pngCompressionLevel;
+  if (pngDeflateBackend) {
+    useDeflateBackend(*pngDeflateBackend, encoder.encoder.zlibsettings);
+  }
+  encoder.encoder.stage_callback = tracing() ? traceEncoderStage : NULL;
+  TraceSpan span("encode");
+  unsigned png_error = encoder.encode(png, pngSize, data.data(), width, height);
+  if (png_error) {
+    std::cerr << "Error producing PNG file: " << lodepng_error_text(png_error) << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int writePNG(const std::string& output, std::vector<std::uint8_t>& data, unsigned width, unsigned height) {
+  flipRows(data, width, height);
+  const unsigned char* png;
+  size_t pngSize;
+  if (encodePNG(data, width, height, &png, &pngSize) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  // Replace rather than overwrite: output may be a hard link into the result
+  // cache.
+  TraceSpan span("write_file", output);
+  if (!writeFileAtomic(output, png, pngSize)) {
+    std::cerr << "Error writing PNG file " << output << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+#ifndef CPP_RENDERER_H
+#define CPP_RENDERER_H
+
+#include "common.h"
+#include "deflate_backend.h"
+#include "diagnostics_cache.h"
+#include "job.h"
+#include "program_cache.h"
+#include "uniform_state.h"
+#include "watchdog.h"
+
+#include "json.hpp"
+
+#include <cstdint>		// uint8_t, etc
+#include <string>
+#include <vector>
+
+struct ResultCacheKey;
+
+static const int WIDTH = 256;
+static const int HEIGHT = 256;
+
+#define COMPILE_ERROR_EXIT_CODE (101)
+#define LINK_ERROR_EXIT_CODE (102)
+#define RENDER_ERROR_EXIT_CODE (103)
+#define TIMEOUT_EXIT_CODE (104)
+// The render process died (e.g. a driver segfault); only reported by the
+// process that forked it.
+#define CRASH_EXIT_CODE (105)
+
+#define CHANNELS (4)
+
+// How far buildProgram should go before returning.
+enum BuildStage {
+  BUILD_COMPILE,
+  BUILD_LINK,
+  BUILD_ALL
+};
+
+// Per-render settings shared by every mode.
+struct RenderOptions {
+  std::string vertex_shader;
+  BuildStage stopAfter;
+  bool animate;
+  int width;
+  int height;
+  // Result cache directory, or empty; see result_cache.h.
+  std::string resultCache;
+  // Diagnostics cache directory, or empty; see diagnostics_cache.h.
+  std::string diagnosticsCache;
+  // driverIdentity() of the current context, part of every cache key.
+  std::string driverIdentity;
+  // Limits of the ProgramCache each rendering context keeps; 0 entries
+  // disables it.
+  size_t programCacheEntries;
+  size_t programCacheBytes;
+  // That context's cache, set by whoever owns it; NULL to build every
+  // program afresh.
+  ProgramCache* programCache;
+};
+
+// Where a job is drawn within a larger target, in atlas mode: its viewport
+// and scissor start at (x, y), and shaders that read gl_FragCoord get it
+// relative to that corner (see atlasShaderSource).
+struct Tile {
+  int x;
+  int y;
+};
+
+// The uniform atlasShaderSource declares for the tile's corner.
+#define ATLAS_OFFSET_UNIFORM "getImageAtlasOffset"
+
+// An offscreen colour target, so several frames can be in flight at once.
+struct RenderTarget {
+  GLuint framebuffer;
+  GLuint renderbuffer;
+};
+
+bool readFile(const std::string& fileName, std::string& contentsOut);
+
+std::string shaderInfoLog(GLuint shader);
+
+std::string programInfoLog(GLuint program);
+
+void printShaderError(GLuint shader);
+
+void printProgramError(GLuint program);
+
+int checkForGLError(const char loc[]);
+
+#define CHECK_ERROR(loc) \
+do { \
+  if(checkForGLError(loc) == EXIT_FAILURE) { \
+    return EXIT_FAILURE; \
+  } \
+} while(false)
+
+// What buildProgram did, for machine-readable reports.
+struct BuildReport {
+  double compileMs;
+  // Vertex shader compile plus link; 0 if the program was not linked.
+  double linkMs;
+  // The log of the last stage that produced one (or failed).
+  std::string infoLog;
+  // The failure came from the diagnostics cache.
+  bool cached;
+};
+
+// Compiles the fragment shader and the given (or embedded) vertex shader and
+// links them into a new program. Returns EXIT_SUCCESS, EXIT_FAILURE,
+// COMPILE_ERROR_EXIT_CODE or LINK_ERROR_EXIT_CODE. Info logs of failures are
+// printed on stdout, unless a report is given to hold them. With diagnostics,
+// known failures are answered from the cache (leaving program 0) and new ones
+// are added to it.
+int buildProgram(
+    const std::string& fragContents,
+    const std::string& vertex_shader,
+    BuildStage stopAfter,
+    GLuint& program,
+    Watchdog& watchdog,
+    BuildReport* report = NULL,
+    const DiagnosticsCache* diagnostics = NULL);
+
+// Creates the full-screen quad buffers; done once per context.
+int initDrawBuffers(GLuint& vertexBuffer, GLuint& indicesBuffer);
+
+// Reads the uniform values next to fragment_shader (foo.frag -> foo.json),
+// filling in defaults for the usual uniforms it leaves out.
+bool readUniformValues(const std::string& fragment_shader, nlohmann::json& uniforms);
+
+// Uploads one {"func": "glUniform2f", "args": [...]} entry of that file to
+// the current program.
+int setUniform(GLint location, const std::string& name, const nlohmann::json& info);
+
+// Makes program current, binds the quad and sets all uniforms from the
+// shader's .json file through uniforms, which reflects program first if it
+// has not yet. Values uniforms already holds are not uploaded again. With a
+// tile, its corner goes to ATLAS_OFFSET_UNIFORM too.
+int prepareProgram(
+    GLuint program,
+    const std::string& fragment_shader,
+    GLuint vertexBuffer,
+    UniformState& uniforms,
+    Watchdog& watchdog,
+    const Tile* tile = NULL);
+
+// fragContents with gl_FragCoord made relative to ATLAS_OFFSET_UNIFORM, so
+// the shader draws the same picture wherever its tile is. Shaders that do not
+// read gl_FragCoord are returned as they are.
+std::string atlasShaderSource(const std::string& fragContents);
+
+int createRenderTarget(int width, int height, RenderTarget& target);
+
+void destroyRenderTarget(RenderTarget& target);
+
+// Waits for fence in bounded slices and deletes it. Expires the watchdog if
+// its budget runs out first.
+int waitForFence(GLsync fence, Watchdog& watchdog);
+
+// Waits for all commands issued so far, bounded by the watchdog budget.
+int waitForRender(Watchdog& watchdog);
+
+int render(
+    EGLDisplay display,
+    EGLSurface surface,
+    int width,
+    int height,
+    bool animate,
+    int numFrames,
+    bool& saved,
+    const std::string& output,
+    GLint resolutionLocation,
+    GLint timeLocation,
+    Watchdog& watchdog,
+    const Tile* tile = NULL);
+
+// Builds and draws one job into the currently bound framebuffer, then fences
+// it. Returns EXIT_SUCCESS with a fence to wait on, or the job's exit code
+// (EXIT_SUCCESS without a fence if options stop before drawing, or the
+// output came from the result cache). cacheKey is set when the finished
+// frame should be stored in the cache. With a tile, the job is drawn into
+// that part of the framebuffer only.
+int drawJob(
+    EGLDisplay display,
+    EGLSurface surface,
+    const Job& job,
+    const RenderOptions& options,
+    GLuint vertexBuffer,
+    Watchdog& watchdog,
+    GLsync& fence,
+    ResultCacheKey& cacheKey,
+    const Tile* tile = NULL);
+
+// drawJob, then wait, read back into pixels and write the PNG.
+int renderJob(
+    EGLDisplay display,
+    EGLSurface surface,
+    const Job& job,
+    const RenderOptions& options,
+    GLuint vertexBuffer,
+    Watchdog& watchdog,
+    std::vector<std::uint8_t>& pixels);
+
+int readPixels(int width, int height, std::vector<std::uint8_t>& data);
+
+// Deflate level used by writePNG for the rest of the process (see
+// LodePNGCompressSettings::level); 0, the default, keeps lodepng's classic
+// match finder. Set it before any encoder threads or workers start.
+void setPNGCompressionLevel(unsigned level);
+
+// Deflate backend used by writePNG for the rest of the process; lodepng's own
+// by default. Set it before any encoder threads or workers start.
+void setPNGDeflateBackend(const DeflateBackend& backend);
+
+// Turns a bottom-up GL readback into top-down rows, in place.
+void flipRows(std::vector<std::uint8_t>& data, unsigned width, unsigned height);
+
+// Encodes top-down RGBA with this thread's encoder. *png stays valid until
+// the thread's next call.
+int encodePNG(
+    const std::vector<std::uint8_t>& data,
+    unsigned width,
+    unsigned height,
+    const unsigned char** png,
+    size_t* pngSize);
+
+// Flips a bottom-up GL readback into a top-down PNG and writes it. The rows
+// of data are flipped in place rather than copied.
+int writePNG(const std::string& output, std::vector<std::uint8_t>& data, unsigned width, unsigned height);
+
+#endif //CPP_RENDERER_H
@@ -0,0 +1,114 @@
+#include "result_cache.h"
+
+#include "file_util.h"
+#include "hash.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+// Bump when the key or the entry layout changes.
+#define RESULT_CACHE_VERSION (2)
+
+static bool readQuietly(const std::string& fileName, std::string& contents) {
+  std::ifstream ifs(fileName.c_str(), std::ios::binary);
+  if(!ifs) {
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static std::string entryPath(const std::string& cacheDir, const std::string& key, const char* extension) {
+  return cacheDir + "/" + key + extension;
+}
+
+bool renderCacheKey(const Job& job, const RenderOptions& options, ResultCacheKey& key) {
+  // The uniforms come from the .json next to the shader, as in setUniforms.
+  std::string jsonFilename(job.fragment_shader);
+  if(jsonFilename.length() < 4) {
+    return false;
+  }
+  jsonFilename.replace(jsonFilename.end() - 4, jsonFilename.end(), "json");
+
+  std::string fragContents;
+  std::string vertContents;
+  std::string uniforms;
+  if(!readQuietly(job.fragment_shader, fragContents) || !readQuietly(jsonFilename, uniforms)) {
+    return false;
+  }
+  if(options.vertex_shader.length() > 0 && !readQuietly(options.vertex_shader, vertContents)) {
+    return false;
+  }
+
+  key.inputs.clear();
+  key.inputs["fragment"] = Hasher().update(fragContents).hexDigest();
+  // The embedded vertex shader follows from the fragment shader.
+  key.inputs["vertex"] = options.vertex_shader.length() > 0 ? Hasher().update(vertContents).hexDigest() : "embedded";
+  key.inputs["uniforms"] = Hasher().update(uniforms).hexDigest();
+  key.inputs["resolution"] = std::to_string(options.width) + "x" + std::to_string(options.height);
+  key.inputs["driver"] = Hasher().update(options.driverIdentity).hexDigest();
+
+  // One line per input, none of which can contain a newline, so no two sets
+  // of inputs hash the same text.
+  Hasher hasher;
+  hasher.update("get_image render " + std::to_string(RESULT_CACHE_VERSION) + "\n");
+  for(std::map<std::string, std::string>::const_iterator it = key.inputs.begin(); it != key.inputs.end(); ++it) {
+    hasher.update(it->first + " " + it->second + "\n");
+  }
+  key.name = hasher.hexDigest();
+  return true;
+}
+
+bool fetchCachedResult(const std::string& cacheDir, const ResultCacheKey& key, const std::string& output) {
+  std::string metadata;
+  if(!readQuietly(entryPath(cacheDir, key.name, ".json"), metadata)) {
+    return false;
+  }
+  std::string pixelHash;
+  try {
+    json entry = json::parse(metadata);
+    if(entry.value("cache_version", 0) != RESULT_CACHE_VERSION) {
+      return false;
+    }
+    // A different render whose inputs hash to the same name.
+    if(entry.value("inputs", json::object()) != json(key.inputs)) {
+      std::cerr << "Warning: result cache entry " << key.name << " was made from other inputs; rendering." << std::endl;
+      return false;
+    }
+    pixelHash = entry.value("pixel_hash", std::string());
+  } catch(const std::exception& e) {
+    std::cerr << "Warning: ignoring unreadable result cache entry " << key.name << ": " << e.what() << std::endl;
+    return false;
+  }
+  if(!linkFileAtomic(entryPath(cacheDir, key.name, ".png"), output)) {
+    return false;
+  }
+  std::cout << "CACHED " << pixelHash << std::endl;
+  return true;
+}
+
+bool storeCachedResult(
+    const std::string& cacheDir,
+    const ResultCacheKey& key,
+    const std::string& output,
+    const std::vector<std::uint8_t>& pixels) {
+
+  json entry;
+  entry["cache_version"] = RESULT_CACHE_VERSION;
+  entry["inputs"] = key.inputs;
+  entry["pixel_hash"] = Hasher().update(pixels.data(), pixels.size()).hexDigest();
+  entry["output"] = output;
+
+  // The PNG goes in first: an entry only counts once its .json exists.
+  if(!makeDirectory(cacheDir) ||
+     !linkFileAtomic(output, entryPath(cacheDir, key.name, ".png")) ||
+     !writeFileAtomic(entryPath(cacheDir, key.name, ".json"), entry.dump(4) + "\n")) {
+    std::cerr << "Warning: could not add " << output << " to the result cache in " << cacheDir << std::endl;
+    return false;
+  }
+  return true;
+}
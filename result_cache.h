@@ -0,0 +1,41 @@
+#ifndef CPP_RESULT_CACHE_H
+#define CPP_RESULT_CACHE_H
+
+#include "job.h"
+#include "renderer.h"
+
+#include <cstdint>		// uint8_t, etc
+#include <map>
+#include <string>
+#include <vector>
+
+// A directory of finished renders, keyed by everything that determines the
+// pixels: fragment and vertex shader sources, the uniform JSON, the
+// resolution and the driver identity. Each entry is <name>.png plus
+// <name>.json holding the pixel hash and the digest of each input; both are
+// renamed into place, so several processes can share one directory.
+
+struct ResultCacheKey {
+  // Input ("fragment", "vertex", ...) to the hash of its contents.
+  std::map<std::string, std::string> inputs;
+  // The entry name, a hash of the input digests; empty if the job is not to
+  // be cached.
+  std::string name;
+};
+
+// Computes the key for job. Fails if an input cannot be read, in which case
+// the job is rendered without the cache.
+bool renderCacheKey(const Job& job, const RenderOptions& options, ResultCacheKey& key);
+
+// On a hit whose entry was made from the same inputs, links the cached PNG to
+// output and prints "CACHED <pixel hash>" on stdout.
+bool fetchCachedResult(const std::string& cacheDir, const ResultCacheKey& key, const std::string& output);
+
+// Adds output, just written from the given top-down RGBA pixels, under key.
+bool storeCachedResult(
+    const std::string& cacheDir,
+    const ResultCacheKey& key,
+    const std::string& output,
+    const std::vector<std::uint8_t>& pixels);
+
+#endif //CPP_RESULT_CACHE_H
@@ -0,0 +1,176 @@
+#include "timing.h"
+
+#include "perf_counters.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "json.hpp"
+using json = nlohmann::json;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct PhaseTotals {
+  size_t count;
+  double ms;
+  // Spans that had counters; threads without them add wall time only.
+  size_t counted;
+  std::uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// A span still open on some thread.
+struct OpenSpan {
+  const char* name;
+  Clock::time_point start;
+  bool counted;
+  std::uint64_t values[PERF_COUNTER_COUNT];
+};
+
+struct ThreadTiming {
+  bool triedCounters;
+  PerfCounters counters;
+  std::vector<OpenSpan> spans;
+
+  ThreadTiming() : triedCounters(false) {}
+};
+
+bool enabled = false;
+bool useCounters = false;
+std::string timingPath;
+Clock::time_point opened;
+std::mutex timingMutex;
+std::map<std::string, PhaseTotals> phases;
+// Why counters are missing, from the first thread that failed to open them.
+std::string countersError;
+bool anyCounters = false;
+// Which counters at least one thread's CPU provided.
+bool haveCounter[PERF_COUNTER_COUNT] = {};
+
+}
+
+static ThreadTiming& threadTiming() {
+  static thread_local ThreadTiming state;
+  return state;
+}
+
+bool openTiming(const std::string& path, bool counters) {
+  std::ofstream file(path.c_str());
+  if(!file) {
+    std::cerr << "Could not write timing " << path << std::endl;
+    return false;
+  }
+  timingPath = path;
+  useCounters = counters;
+  opened = Clock::now();
+  enabled = true;
+  return true;
+}
+
+bool timing() {
+  return enabled;
+}
+
+void timingBegin(const char* name) {
+  if(!enabled) {
+    return;
+  }
+  ThreadTiming& state = threadTiming();
+  if(useCounters && !state.triedCounters) {
+    state.triedCounters = true;
+    std::string error;
+    bool ok = state.counters.open(error);
+    std::lock_guard<std::mutex> lock(timingMutex);
+    if(ok) {
+      anyCounters = true;
+      for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        haveCounter[i] = haveCounter[i] || state.counters.has((PerfCounter) i);
+      }
+    } else if(countersError.empty()) {
+      countersError = error;
+      std::cerr << "Warning: no hardware counters (" << error << "); timing wall time only." << std::endl;
+    }
+  }
+  OpenSpan span;
+  span.name = name;
+  span.counted = state.counters.read(span.values);
+  // Taken last, so that reading the counters is not charged to the span.
+  span.start = Clock::now();
+  state.spans.push_back(span);
+}
+
+void timingEnd(const char* name) {
+  if(!enabled) {
+    return;
+  }
+  ThreadTiming& state = threadTiming();
+  if(state.spans.empty()) {
+    return;
+  }
+  Clock::time_point end = Clock::now();
+  std::uint64_t values[PERF_COUNTER_COUNT];
+  bool counted = state.counters.read(values);
+  const OpenSpan& span = state.spans.back();
+  std::lock_guard<std::mutex> lock(timingMutex);
+  PhaseTotals& totals = phases[span.name];
+  ++totals.count;
+  totals.ms += std::chrono::duration<double, std::milli>(end - span.start).count();
+  if(counted && span.counted) {
+    ++totals.counted;
+    for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+      totals.values[i] += values[i] - span.values[i];
+    }
+  }
+  state.spans.pop_back();
+}
+
+void closeTiming() {
+  if(!enabled) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(timingMutex);
+  enabled = false;
+
+  json out;
+  out["wall_ms"] = std::chrono::duration<double, std::milli>(Clock::now() - opened).count();
+  json counters;
+  counters["requested"] = useCounters;
+  counters["available"] = anyCounters;
+  if(!countersError.empty()) {
+    counters["error"] = countersError;
+  }
+  out["counters"] = counters;
+  json phaseList = json::object();
+  for(std::map<std::string, PhaseTotals>::const_iterator it = phases.begin(); it != phases.end(); ++it) {
+    const PhaseTotals& totals = it->second;
+    json phase;
+    phase["count"] = totals.count;
+    phase["total_ms"] = totals.ms;
+    phase["mean_ms"] = totals.count > 0 ? totals.ms / totals.count : 0.0;
+    if(totals.counted > 0) {
+      phase["counted"] = totals.counted;
+      for(int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if(haveCounter[i]) {
+          phase[perfCounterName((PerfCounter) i)] = totals.values[i];
+        }
+      }
+      if(haveCounter[PERF_INSTRUCTIONS] && totals.values[PERF_CYCLES] > 0) {
+        phase["ipc"] = (double) totals.values[PERF_INSTRUCTIONS] / totals.values[PERF_CYCLES];
+      }
+    }
+    phaseList[it->first] = phase;
+  }
+  out["phases"] = phaseList;
+
+  std::ofstream file(timingPath.c_str());
+  file << out.dump(2) << std::endl;
+  if(!file) {
+    std::cerr << "Could not write timing " << timingPath << std::endl;
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef CPP_TIMING_H
+#define CPP_TIMING_H
+
+#include <string>
+
+// Per-phase totals for --timing, fed by the same spans as --trace (see
+// trace.h): for each span name, how often it ran and its wall time, summed
+// over every thread of the process. Spans are inclusive, so "chunks" counts
+// the "deflate" inside it too.
+//
+// With counters, each thread also opens PerfCounters on its first span and
+// every phase gets the cycles, instructions, cache misses and branch misses
+// spent inside it. Where they cannot be opened the file says why and holds
+// wall times only.
+
+// Starts collecting; the file is written by closeTiming. Call before any
+// threads start.
+bool openTiming(const std::string& path, bool counters);
+
+// Writes the totals as JSON.
+void closeTiming();
+
+bool timing();
+
+void timingBegin(const char* name);
+void timingEnd(const char* name);
+
+#endif //CPP_TIMING_H
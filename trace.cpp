@@ -0,0 +1,175 @@
+#include "trace.h"
+
+#include "timing.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Buffered events are appended once there is this much of them.
+const size_t FLUSH_SIZE = 1 << 20;
+
+bool enabled = false;
+std::string tracePath;
+std::mutex traceMutex;
+std::string buffer;
+std::atomic<int> nextThreadId(1);
+
+}
+
+static int threadId() {
+  static thread_local int id = nextThreadId++;
+  return id;
+}
+
+static void appendQuoted(std::string& out, const std::string& text) {
+  out += '"';
+  for(char c : text) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if((unsigned char) c < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned) (unsigned char) c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+// One event, without the separator that follows it.
+static std::string formatEvent(const std::string& name, const char* phase, const char* argName, const std::string& arg) {
+  double ts = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  std::ostringstream fields;
+  fields.setf(std::ios::fixed);
+  fields.precision(3);
+  fields << ",\"ph\":\"" << phase << "\",\"pid\":" << getpid() << ",\"tid\":" << threadId() << ",\"ts\":" << ts;
+  std::string event = "{\"name\":";
+  appendQuoted(event, name);
+  event += fields.str();
+  if(argName != NULL) {
+    event += ",\"args\":{\"";
+    event += argName;
+    event += "\":";
+    appendQuoted(event, arg);
+    event += '}';
+  }
+  event += '}';
+  return event;
+}
+
+// Appends data to the trace in a single write, so that processes sharing the
+// file never interleave within a batch.
+static void appendToFile(const std::string& data) {
+  std::FILE* file = std::fopen(tracePath.c_str(), "ab");
+  if(file == NULL) {
+    return;
+  }
+  std::setvbuf(file, NULL, _IONBF, 0);
+  std::fwrite(data.data(), 1, data.size(), file);
+  std::fclose(file);
+}
+
+static void addEvent(const std::string& name, const char* phase, const char* argName, const std::string& arg) {
+  std::string event = formatEvent(name, phase, argName, arg);
+  std::lock_guard<std::mutex> lock(traceMutex);
+  buffer += event;
+  buffer += ",\n";
+  if(buffer.size() >= FLUSH_SIZE) {
+    appendToFile(buffer);
+    buffer.clear();
+  }
+}
+
+bool openTrace(const std::string& path) {
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if(file == NULL || std::fputs("[\n", file) < 0 || std::fclose(file) != 0) {
+    std::cerr << "Could not write trace " << path << std::endl;
+    return false;
+  }
+  tracePath = path;
+  enabled = true;
+  nameTraceProcess("get_image");
+  nameTraceThread("main");
+  return true;
+}
+
+void closeTrace() {
+  if(!enabled) {
+    return;
+  }
+  // An instant event last, so that the array ends without a separator.
+  std::string end = formatEvent("trace_end", "i", NULL, std::string());
+  std::lock_guard<std::mutex> lock(traceMutex);
+  buffer += end;
+  buffer += "\n]\n";
+  appendToFile(buffer);
+  buffer.clear();
+  enabled = false;
+}
+
+void flushTrace() {
+  if(!enabled) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if(!buffer.empty()) {
+    appendToFile(buffer);
+    buffer.clear();
+  }
+}
+
+bool tracing() {
+  return enabled || timing();
+}
+
+void nameTraceThread(const std::string& name) {
+  if(enabled) {
+    addEvent("thread_name", "M", "name", name);
+  }
+}
+
+void nameTraceProcess(const std::string& name) {
+  if(enabled) {
+    addEvent("process_name", "M", "name", name);
+  }
+}
+
+void traceBegin(const char* name, const std::string& detail) {
+  if(enabled) {
+    addEvent(name, "B", detail.empty() ? NULL : "detail", detail);
+  }
+  timingBegin(name);
+}
+
+void traceEnd(const char* name) {
+  // In the reverse order of traceBegin, so that the timing excludes writing
+  // the events.
+  timingEnd(name);
+  if(enabled) {
+    addEvent(name, "E", NULL, std::string());
+  }
+}
+
+void traceEncoderStage(const char* stage, unsigned begin, void* context) {
+  if(begin) {
+    traceBegin(stage);
+  } else {
+    traceEnd(stage);
+  }
+}
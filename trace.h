@@ -0,0 +1,73 @@
+#ifndef CPP_TRACE_H
+#define CPP_TRACE_H
+
+#include <string>
+
+// Chrome trace-event output (--trace), for chrome://tracing, Perfetto or
+// anything else that reads the JSON array format: a begin and an end event
+// per span, tagged with the process and a small per-thread id, timestamped
+// in microseconds of the monotonic clock so that forked children line up
+// with their parent.
+//
+// Events are buffered per process and appended to the file in whole
+// batches, so the parent and any forked children can share it. A process
+// must flushTrace before it forks (or the child writes the parent's buffer
+// again) and before it _Exits; events buffered when a process dies are lost.
+//
+// The same spans feed the per-phase totals of --timing (timing.h). Both are
+// off unless openTrace or openTiming succeeded; spans then cost one test of
+// a flag.
+
+// Starts the trace, truncating path. Call before any threads start.
+bool openTrace(const std::string& path);
+
+// Writes everything still buffered and closes the JSON array. Only the
+// process that opened the trace calls this, once every other process that
+// writes to it is gone.
+void closeTrace();
+
+// Appends this process's buffered events to the file.
+void flushTrace();
+
+// Whether spans are wanted, by the trace or by the timing.
+bool tracing();
+
+// Names the calling thread, or the process, in the viewer.
+void nameTraceThread(const std::string& name);
+void nameTraceProcess(const std::string& name);
+
+// name must outlive the trace (a literal, in practice). detail, if any, is
+// shown with the begin event.
+void traceBegin(const char* name, const std::string& detail = std::string());
+void traceEnd(const char* name);
+
+// lodepng's stage_callback: one span per encoding stage.
+void traceEncoderStage(const char* stage, unsigned begin, void* context);
+
+// A span for the rest of the enclosing scope.
+class TraceSpan {
+  public:
+    explicit TraceSpan(const char* name) : name(tracing() ? name : NULL) {
+      if(this->name) {
+        traceBegin(this->name);
+      }
+    }
+    TraceSpan(const char* name, const std::string& detail) : name(tracing() ? name : NULL) {
+      if(this->name) {
+        traceBegin(this->name, detail);
+      }
+    }
+    ~TraceSpan() {
+      if(name) {
+        traceEnd(name);
+      }
+    }
+
+  private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+
+    const char* const name;
+};
+
+#endif //CPP_TRACE_H
@@ -0,0 +1,94 @@
+#include "uniform_state.h"
+
+#include "renderer.h"
+
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+
+UniformState::UniformState() : program(0), uploads(0), skipped(0) {}
+
+int UniformState::reflect(GLuint program) {
+  if(program == this->program && program != 0) {
+    return EXIT_SUCCESS;
+  }
+  this->program = program;
+  uniforms.clear();
+  byName.clear();
+
+  GLint nbUniforms = 0;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &nbUniforms);
+  CHECK_ERROR("glGetProgramiv");
+  if(nbUniforms == 0) {
+    return EXIT_SUCCESS;
+  }
+
+  GLint uniformNameMaxLength = 0;
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformNameMaxLength);
+  CHECK_ERROR("glGetProgramiv");
+  std::vector<GLchar> uniformName(uniformNameMaxLength > 0 ? uniformNameMaxLength : 1);
+
+  for(GLint i = 0; i < nbUniforms; i++) {
+    Uniform uniform;
+    glGetActiveUniform(program, i, (GLsizei) uniformName.size(), NULL, &uniform.size, &uniform.type,
+                       uniformName.data());
+    CHECK_ERROR("glGetActiveUniform");
+    uniform.name = uniformName.data();
+    uniform.location = glGetUniformLocation(program, uniformName.data());
+    CHECK_ERROR("After glGetUniformLocation");
+    if(uniform.location == -1) {
+      std::cerr << "Error: Cannot find uniform named: " << uniform.name << std::endl;
+      return EXIT_FAILURE;
+    }
+    byName[uniform.name] = uniforms.size();
+    uniforms.push_back(uniform);
+  }
+  return EXIT_SUCCESS;
+}
+
+GLint UniformState::location(const std::string& name) const {
+  std::unordered_map<std::string, size_t>::const_iterator found = byName.find(name);
+  return found == byName.end() ? -1 : uniforms[found->second].location;
+}
+
+int UniformState::set(const std::string& name, const nlohmann::json& info) {
+  std::unordered_map<std::string, size_t>::const_iterator found = byName.find(name);
+  if(found == byName.end()) {
+    return EXIT_SUCCESS;
+  }
+  Uniform& uniform = uniforms[found->second];
+  if(uniform.value == info) {
+    ++skipped;
+    return EXIT_SUCCESS;
+  }
+  // A failed upload leaves the value unknown.
+  uniform.value = nullptr;
+  if(setUniform(uniform.location, name, info) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  uniform.value = info;
+  ++uploads;
+  return EXIT_SUCCESS;
+}
+
+int UniformState::setAll(const nlohmann::json& values) {
+  for(size_t i = 0; i < uniforms.size(); i++) {
+    const Uniform& uniform = uniforms[i];
+    std::cout << "UNIFORM " << i << ": " << uniform.name << " size:" << uniform.size << std::endl;
+
+    if(values.count(uniform.name) == 0) {
+      std::cerr << "Error: missing JSON entry for uniform: " << uniform.name << std::endl;
+      return EXIT_FAILURE;
+    }
+    if(set(uniform.name, values[uniform.name]) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+void UniformState::invalidate(const std::string& name) {
+  std::unordered_map<std::string, size_t>::const_iterator found = byName.find(name);
+  if(found != byName.end()) {
+    uniforms[found->second].value = nullptr;
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef CPP_UNIFORM_STATE_H
+#define CPP_UNIFORM_STATE_H
+
+#include "common.h"
+
+#include "json.hpp"
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What a program's uniforms look like and what was last uploaded to them, so
+// that a program reused across frames (a sweep, or a later job with the same
+// shaders) is reflected once and only sent the values that changed. The cost
+// of a frame then depends on how many uniforms change, not on how many the
+// program has.
+//
+// Everything is keyed by the names glGetActiveUniform reports. Uploads that
+// bypass the state (render() sets resolution itself) must be followed by
+// invalidate.
+class UniformState {
+  public:
+    UniformState();
+
+    // Queries the active uniforms of program. Does nothing if that program
+    // has already been reflected: a state belongs to one program object for
+    // as long as it lives.
+    int reflect(GLuint program);
+
+    GLuint getProgram() const { return program; }
+
+    // Number of active uniforms.
+    size_t size() const { return uniforms.size(); }
+
+    // -1 if the program has no active uniform of that name.
+    GLint location(const std::string& name) const;
+
+    // Uploads a {"func": ..., "args": [...]} entry to name, unless it is what
+    // was last uploaded there. Names the program does not use are ignored.
+    int set(const std::string& name, const nlohmann::json& info);
+
+    // set for every active uniform, from a shader's .json values. Fails if
+    // one of them has no entry, as every uniform needs a defined value.
+    int setAll(const nlohmann::json& values);
+
+    // Forgets the value last uploaded to name.
+    void invalidate(const std::string& name);
+
+    // Uploads made and skipped as unchanged, since construction.
+    size_t getUploads() const { return uploads; }
+    size_t getSkipped() const { return skipped; }
+
+  private:
+    struct Uniform {
+      std::string name;
+      GLenum type;
+      GLint size;
+      GLint location;
+      // The entry last uploaded; null if none yet.
+      nlohmann::json value;
+    };
+
+    GLuint program;
+    std::vector<Uniform> uniforms;
+    std::unordered_map<std::string, size_t> byName;
+    size_t uploads;
+    size_t skipped;
+};
+
+#endif //CPP_UNIFORM_STATE_H
@@ -0,0 +1,214 @@
+#include "uniform_sweep.h"
+
+#include "trace.h"
+
+#include <cstdlib>		// EXIT_SUCCESS, etc
+#include <iostream>
+#include <sstream>
+
+using json = nlohmann::json;
+
+// Appends every combination of the values listed in product, starting from
+// partial, with names[i] onwards still to choose.
+static void expandProduct(
+    const json& product,
+    const std::vector<std::string>& names,
+    size_t i,
+    json& partial,
+    std::vector<json>& combinations) {
+  if(i == names.size()) {
+    combinations.push_back(partial);
+    return;
+  }
+  for(const json& value : product[names[i]]) {
+    partial[names[i]] = value;
+    expandProduct(product, names, i + 1, partial, combinations);
+  }
+}
+
+bool readUniformSweep(const std::string& path, std::vector<json>& combinations) {
+  std::string contents;
+  if(!readFile(path, contents)) {
+    return false;
+  }
+  json sweep;
+  try {
+    sweep = json::parse(contents);
+  } catch(const std::exception& e) {
+    std::cerr << "Error parsing uniform sweep " << path << ": " << e.what() << std::endl;
+    return false;
+  }
+
+  combinations.clear();
+  if(sweep.is_array()) {
+    for(const json& set : sweep) {
+      if(!set.is_object()) {
+        std::cerr << "Error: uniform sweep " << path << " lists something other than a set of uniforms" << std::endl;
+        return false;
+      }
+      combinations.push_back(set);
+    }
+  } else if(sweep.is_object() && sweep.count("product") == 1 && sweep["product"].is_object()) {
+    const json& product = sweep["product"];
+    std::vector<std::string> names;
+    for(json::const_iterator it = product.begin(); it != product.end(); ++it) {
+      if(!it.value().is_array() || it.value().empty()) {
+        std::cerr << "Error: uniform sweep " << path << " needs a non-empty list of values for " << it.key()
+                  << std::endl;
+        return false;
+      }
+      names.push_back(it.key());
+    }
+    json partial = json::object();
+    expandProduct(product, names, 0, partial, combinations);
+  } else {
+    std::cerr << "Error: uniform sweep " << path << " must be a list of uniform sets or {\"product\": {...}}"
+              << std::endl;
+    return false;
+  }
+
+  if(combinations.empty()) {
+    std::cerr << "Error: uniform sweep " << path << " is empty" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::string sweepOutput(const std::string& output, size_t index, size_t count) {
+  size_t digits = 1;
+  for(size_t n = count - 1; n >= 10; n /= 10) {
+    digits++;
+  }
+  std::ostringstream number;
+  number << "_";
+  number.width(digits);
+  number.fill('0');
+  number << index;
+
+  size_t dot = output.rfind('.');
+  size_t slash = output.find_last_of("/\\");
+  if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return output + number.str();
+  }
+  return output.substr(0, dot) + number.str() + output.substr(dot);
+}
+
+// A sweep value as a full uniform entry, taking the func from base when only
+// the args are given.
+static bool resolveEntry(const json& base, const std::string& name, const json& value, json& entry) {
+  if(value.is_object()) {
+    if(value.count("func") == 0 || value.count("args") == 0) {
+      std::cerr << "Error: uniform sweep entry for " << name << " needs \"func\" and \"args\"" << std::endl;
+      return false;
+    }
+    entry = value;
+    return true;
+  }
+  if(base.count(name) == 0 || base[name].count("func") == 0) {
+    std::cerr << "Error: uniform sweep sets " << name
+              << ", which the shader's JSON does not have; give its \"func\" too" << std::endl;
+    return false;
+  }
+  entry = {
+    {"func", base[name]["func"]},
+    {"args", value.is_array() ? value : json::array({value})}
+  };
+  return true;
+}
+
+int runUniformSweep(
+    EGLDisplay display,
+    EGLSurface surface,
+    UniformState& uniforms,
+    const std::string& fragment_shader,
+    const std::vector<json>& combinations,
+    const std::string& output,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<Job>& jobs,
+    std::vector<int>& results) {
+
+  json base;
+  if(!readUniformValues(fragment_shader, base)) {
+    return EXIT_FAILURE;
+  }
+
+  // Every frame is resolved up front into the entries that differ from the
+  // frame before, so that a bad entry fails before anything is drawn and
+  // drawing a frame costs nothing for the uniforms it leaves alone.
+  std::vector<json> changes;
+  json previous = base;
+  for(const json& combination : combinations) {
+    json frame = base;
+    for(json::const_iterator it = combination.begin(); it != combination.end(); ++it) {
+      json entry;
+      if(!resolveEntry(base, it.key(), it.value(), entry)) {
+        return EXIT_FAILURE;
+      }
+      frame[it.key()] = entry;
+    }
+    json changed = json::object();
+    for(json::const_iterator it = frame.begin(); it != frame.end(); ++it) {
+      if(previous.count(it.key()) == 0 || previous[it.key()] != it.value()) {
+        changed[it.key()] = it.value();
+      }
+    }
+    changes.push_back(changed);
+    previous.swap(frame);
+  }
+
+  jobs.clear();
+  for(size_t i = 0; i < changes.size(); i++) {
+    Job job;
+    job.fragment_shader = fragment_shader;
+    job.output = sweepOutput(output, i, changes.size());
+    jobs.push_back(job);
+  }
+  results.assign(jobs.size(), EXIT_FAILURE);
+
+  EncoderPool encoders(
+      options.encoders, options.depth, std::string(), options.pack, options.packKind, jobs, results);
+
+  size_t uploadsBefore = uniforms.getUploads();
+  for(size_t i = 0; i < changes.size(); i++) {
+    watchdog.arm("uniforms");
+    int result = EXIT_SUCCESS;
+    traceBegin("setUniforms");
+    for(json::const_iterator it = changes[i].begin(); it != changes[i].end() && result == EXIT_SUCCESS; ++it) {
+      result = uniforms.set(it.key(), it.value());
+    }
+    traceEnd("setUniforms");
+
+    if(result == EXIT_SUCCESS) {
+      bool saved = false;
+      result = render(display, surface, options.width, options.height, false, 0, saved, jobs[i].output,
+                      uniforms.location("resolution"), -1, watchdog);
+      uniforms.invalidate("resolution");
+    }
+    if(result == EXIT_SUCCESS && watchdog.enabled()) {
+      result = waitForRender(watchdog);
+    }
+    Frame frame;
+    if(result == EXIT_SUCCESS) {
+      watchdog.setPhase("readback");
+      frame.job = i;
+      frame.width = options.width;
+      frame.height = options.height;
+      frame.pixels = encoders.acquireBuffer();
+      result = readPixels(options.width, options.height, frame.pixels);
+    }
+    watchdog.disarm();
+    if(result != EXIT_SUCCESS) {
+      // The program's uniforms are in an unknown state; stop here.
+      results[i] = result;
+      break;
+    }
+    encoders.submit(std::move(frame));
+  }
+
+  encoders.finish();
+  encoders.reportStats();
+  std::cerr << "Uniform sweep: " << changes.size() << " combinations, "
+            << uniforms.getUploads() - uploadsBefore << " uniform uploads." << std::endl;
+  return EXIT_SUCCESS;
+}
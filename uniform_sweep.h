@@ -0,0 +1,47 @@
+#ifndef CPP_UNIFORM_SWEEP_H
+#define CPP_UNIFORM_SWEEP_H
+
+#include "pipeline.h"
+
+#include "json.hpp"
+
+#include <string>
+#include <vector>
+
+// A sweep renders one linked program once per set of uniform overrides, on
+// top of the values in the shader's .json. The sweep file is either a list of
+// sets:
+//
+//   [{"time": [0.0]}, {"time": [0.5], "mouse": [128, 128]}]
+//
+// or the Cartesian product of per-uniform values, in name order with the
+// last name varying fastest:
+//
+//   {"product": {"time": [[0.0], [0.5], [1.0]], "injectionSwitch": [[0, 1], [1, 0]]}}
+//
+// Each value is either a full {"func": ..., "args": [...]} entry or just the
+// args, in which case the func of the shader's own entry is kept.
+bool readUniformSweep(const std::string& path, std::vector<nlohmann::json>& combinations);
+
+// out.png -> out_07.png for combination 7 of 12.
+std::string sweepOutput(const std::string& output, size_t index, size_t count);
+
+// Renders the program of uniforms, already prepared with prepareProgram, once
+// per combination into the current surface. Each frame only goes through the
+// uniforms its combination changes from the previous one, and uniforms
+// uploads only those that differ from what the program holds. Frames go
+// through an EncoderPool to sweepOutput files, or to options.pack; jobs and
+// results get one entry per combination, for reportBatch.
+int runUniformSweep(
+    EGLDisplay display,
+    EGLSurface surface,
+    UniformState& uniforms,
+    const std::string& fragment_shader,
+    const std::vector<nlohmann::json>& combinations,
+    const std::string& output,
+    const PipelineOptions& options,
+    Watchdog& watchdog,
+    std::vector<Job>& jobs,
+    std::vector<int>& results);
+
+#endif //CPP_UNIFORM_SWEEP_H
@@ -0,0 +1,115 @@
+#include "watchdog.h"
+
+#include "trace.h"
+
+#include <cstdlib>
+#include <iostream>
+
+Watchdog::Watchdog(long timeoutMs, int exitCode)
+  : timeoutMs(timeoutMs),
+    exitCode(exitCode),
+    phase("init"),
+    armed(false),
+    stopping(false),
+    stdoutReport(true) {
+  if(enabled()) {
+    thread = std::thread(&Watchdog::run, this);
+  }
+}
+
+Watchdog::~Watchdog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if(thread.joinable()) {
+    thread.join();
+  }
+}
+
+void Watchdog::arm(const char* phase) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->phase = phase;
+    start = Clock::now();
+    deadline = start + std::chrono::milliseconds(timeoutMs);
+    armed = true;
+  }
+  wake.notify_all();
+  if(phaseListener) {
+    phaseListener(phase);
+  }
+}
+
+void Watchdog::disarm() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    armed = false;
+  }
+  wake.notify_all();
+}
+
+void Watchdog::setPhase(const char* phase) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->phase = phase;
+  }
+  if(phaseListener) {
+    phaseListener(phase);
+  }
+}
+
+void Watchdog::setPhaseListener(std::function<void(const char*)> listener) {
+  phaseListener = listener;
+}
+
+const char* Watchdog::currentPhase() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return phase;
+}
+
+long Watchdog::remainingMs() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(!armed) {
+    return timeoutMs;
+  }
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+  return left > 0 ? (long) left : 0;
+}
+
+void Watchdog::expire() {
+  const char* expiredPhase;
+  long long elapsedMs;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    expiredPhase = phase;
+    elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+  }
+  std::cerr << "Timeout: render exceeded " << timeoutMs << " ms during phase '" << expiredPhase
+            << "' (" << elapsedMs << " ms elapsed)." << std::endl;
+  if(stdoutReport) {
+    std::cout << "TIMEOUT " << expiredPhase << std::endl;
+  }
+  // The spans so far show what the render was doing when it hung.
+  flushTrace();
+  // Skip static destructors and atexit handlers: they would call back into a
+  // driver that may never return.
+  std::_Exit(exitCode);
+}
+
+void Watchdog::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(!stopping) {
+    if(!armed) {
+      wake.wait(lock);
+      continue;
+    }
+    if(Clock::now() < deadline) {
+      wake.wait_until(lock, deadline);
+      continue;
+    }
+    lock.unlock();
+    expire();
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef CPP_WATCHDOG_H
+#define CPP_WATCHDOG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Bounds the time spent rendering a single shader.
+//
+// The render path polls remainingMs() between bounded waits (e.g. on a fence)
+// and calls expire() itself when the budget runs out. As a backstop, a
+// background thread fires if the GL thread is stuck inside a blocking driver
+// call (glCompileShader, glReadPixels, ...) when the deadline passes.
+//
+// Firing reports the phase that was active and terminates the process
+// immediately with the given exit code: once a driver has hung, neither
+// destructors nor eglTerminate can be relied upon to return.
+class Watchdog {
+  public:
+    Watchdog(long timeoutMs, int exitCode);
+    ~Watchdog();
+
+    bool enabled() const { return timeoutMs > 0; }
+
+    // Starts a new budget of timeoutMs for the next render.
+    void arm(const char* phase);
+    void disarm();
+
+    void setPhase(const char* phase);
+    const char* currentPhase();
+
+    // Called on the GL thread with each new phase (from arm and setPhase), so
+    // a supervising process can tell where a crashed render was.
+    void setPhaseListener(std::function<void(const char*)> listener);
+
+    // Whether expiring also prints "TIMEOUT <phase>" on stdout (the default);
+    // off where stdout carries machine-readable records.
+    void setStdoutReport(bool report) { stdoutReport = report; }
+
+    // Milliseconds left before the deadline; never negative.
+    long remainingMs();
+
+    [[noreturn]] void expire();
+
+  private:
+    void run();
+
+    typedef std::chrono::steady_clock Clock;
+
+    const long timeoutMs;
+    const int exitCode;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    Clock::time_point start;
+    Clock::time_point deadline;
+    const char* phase;
+    std::function<void(const char*)> phaseListener;
+    bool armed;
+    bool stopping;
+    bool stdoutReport;
+};
+
+#endif //CPP_WATCHDOG_H